@@ -1,17 +1,22 @@
+#include <stdatomic.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 
 #include <sys/signal.h>
 
+#include "src/async.h"
 #include "src/default_callbacks.h"
 #include "src/http.h"
 #include "src/net.h"
 #include "src/settings.h"
+#include "src/static.h"
 
 void handle_home(struct response_t *res, struct request_t *req) {
   res->status = HTTP_STATUS_OK;
   response_headers_append(res, "Content-Type", "text/html");
-  res->body = new_string_literal(
+  string_append_literal(
+      &res->body,
       "<html><title>Home</title><body><h1>Home page</h1><p>Welcome to the home "
       "page!</p></body></html>");
 }
@@ -22,18 +27,133 @@ void handle_root(struct response_t *res, struct request_t *req) {
 
 void handler_parrot(struct response_t *res, struct request_t *req) {
   res->status = HTTP_STATUS_OK;
-  char buff[1024];
-  if (headers_get(&req->headers, buff, sizeof(buff), "Content-Type") == 0) {
-    response_headers_append(res, "Content-Type", buff);
+  char const *const content_type =
+      request_header(req, HTTP_HEADER_CONTENT_TYPE, NULL);
+  if (content_type != NULL) {
+    response_headers_append(res, "Content-Type", content_type);
   }
 
-  res->body = new_string(req->body, req->content_length);
+  string_append(&res->body, req->body, req->content_length);
 }
 
+void handler_hello(struct response_t *res, struct request_t *req) {
+  size_t len;
+  char const *const name = request_param(req, "name", &len);
+
+  res->status = HTTP_STATUS_OK;
+  string_append_literal(&res->body, "Hello, ");
+  string_append(&res->body, name, len);
+  string_append(&res->body, "!\n", 2);
+}
+
+// Count the bytes of an upload as they arrive, without keeping them
+int handler_upload_body(struct request_t *req, char const *data, size_t len) {
+  size_t *received = req->body_context;
+  if (received == NULL) {
+    received = arena_alloc(req->arena, sizeof(*received));
+    if (received == NULL) {
+      return -1;
+    }
+    *received = 0;
+    req->body_context = received;
+  }
+
+  *received += len;
+  return 0;
+}
+
+void handler_upload(struct response_t *res, struct request_t *req) {
+  size_t const *const received = req->body_context;
+
+  char buff[64];
+  int const len = snprintf(buff, sizeof(buff), "Received %zu bytes\n",
+                           received != NULL ? *received : 0);
+
+  res->status = HTTP_STATUS_OK;
+  string_append(&res->body, buff, len);
+}
+
+struct numbers {
+  unsigned long next;
+  unsigned long last;
+};
+
+// Append the next lines of numbers, a few at a time
+int numbers_produce(void *context, struct string_t *out) {
+  struct numbers *const numbers = context;
+
+  char line[32];
+  for (int i = 0; i < 256 && numbers->next <= numbers->last; ++i) {
+    int const len = snprintf(line, sizeof(line), "%lu\n", numbers->next++);
+    if (string_append(out, line, len) != 0) {
+      return -1;
+    }
+  }
+
+  return numbers->next > numbers->last ? 1 : 0;
+}
+
+// Stream the numbers from 1 to the count, one per line, without building the
+// whole body first
+void handler_numbers(struct response_t *res, struct request_t *req) {
+  size_t len;
+  char const *const count = request_param(req, "count", &len);
+
+  struct numbers *const numbers = malloc(sizeof(*numbers));
+  if (numbers == NULL) {
+    res->status = HTTP_STATUS_INTERNAL_SERVER_ERROR;
+    return;
+  }
+  *numbers = (struct numbers){
+      .next = 1,
+      .last = strtoul(count, NULL, 10),
+  };
+
+  res->status = HTTP_STATUS_OK;
+  response_headers_append(res, "Content-Type", "text/plain");
+  response_stream(res, numbers_produce, free, numbers, -1);
+}
+
+void handler_slept(struct response_t *res, struct request_t *req,
+                   void *context) {
+  if (res == NULL) {
+    return;
+  }
+  res->status = HTTP_STATUS_OK;
+  string_append_literal(&res->body, "Sleeping for 1 second\n");
+}
+
+// Sleeps without holding up the thread, which serves others meanwhile
 void handler_sleep(struct response_t *res, struct request_t *req) {
+  if (response_suspend_for(res, 1000, handler_slept, NULL) != 0) {
+    res->status = HTTP_STATUS_INTERNAL_SERVER_ERROR;
+  }
+}
+
+// Reports take a while to build, so they are cached
+atomic_uint reports_built;
+char const *const report_vary[] = {"Accept-Language", NULL};
+
+void handler_report(struct response_t *res, struct request_t *req) {
+  size_t len;
+  char const *const name = request_param(req, "name", &len);
+  size_t language_len = 0;
+  char const *const language =
+      request_header_find(req, "Accept-Language", &language_len);
+
+  usleep(200 * 1000);
+  unsigned const build = atomic_fetch_add(&reports_built, 1) + 1;
+
+  char line[64];
+  int const n = snprintf(line, sizeof(line), "Report #%u for ", build);
   res->status = HTTP_STATUS_OK;
-  res->body = new_string_literal("Sleeping for 1 second\n");
-  sleep(1);
+  string_append(&res->body, line, n);
+  string_append(&res->body, name, len);
+  if (language != NULL) {
+    string_append_literal(&res->body, " in ");
+    string_append(&res->body, language, language_len);
+  }
+  string_append(&res->body, "\n", 1);
 }
 
 volatile bool interrupted = false;
@@ -49,13 +169,37 @@ int main(int argc, char **argv) {
   };
 
   struct httpserver *server = new_httpserver();
+  server->keepalive_timeout = settings.keepalive_timeout;
+  server->keepalive_max_requests = settings.keepalive_max_requests;
+  server->limits = settings.limits;
+  server->compression = settings.compression;
+  server->cache_size = settings.cache_size;
 
-  int sockfd = bind_and_listen(&addr, 1024);
-  if (sockfd < 0) {
-    exiterr(1, "could not bind/listen");
+  int *sockfds = calloc(settings.shards, sizeof(*sockfds));
+  if (sockfds == NULL) {
+    exiterr(1, "could not allocate sockets");
   }
 
-  if (httpserver_register(server, "GET", "/home", handle_home) != 0) {
+  for (unsigned i = 0; i < settings.shards; ++i) {
+    sockfds[i] = settings.shards == 1 ? bind_and_listen(&addr, 1024)
+                                      : bind_and_listen_reuseport(&addr, 1024);
+    if (sockfds[i] < 0) {
+      exiterr(1, "could not bind/listen");
+    }
+  }
+
+  // The home page never changes: it is serialized once, up front
+  struct frozen_response home;
+  struct response_t *const home_res = new_response(-1, NULL);
+  if (home_res == NULL) {
+    exiterr(1, "could not build home page");
+  }
+  handle_home(home_res, NULL);
+  if (response_freeze(home_res, &home) != 0) {
+    exiterr(1, "could not build home page");
+  }
+
+  if (httpserver_register_frozen(server, "GET", "/home", &home) != 0) {
     exiterr(1, "could not register home handler");
   }
 
@@ -71,11 +215,45 @@ int main(int argc, char **argv) {
     exiterr(1, "could not register sleep handler");
   }
 
+  if (httpserver_register(server, "GET", "/hello/:name", handler_hello) != 0) {
+    exiterr(1, "could not register hello handler");
+  }
+
+  if (httpserver_register(server, "GET", "/numbers/:count", handler_numbers) !=
+      0) {
+    exiterr(1, "could not register numbers handler");
+  }
+
+  if (httpserver_register_cached(server, "GET", "/report/:name",
+                                 handler_report, 5, report_vary) != 0) {
+    exiterr(1, "could not register report handler");
+  }
+
+  if (httpserver_register_streaming(server, "POST", "/upload",
+                                    handler_upload_body, handler_upload) != 0) {
+    exiterr(1, "could not register upload handler");
+  }
+
+  struct static_dir assets = {.fd = -1};
+  if (settings.static_dir != NULL) {
+    if (static_dir_open(&assets, settings.static_dir) != 0) {
+      exiterr(1, "could not open static directory");
+    }
+
+    if (httpserver_register_context(server, "GET", "/static/*path",
+                                    callback_static, &assets) != 0) {
+      exiterr(1, "could not register static handler");
+    }
+  }
+
   char fmt[128];
   format_address(fmt, sizeof(fmt), &addr);
   printf("Listening to %s\n", fmt);
   fflush(stdout);
 
+  // Clients closing their end must not kill the server
+  signal(SIGPIPE, SIG_IGN);
+
   signal(SIGINT, interrupt_handler);
   signal(SIGTERM, interrupt_handler);
   signal(SIGQUIT, interrupt_handler);
@@ -83,13 +261,21 @@ int main(int argc, char **argv) {
   sigaddset(&server->interruptmask, SIGTERM);
   sigaddset(&server->interruptmask, SIGQUIT);
 
-  if (httpserver_serve(server, sockfd, settings.max_threads, &interrupted) !=
-      0) {
+  if (httpserver_serve_sharded(server, sockfds, settings.shards,
+                               settings.max_threads, settings.mode,
+                               &interrupted) != 0) {
     exiterr(1, "could not serve\n");
   }
 
   httpserver_free(server);
-  close(sockfd);
+  frozen_response_free(&home);
+  if (assets.fd >= 0) {
+    static_dir_close(&assets);
+  }
+  for (unsigned i = 0; i < settings.shards; ++i) {
+    close(sockfds[i]);
+  }
+  free(sockfds);
 
   printf("Exited\n");
   return 0;
@@ -0,0 +1,128 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "objpool.h"
+
+#define arena_align(n) (((n) + 15) & ~(size_t)15)
+
+void arena_init(struct arena *const arena) {
+  *arena = (struct arena){
+      .head = NULL,
+      .last = NULL,
+  };
+}
+
+void arena_free(struct arena *const arena) {
+  struct arena_block *block = arena->head;
+  while (block != NULL) {
+    struct arena_block *const prev = block->prev;
+    arena_block_pool_put(block);
+    block = prev;
+  }
+  arena_init(arena);
+}
+
+struct arena_block *new_arena_block(size_t const size) {
+  if (size == arena_block_size) {
+    // Blocks of the default size are recycled across connections
+    return arena_block_pool_get();
+  }
+
+  struct arena_block *const block = malloc(sizeof(*block) + size);
+  if (block == NULL) {
+    return NULL;
+  }
+
+  block->prev = NULL;
+  block->size = size;
+  block->used = 0;
+  return block;
+}
+
+void arena_reset(struct arena *const arena) {
+  arena->last = NULL;
+  if (arena->head == NULL) {
+    return;
+  }
+
+  if (arena->head->prev == NULL) {
+    arena->head->used = 0;
+    return;
+  }
+
+  // Replace the chain with a single block big enough for all of it, so that
+  // the next request of the same size fits in it
+  size_t total = 0;
+  for (struct arena_block *b = arena->head; b != NULL; b = b->prev) {
+    total += b->size;
+  }
+
+  arena_free(arena);
+  if (total > arena_max_retained) {
+    total = arena_block_size;
+  }
+  arena->head = new_arena_block(total);
+}
+
+void *arena_alloc(struct arena *const arena, size_t size) {
+  size = arena_align(size);
+
+  struct arena_block *block = arena->head;
+  if (block == NULL || block->size - block->used < size) {
+    size_t const block_size = size > arena_block_size ? size : arena_block_size;
+    block = new_arena_block(block_size);
+    if (block == NULL) {
+      return NULL;
+    }
+    block->prev = arena->head;
+    arena->head = block;
+  }
+
+  char *const ptr = block->data + block->used;
+  block->used += size;
+  arena->last = ptr;
+  return ptr;
+}
+
+void *arena_realloc(struct arena *const arena, void *const ptr,
+                    size_t const old_size, size_t const new_size) {
+  if (ptr == NULL) {
+    return arena_alloc(arena, new_size);
+  }
+
+  if (new_size <= old_size) {
+    return ptr;
+  }
+
+  struct arena_block *const block = arena->head;
+  if (ptr == arena->last) {
+    // Grow in place when the block has room
+    size_t const offset = (char *)ptr - block->data;
+    size_t const size = arena_align(new_size);
+    if (block->size - offset >= size) {
+      block->used = offset + size;
+      return ptr;
+    }
+  }
+
+  void *const moved = arena_alloc(arena, new_size);
+  if (moved == NULL) {
+    return NULL;
+  }
+  memcpy(moved, ptr, old_size);
+  return moved;
+}
+
+char *arena_strndup(struct arena *const arena, char const *const str,
+                    size_t const len) {
+  size_t const n = strnlen(str, len);
+  char *const copy = arena_alloc(arena, n + 1);
+  if (copy == NULL) {
+    return NULL;
+  }
+  memcpy(copy, str, n);
+  copy[n] = '\0';
+  return copy;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stddef.h>
+
+struct arena_block {
+  struct arena_block *prev;
+  size_t size;
+  size_t used;
+  _Alignas(16) char data[];
+};
+
+// Bump-pointer allocator. Allocations are never freed one by one: they are
+// all released at once by arena_reset, which keeps enough memory around that
+// the next request of a similar size allocates nothing from malloc.
+struct arena {
+  // Block allocations are served from. Earlier blocks are chained behind it.
+  struct arena_block *head;
+
+  // Most recent allocation, which arena_realloc can grow in place
+  char *last;
+};
+
+#define arena_block_size (16 * 1024)
+
+// Memory kept across resets at most
+#define arena_max_retained (1024 * 1024)
+
+void arena_init(struct arena *arena);
+
+// Release all the memory of the arena
+void arena_free(struct arena *arena);
+
+// Release every allocation at once, keeping the memory for later
+void arena_reset(struct arena *arena);
+
+// Allocate size bytes, aligned to 16 bytes. Returns NULL on failure.
+void *arena_alloc(struct arena *arena, size_t size);
+
+// Grow an allocation, in place if it was the last one
+void *arena_realloc(struct arena *arena, void *ptr, size_t old_size,
+                    size_t new_size);
+
+// Copy at most len bytes of the string into the arena, null-terminated
+char *arena_strndup(struct arena *arena, char const *str, size_t len);
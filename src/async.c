@@ -0,0 +1,91 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#include "async.h"
+
+struct response_async *response_async_new(struct response_t *const res,
+                                          int const fd, unsigned const refs,
+                                          response_resumer const resume,
+                                          void *const context) {
+  struct response_async *const async = malloc(sizeof(*async));
+  if (async == NULL) {
+    close(fd);
+    return NULL;
+  }
+
+  async->fd = fd;
+  async->resume = resume;
+  async->context = context;
+  atomic_init(&async->refs, refs);
+  res->async = async;
+  return async;
+}
+
+void response_async_release(struct response_async *const async) {
+  if (atomic_fetch_sub(&async->refs, 1) == 1) {
+    close(async->fd);
+    free(async);
+  }
+}
+
+struct response_async *response_suspend(struct response_t *const res,
+                                        response_resumer const resume,
+                                        void *const context) {
+  int const fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (fd < 0) {
+    return NULL;
+  }
+  return response_async_new(res, fd, 2, resume, context);
+}
+
+int response_suspend_for(struct response_t *const res, unsigned const ms,
+                         response_resumer const resume, void *const context) {
+  int const fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (fd < 0) {
+    return -1;
+  }
+
+  // A zero expiration would disarm the timer
+  struct itimerspec const spec = {
+      .it_value =
+          {
+              .tv_sec = ms / 1000,
+              .tv_nsec = ms % 1000 * 1000000 + (ms == 0),
+          },
+  };
+  if (timerfd_settime(fd, 0, &spec, NULL) != 0) {
+    close(fd);
+    return -1;
+  }
+
+  // Nobody else completes a timer
+  return response_async_new(res, fd, 1, resume, context) != NULL ? 0 : -1;
+}
+
+void response_async_complete(struct response_async *const async) {
+  // Only fails if the counter would overflow, which a single write cannot do
+  uint64_t const one = 1;
+  ssize_t const written = write(async->fd, &one, sizeof(one));
+  (void)written;
+  response_async_release(async);
+}
+
+void response_async_resume(struct response_async *const async,
+                           struct response_t *const res,
+                           struct request_t *const req) {
+  if (async->resume != NULL) {
+    async->resume(res, req, async->context);
+  }
+  response_async_release(async);
+}
+
+void response_async_cancel(struct response_async *const async) {
+  if (async->resume != NULL) {
+    async->resume(NULL, NULL, async->context);
+  }
+  response_async_release(async);
+}
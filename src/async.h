@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdatomic.h>
+
+#include "http.h"
+
+// Suspended responses: handlers that have to wait, for a timer or for work
+// done elsewhere, return without completing their response, and it is
+// completed later on the thread serving the connection.
+//
+// Every suspended response has a file descriptor that becomes readable once
+// it can be completed: an eventfd written by response_async_complete, or a
+// timerfd. The event and io_uring loops wait for it alongside their sockets,
+// so a waiting response costs no thread. In the threads mode the connection
+// leaves its worker and waits with the others in a single epoll set, until it
+// goes back to the pool's queue to be completed.
+//
+// The connection answers no further requests until the response is complete,
+// so that responses stay in order.
+
+// Completes a suspended response. Called exactly once per suspension, on the
+// thread serving the connection, with the response and its request. Both are
+// NULL if the connection went away first, for the context to be released. It
+// may suspend the response again, to be called once more later.
+typedef void (*response_resumer)(struct response_t *res, struct request_t *req,
+                                 void *context);
+
+struct response_async {
+  // Readable once the response can be completed
+  int fd;
+
+  response_resumer resume;
+  void *context;
+
+  // The connection's, and that of whoever completes an eventfd
+  atomic_uint refs;
+};
+
+// Suspend the response until response_async_complete is called on the result,
+// from any thread. Call at most once, before returning from the handler or the
+// resumer. Returns NULL on error, with the response left as it was.
+struct response_async *response_suspend(struct response_t *res,
+                                        response_resumer resume,
+                                        void *context);
+
+// Suspend the response for ms milliseconds. Returns -1 on error, with the
+// response left as it was.
+int response_suspend_for(struct response_t *res, unsigned ms,
+                         response_resumer resume, void *context);
+
+// Let the suspended response be completed. Call exactly once for every
+// response_suspend; the result may be freed right away.
+void response_async_complete(struct response_async *async);
+
+// Complete the suspended response on the thread serving its connection
+void response_async_resume(struct response_async *async,
+                           struct response_t *res, struct request_t *req);
+
+// Drop the suspended response of a connection that went away
+void response_async_cancel(struct response_async *async);
@@ -0,0 +1,417 @@
+#define _GNU_SOURCE // Required for strcasestr
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "async.h"
+#include "cache.h"
+#include "eventloop.h"
+
+struct response_cache *response_cache_new(size_t const budget) {
+  struct response_cache *const cache = malloc(sizeof(*cache));
+  if (cache == NULL) {
+    return NULL;
+  }
+
+  for (size_t i = 0; i < cache_shards; ++i) {
+    struct cache_shard *const shard = &cache->shards[i];
+    *shard = (struct cache_shard){
+        .newest = NULL,
+        .oldest = NULL,
+        .len = 0,
+        .bytes = 0,
+        .budget = budget / cache_shards,
+    };
+    pthread_mutex_init(&shard->lock, NULL);
+  }
+
+  cache->routes = NULL;
+  atomic_init(&cache->hits, 0);
+  atomic_init(&cache->misses, 0);
+  atomic_init(&cache->evictions, 0);
+  return cache;
+}
+
+// Let the requests waiting for a pending entry look it up again
+void cache_wake(struct cache_waiter *waiter) {
+  while (waiter != NULL) {
+    struct cache_waiter *const next = waiter->next;
+    response_async_complete(waiter->async);
+    free(waiter);
+    waiter = next;
+  }
+}
+
+void cache_entry_free(struct cache_entry *const entry) {
+  cache_wake(entry->waiters);
+  frozen_response_free(&entry->frozen);
+  free(entry->key);
+  free(entry);
+}
+
+void response_cache_free(struct response_cache *const cache) {
+  for (size_t i = 0; i < cache_shards; ++i) {
+    struct cache_shard *const shard = &cache->shards[i];
+    while (shard->newest != NULL) {
+      struct cache_entry *const entry = shard->newest;
+      shard->newest = entry->older;
+      cache_entry_free(entry);
+    }
+    pthread_mutex_destroy(&shard->lock);
+  }
+
+  while (cache->routes != NULL) {
+    struct cache_route *const route = cache->routes;
+    cache->routes = route->next;
+    free(route);
+  }
+  free(cache);
+}
+
+struct cache_route *response_cache_route(struct response_cache *const cache,
+                                         httpserver_callback const handler,
+                                         unsigned const ttl,
+                                         char const *const *const vary) {
+  struct cache_route *const route = malloc(sizeof(*route));
+  if (route == NULL) {
+    return NULL;
+  }
+
+  *route = (struct cache_route){
+      .cache = cache,
+      .handler = handler,
+      .ttl = ttl,
+      .vary = vary,
+      .next = cache->routes,
+  };
+  cache->routes = route;
+  return route;
+}
+
+void response_cache_stats(struct response_cache *const cache,
+                          struct response_cache_stats *const stats) {
+  *stats = (struct response_cache_stats){
+      .hits = atomic_load(&cache->hits),
+      .misses = atomic_load(&cache->misses),
+      .evictions = atomic_load(&cache->evictions),
+      .entries = 0,
+      .bytes = 0,
+  };
+
+  for (size_t i = 0; i < cache_shards; ++i) {
+    struct cache_shard *const shard = &cache->shards[i];
+    pthread_mutex_lock(&shard->lock);
+    stats->entries += shard->len;
+    stats->bytes += shard->bytes;
+    pthread_mutex_unlock(&shard->lock);
+  }
+}
+
+void response_cache_print_stats(struct response_cache *const cache) {
+  struct response_cache_stats stats;
+  response_cache_stats(cache, &stats);
+
+  printf("cache {\n");
+  printf("  hits: %zu\n", stats.hits);
+  printf("  misses: %zu\n", stats.misses);
+  printf("  evictions: %zu\n", stats.evictions);
+  printf("  entries: %zu\n", stats.entries);
+  printf("  bytes: %zu\n", stats.bytes);
+  printf("}\n");
+}
+
+// The method, the path and the values of the headers the route varies on,
+// each null-terminated
+int cache_key(struct string_t *const key, struct request_t const *const req,
+              char const *const *const vary) {
+  if (string_append(key, req->method, strlen(req->method) + 1) != 0 ||
+      string_append(key, req->path, strlen(req->path) + 1) != 0) {
+    return -1;
+  }
+
+  for (size_t i = 0; vary != NULL && vary[i] != NULL; ++i) {
+    size_t len = 0;
+    char const *const value = request_header_find(req, vary[i], &len);
+    if ((value != NULL && string_append(key, value, len) != 0) ||
+        string_push(key, '\0') != 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+size_t cache_hash(char const *const key, size_t const len) {
+  // FNV-1a
+  size_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < len; ++i) {
+    hash = (hash ^ (unsigned char)key[i]) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+struct cache_entry **cache_bucket(struct cache_shard *const shard,
+                                  size_t const hash) {
+  return &shard->buckets[hash / cache_shards % cache_buckets];
+}
+
+struct cache_entry *cache_find(struct cache_shard *const shard,
+                               char const *const key, size_t const len,
+                               size_t const hash) {
+  struct cache_entry *entry = *cache_bucket(shard, hash);
+  while (entry != NULL &&
+         (entry->hash != hash || entry->key_len != len ||
+          memcmp(entry->key, key, len) != 0)) {
+    entry = entry->chain;
+  }
+  return entry;
+}
+
+// Make the entry the most recently used of a shard it is not in yet
+void cache_link(struct cache_shard *const shard,
+                struct cache_entry *const entry) {
+  struct cache_entry **const bucket = cache_bucket(shard, entry->hash);
+  entry->chain = *bucket;
+  *bucket = entry;
+
+  entry->newer = NULL;
+  entry->older = shard->newest;
+  if (shard->newest != NULL) {
+    shard->newest->newer = entry;
+  } else {
+    shard->oldest = entry;
+  }
+  shard->newest = entry;
+
+  ++shard->len;
+  shard->bytes += entry->bytes;
+}
+
+// Take the entry out of its shard, without freeing it
+void cache_unlink(struct cache_shard *const shard,
+                  struct cache_entry *const entry) {
+  struct cache_entry **link = cache_bucket(shard, entry->hash);
+  while (*link != entry) {
+    link = &(*link)->chain;
+  }
+  *link = entry->chain;
+
+  if (entry->newer != NULL) {
+    entry->newer->older = entry->older;
+  } else {
+    shard->newest = entry->older;
+  }
+  if (entry->older != NULL) {
+    entry->older->newer = entry->newer;
+  } else {
+    shard->oldest = entry->newer;
+  }
+
+  --shard->len;
+  shard->bytes -= entry->bytes;
+}
+
+// Make the entry the most recently used
+void cache_touch(struct cache_shard *const shard,
+                 struct cache_entry *const entry) {
+  if (shard->newest != entry) {
+    cache_unlink(shard, entry);
+    cache_link(shard, entry);
+  }
+}
+
+// Evict the least recently used entries until the shard is within its budget.
+// Pending entries are left for their handlers to fill.
+void cache_evict(struct response_cache *const cache,
+                 struct cache_shard *const shard) {
+  struct cache_entry *entry = shard->oldest;
+  while (entry != NULL && shard->bytes > shard->budget) {
+    struct cache_entry *const newer = entry->newer;
+    if (!entry->pending) {
+      cache_unlink(shard, entry);
+      cache_entry_free(entry);
+      atomic_fetch_add(&cache->evictions, 1);
+    }
+    entry = newer;
+  }
+}
+
+// Whether the handler's response may be stored and sent to other clients
+bool cache_storable(struct response_t const *const res) {
+  if (res->status != HTTP_STATUS_OK || res->frozen != NULL ||
+      res->async != NULL ||
+      response_stream_active(&res->stream) ||
+      response_header(res, "Set-Cookie") != NULL) {
+    return false;
+  }
+
+  char const *const control = response_header(res, "Cache-Control");
+  return control == NULL || (strcasestr(control, "no-store") == NULL &&
+                             strcasestr(control, "private") == NULL);
+}
+
+// Answer with a copy of the stored response, which may be evicted as soon as
+// the shard is unlocked
+int cache_send(struct response_t *const res, struct request_t const *const req,
+               struct frozen_response const *const frozen) {
+  struct frozen_response *const copy = arena_alloc(res->arena, sizeof(*copy));
+  char *const data = arena_alloc(res->arena, frozen->len);
+  if (copy == NULL || data == NULL) {
+    return -1;
+  }
+
+  memcpy(data, frozen->data, frozen->len);
+  *copy = *frozen;
+  copy->data = data;
+  response_send_frozen(res, req, copy);
+  return 0;
+}
+
+// Claim the key for the caller, which is to fill it with the response of the
+// handler. Returns NULL on error.
+struct cache_entry *cache_claim(struct cache_shard *const shard,
+                                char const *const key, size_t const len,
+                                size_t const hash) {
+  struct cache_entry *const entry = malloc(sizeof(*entry));
+  char *const copy = malloc(len);
+  if (entry == NULL || copy == NULL) {
+    free(entry);
+    free(copy);
+    return NULL;
+  }
+
+  memcpy(copy, key, len);
+  *entry = (struct cache_entry){
+      .key = copy,
+      .key_len = len,
+      .hash = hash,
+      .frozen = {.data = NULL, .len = 0, .head_len = 0},
+      .pending = true,
+      .waiters = NULL,
+      .expires = 0,
+      .bytes = sizeof(*entry) + len,
+  };
+  cache_link(shard, entry);
+  return entry;
+}
+
+void cache_serve(struct cache_route *route, struct response_t *res,
+                 struct request_t *req);
+
+// Look the key up again once the entry it waited for is filled or dropped
+void cache_resume(struct response_t *const res, struct request_t *const req,
+                  void *const context) {
+  if (res != NULL) {
+    cache_serve(context, res, req);
+  }
+}
+
+// Suspend the response until the pending entry is filled or dropped, so that
+// the thread serves other connections meanwhile. Call with the shard locked.
+// Returns -1 on error, with the response left as it was.
+int cache_wait(struct cache_entry *const entry, struct response_t *const res,
+               struct cache_route *const route) {
+  struct cache_waiter *const waiter = malloc(sizeof(*waiter));
+  if (waiter == NULL) {
+    return -1;
+  }
+
+  waiter->async = response_suspend(res, cache_resume, route);
+  if (waiter->async == NULL) {
+    free(waiter);
+    return -1;
+  }
+  waiter->next = entry->waiters;
+  entry->waiters = waiter;
+  return 0;
+}
+
+// Answer from the cache, wait for the response of the request already running
+// the handler for the key, or run it and store its response
+void cache_serve(struct cache_route *const route, struct response_t *const res,
+                 struct request_t *const req) {
+  struct response_cache *const cache = route->cache;
+
+  struct string_t key = arena_string(res->arena);
+  if (res->arena == NULL || cache_key(&key, req, route->vary) != 0) {
+    string_free(&key);
+    route->handler(res, req);
+    return;
+  }
+
+  size_t const hash = cache_hash(key.data, key.len);
+  struct cache_shard *const shard = &cache->shards[hash % cache_shards];
+
+  pthread_mutex_lock(&shard->lock);
+  struct cache_entry *entry = cache_find(shard, key.data, key.len, hash);
+  if (entry != NULL && entry->pending) {
+    // Another request is running the handler: its response will do
+    int const err = cache_wait(entry, res, route);
+    pthread_mutex_unlock(&shard->lock);
+    if (err != 0) {
+      route->handler(res, req);
+    }
+    return;
+  }
+
+  if (entry != NULL && entry->expires <= monotonic_seconds()) {
+    cache_unlink(shard, entry);
+    cache_entry_free(entry);
+    entry = NULL;
+  }
+
+  if (entry != NULL) {
+    cache_touch(shard, entry);
+    int const err = cache_send(res, req, &entry->frozen);
+    pthread_mutex_unlock(&shard->lock);
+
+    if (err == 0) {
+      atomic_fetch_add(&cache->hits, 1);
+      response_headers_append(res, "X-Cache", "HIT");
+      return;
+    }
+    route->handler(res, req);
+    return;
+  }
+
+  entry = cache_claim(shard, key.data, key.len, hash);
+  pthread_mutex_unlock(&shard->lock);
+  atomic_fetch_add(&cache->misses, 1);
+
+  route->handler(res, req);
+
+  struct frozen_response frozen;
+  bool const stored = entry != NULL && cache_storable(res) &&
+                      response_freeze_copy(res, &frozen) == 0;
+
+  if (entry != NULL) {
+    pthread_mutex_lock(&shard->lock);
+    struct cache_waiter *const waiters = entry->waiters;
+    entry->waiters = NULL;
+    if (stored) {
+      shard->bytes += frozen.len;
+      entry->bytes += frozen.len;
+      entry->frozen = frozen;
+      entry->pending = false;
+      entry->expires = monotonic_seconds() + route->ttl;
+      cache_evict(cache, shard);
+    } else {
+      // Whoever waited for it runs the handler on its own
+      cache_unlink(shard, entry);
+      cache_entry_free(entry);
+    }
+    pthread_mutex_unlock(&shard->lock);
+    cache_wake(waiters);
+  }
+
+  response_headers_append(res, "X-Cache", "MISS");
+}
+
+void callback_cached(struct response_t *res, struct request_t *req) {
+  struct cache_route *const route = req->handler.context;
+
+  // The handler gets no context of its own
+  req->handler.context = NULL;
+  cache_serve(route, res, req);
+}
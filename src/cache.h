@@ -0,0 +1,135 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+#include "http.h"
+
+// In-memory cache of the responses of opt-in routes, registered with
+// httpserver_register_cached.
+//
+// Responses are stored frozen, keyed on the method, the path and the values
+// of the request headers the route varies on. Entries live for the TTL of
+// their route, and the least recently used are evicted to keep the cache
+// within its byte budget.
+//
+// The cache is split into shards, each with its own lock, LRU list and an
+// even slice of the budget, so that threads rarely wait for each other. While
+// a miss runs the handler, concurrent requests for the same key wait for its
+// response instead of running the handler as well. They wait suspended, like
+// the responses of async handlers, so their threads serve other connections
+// meanwhile.
+//
+// Only successful responses, buffered and not suspended, are stored, never
+// those with Set-Cookie or a Cache-Control of no-store or private. Hits are
+// sent as stored, without compression.
+
+// Shards of the cache, each with its own lock
+#define cache_shards 16
+
+// Buckets of the hash table of each shard
+#define cache_buckets 256
+
+// A request waiting for a pending entry, with its response suspended
+struct cache_waiter {
+  struct response_async *async;
+  struct cache_waiter *next;
+};
+
+// An entry of the cache, pending while its handler runs
+struct cache_entry {
+  char *key;
+  size_t key_len;
+  size_t hash;
+
+  // Empty while pending
+  struct frozen_response frozen;
+  bool pending;
+
+  // Requests waiting for the pending entry
+  struct cache_waiter *waiters;
+
+  // When it expires, from monotonic_seconds
+  time_t expires;
+
+  // Bytes it takes from the budget
+  size_t bytes;
+
+  // Neighbours in the LRU list, most recently used first
+  struct cache_entry *newer;
+  struct cache_entry *older;
+
+  // Next entry in the same hash bucket
+  struct cache_entry *chain;
+};
+
+struct cache_shard {
+  pthread_mutex_t lock;
+
+  struct cache_entry *buckets[cache_buckets];
+  struct cache_entry *newest;
+  struct cache_entry *oldest;
+
+  size_t len;
+  size_t bytes;
+  size_t budget;
+};
+
+// A route whose responses are cached
+struct cache_route {
+  struct response_cache *cache;
+  httpserver_callback handler;
+  unsigned ttl;
+
+  // Request headers the response depends on, NULL-terminated, or NULL
+  char const *const *vary;
+
+  struct cache_route *next;
+};
+
+struct response_cache {
+  struct cache_shard shards[cache_shards];
+
+  // Routes using the cache, freed with it
+  struct cache_route *routes;
+
+  atomic_size_t hits;
+  atomic_size_t misses;
+  atomic_size_t evictions;
+};
+
+// Counters of the cache, as of when they are read
+struct response_cache_stats {
+  size_t hits;
+  size_t misses;
+  size_t evictions;
+  size_t entries;
+  size_t bytes;
+};
+
+// Create a cache keeping budget bytes of responses at most. Returns NULL on
+// error.
+struct response_cache *response_cache_new(size_t budget);
+
+void response_cache_free(struct response_cache *cache);
+
+// Add a route using the cache, to register with callback_cached as its
+// context. Returns NULL on error.
+struct cache_route *response_cache_route(struct response_cache *cache,
+                                         httpserver_callback handler,
+                                         unsigned ttl,
+                                         char const *const *vary);
+
+void response_cache_stats(struct response_cache *cache,
+                          struct response_cache_stats *stats);
+
+// Print the counters of the cache to stdout
+void response_cache_print_stats(struct response_cache *cache);
+
+// Handler answering from the cache, or calling the handler of the
+// struct cache_route registered as its context on a miss. Responses say
+// which it was with an X-Cache header of HIT or MISS.
+void callback_cached(struct response_t *res, struct request_t *req);
@@ -0,0 +1,352 @@
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <zlib.h>
+
+#include "compress.h"
+
+// Bytes of output room added at a time while a stream is compressed
+#define compress_piece (16 * 1024)
+
+// Deflate streams of a thread, one per coding, reset and reused by every
+// buffered response
+struct compress_state {
+  z_stream streams[3];
+  int levels[3];
+};
+
+_Thread_local struct compress_state *compress_state;
+
+pthread_key_t compress_state_key;
+pthread_once_t compress_state_once = PTHREAD_ONCE_INIT;
+
+// A streamed body compressed as it is produced. Wraps the stream of the
+// response, which it releases once it ends.
+struct compress_stream {
+  response_producer produce;
+  void (*release)(void *context);
+  void *context;
+
+  z_stream z;
+
+  // Latest piece of the uncompressed body
+  struct string_t piece;
+};
+
+// Window bits that make zlib write the coding's wrapper, or none for a raw
+// deflate stream
+int compress_window_bits(enum content_coding const coding) {
+  switch (coding) {
+  case CONTENT_CODING_GZIP:
+    return MAX_WBITS + 16;
+  case CONTENT_CODING_DEFLATE:
+    return MAX_WBITS;
+  case CONTENT_CODING_IDENTITY:
+    break;
+  }
+  return -MAX_WBITS;
+}
+
+int compress_init(z_stream *const z, enum content_coding const coding,
+                  int const level) {
+  *z = (z_stream){.zalloc = Z_NULL, .zfree = Z_NULL, .opaque = Z_NULL};
+  return deflateInit2(z, level, Z_DEFLATED, compress_window_bits(coding), 8,
+                      Z_DEFAULT_STRATEGY) == Z_OK
+             ? 0
+             : -1;
+}
+
+void compress_state_free(void *const context) {
+  struct compress_state *const state = context;
+  for (int i = 0; i < 3; ++i) {
+    if (state->levels[i] != 0) {
+      deflateEnd(&state->streams[i]);
+    }
+  }
+  free(state);
+}
+
+void compress_state_create_key() {
+  pthread_key_create(&compress_state_key, compress_state_free);
+}
+
+// The thread's stream for the coding at the level, ready for a new body.
+// Streams are allocated on first use and freed with the thread.
+z_stream *compress_state_get(enum content_coding const coding,
+                             int const level) {
+  if (compress_state == NULL) {
+    pthread_once(&compress_state_once, compress_state_create_key);
+    compress_state = calloc(1, sizeof(*compress_state));
+    if (compress_state == NULL) {
+      return NULL;
+    }
+    pthread_setspecific(compress_state_key, compress_state);
+  }
+
+  z_stream *const z = &compress_state->streams[coding];
+  int *const current = &compress_state->levels[coding];
+  if (*current == level) {
+    return deflateReset(z) == Z_OK ? z : NULL;
+  }
+
+  if (*current != 0) {
+    deflateEnd(z);
+    *current = 0;
+  }
+  if (compress_init(z, coding, level) != 0) {
+    return NULL;
+  }
+  *current = level;
+  return z;
+}
+
+// Run the data through the stream and append what comes out to out, until
+// every byte is taken and flushed as asked
+int compress_deflate(z_stream *const z, char const *const data,
+                     size_t const len, int const flush,
+                     struct string_t *const out) {
+  z->next_in = (Bytef *)data;
+  z->avail_in = 0;
+  size_t left = len;
+
+  while (true) {
+    if (z->avail_in == 0) {
+      z->avail_in = left < UINT_MAX ? left : UINT_MAX;
+      left -= z->avail_in;
+    }
+    if (out->cap - out->len < compress_piece &&
+        string_reserve(out, out->len + compress_piece) != 0) {
+      return -1;
+    }
+
+    size_t const room = out->cap - out->len;
+    z->next_out = (Bytef *)out->data + out->len;
+    z->avail_out = room < UINT_MAX ? room : UINT_MAX;
+    int const status = deflate(z, left > 0 ? Z_NO_FLUSH : flush);
+    out->len = (char *)z->next_out - out->data;
+
+    if (status == Z_STREAM_END) {
+      return 0;
+    }
+    if (status != Z_OK && status != Z_BUF_ERROR) {
+      return -1;
+    }
+    // Output only stops short of the room once nothing is pending
+    if (flush != Z_FINISH && left == 0 && z->avail_in == 0 &&
+        z->avail_out > 0) {
+      return 0;
+    }
+  }
+}
+
+int compress_encode(enum content_coding const coding, int level,
+                    char const *const data, size_t const len,
+                    struct string_t *const out) {
+  level = level < 1 ? 1 : level > 9 ? 9 : level;
+
+  z_stream *const z = compress_state_get(coding, level);
+  if (z == NULL) {
+    return -1;
+  }
+
+  // Room for the worst case, so that the body goes through in one call
+  if (string_reserve(out, out->len + deflateBound(z, len)) != 0) {
+    return -1;
+  }
+  return compress_deflate(z, data, len, Z_FINISH, out);
+}
+
+// Produce the next piece of the wrapped stream and append it compressed.
+// Compressed data comes out in blocks, so pieces are produced until one is.
+int compress_stream_produce(void *const context, struct string_t *const out) {
+  struct compress_stream *const stream = context;
+  size_t const start = out->len;
+
+  int status = 0;
+  while (status == 0 && out->len == start) {
+    stream->piece.len = 0;
+    status = stream->produce(stream->context, &stream->piece);
+    if (status < 0 ||
+        compress_deflate(&stream->z, stream->piece.data, stream->piece.len,
+                         status == 1 ? Z_FINISH : Z_NO_FLUSH, out) != 0) {
+      return -1;
+    }
+  }
+  return status;
+}
+
+void compress_stream_release(void *const context) {
+  struct compress_stream *const stream = context;
+  if (stream->release != NULL) {
+    stream->release(stream->context);
+  }
+  deflateEnd(&stream->z);
+  string_free(&stream->piece);
+  free(stream);
+}
+
+// Compress the streamed body of the response as it is produced. Its length
+// is not known in advance anymore, so it is sent in chunks.
+int compress_stream(struct response_t *const res,
+                    enum content_coding const coding, int level) {
+  level = level < 1 ? 1 : level > 9 ? 9 : level;
+
+  struct compress_stream *const stream = malloc(sizeof(*stream));
+  if (stream == NULL) {
+    return -1;
+  }
+  if (compress_init(&stream->z, coding, level) != 0) {
+    free(stream);
+    return -1;
+  }
+
+  stream->produce = res->stream.produce;
+  stream->release = res->stream.release;
+  stream->context = res->stream.context;
+  stream->piece = null_string();
+
+  res->stream.produce = compress_stream_produce;
+  res->stream.release = compress_stream_release;
+  res->stream.context = stream;
+  res->stream.remaining = -1;
+  res->stream.length = -1;
+  res->stream.chunked = true;
+  return 0;
+}
+
+char const *content_coding_name(enum content_coding const coding) {
+  switch (coding) {
+  case CONTENT_CODING_GZIP:
+    return "gzip";
+  case CONTENT_CODING_DEFLATE:
+    return "deflate";
+  case CONTENT_CODING_IDENTITY:
+    break;
+  }
+  return "identity";
+}
+
+// Quality the Accept-Encoding value gives the coding, directly or through
+// "*", or -1 if it lists neither
+double compress_quality(char const *accept, char const *const name) {
+  double quality = -1;
+  double wildcard = -1;
+
+  while (accept != NULL && *accept != '\0') {
+    accept += strspn(accept, " \t,");
+    size_t const len = strcspn(accept, " \t,;");
+    char const *const item = accept;
+    accept += len;
+
+    double q = 1;
+    char const *const end = accept + strcspn(accept, ",");
+    char const *const param = strstr(accept, "q=");
+    if (param != NULL && param < end) {
+      q = strtod(param + 2, NULL);
+    }
+
+    if (len == strlen(name) && strncasecmp(item, name, len) == 0) {
+      quality = q;
+    } else if (len == 1 && *item == '*') {
+      wildcard = q;
+    }
+    accept = end;
+  }
+
+  return quality >= 0 ? quality : wildcard;
+}
+
+bool compress_accepts(char const *const accept_encoding,
+                      enum content_coding const coding) {
+  return compress_quality(accept_encoding, content_coding_name(coding)) > 0;
+}
+
+enum content_coding compress_negotiate(char const *const accept_encoding) {
+  double const gzip = compress_quality(accept_encoding, "gzip");
+  double const deflate = compress_quality(accept_encoding, "deflate");
+  if (gzip <= 0 && deflate <= 0) {
+    return CONTENT_CODING_IDENTITY;
+  }
+  return gzip >= deflate ? CONTENT_CODING_GZIP : CONTENT_CODING_DEFLATE;
+}
+
+// Whether bodies of the media type shrink when compressed. Untyped bodies
+// are taken to be text.
+bool compress_type(char const *const type) {
+  return type == NULL || strncasecmp(type, "text/", 5) == 0 ||
+         strstr(type, "json") != NULL || strstr(type, "xml") != NULL ||
+         strstr(type, "javascript") != NULL;
+}
+
+int compress_response(struct response_t *const res,
+                      struct request_t const *const req,
+                      struct compression_settings const *const settings) {
+  // Streams are measured by their length, if they announce one
+  bool const streamed = response_stream_active(&res->stream);
+  size_t const size = !streamed                ? res->body.len
+                      : res->stream.length < 0 ? SIZE_MAX
+                                               : (size_t)res->stream.length;
+  if (settings->level <= 0 || req == NULL || res->frozen != NULL ||
+      res->stream.file >= 0 || size < settings->min_size || res->status < 200 ||
+      res->status == HTTP_STATUS_NO_CONTENT ||
+      res->status == HTTP_STATUS_NOT_MODIFIED ||
+      response_header(res, "Content-Encoding") != NULL ||
+      !compress_type(response_header(res, "Content-Type"))) {
+    return 0;
+  }
+
+  // Caches must tell the encodings apart, whichever this client gets
+  if (response_headers_append(res, "Vary", "Accept-Encoding") != 0) {
+    return -1;
+  }
+
+  char const *const accept =
+      request_header(req, HTTP_HEADER_ACCEPT_ENCODING, NULL);
+  enum content_coding const coding = compress_negotiate(accept);
+  if (coding == CONTENT_CODING_IDENTITY) {
+    return 0;
+  }
+
+  if (streamed) {
+    if (compress_stream(res, coding, settings->level) != 0) {
+      return -1;
+    }
+  } else {
+    struct string_t out = res->body.arena != NULL
+                              ? arena_string(res->body.arena)
+                              : null_string();
+    if (compress_encode(coding, settings->level, res->body.data,
+                        res->body.len, &out) != 0) {
+      string_free(&out);
+      return -1;
+    }
+
+    if (out.len >= res->body.len) {
+      // Not worth it
+      string_free(&out);
+      return 0;
+    }
+
+    string_free(&res->body);
+    res->body = out;
+  }
+
+  // The compressed body is another representation, with a tag of its own
+  char tagged[128];
+  char const *const etag = response_header(res, "ETag");
+  size_t const etag_len = etag != NULL ? strlen(etag) : 0;
+  if (etag_len >= 2 && etag_len + 16 <= sizeof(tagged) &&
+      etag[etag_len - 1] == '"') {
+    snprintf(tagged, sizeof(tagged), "%.*s-%s\"", (int)(etag_len - 1), etag,
+             content_coding_name(coding));
+    response_headers_set(res, "ETag", tagged);
+  }
+
+  return response_headers_append(res, "Content-Encoding",
+                                 content_coding_name(coding));
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "http.h"
+#include "string_t.h"
+
+// Response compression, negotiated from Accept-Encoding.
+//
+// Bodies are compressed with zlib. Buffered bodies go through a deflate stream
+// kept per thread and reset for every response. Streamed bodies get a stream
+// of their own, are compressed piece by piece as they are produced, and are
+// sent in chunks. File bodies are left alone, so that they keep going out with
+// sendfile: static files are served precompressed instead.
+
+enum content_coding {
+  CONTENT_CODING_IDENTITY,
+  CONTENT_CODING_GZIP,
+  CONTENT_CODING_DEFLATE,
+};
+
+// Name of the coding, as in Content-Encoding
+char const *content_coding_name(enum content_coding coding);
+
+// Whether the Accept-Encoding value, which may be NULL, accepts the coding
+bool compress_accepts(char const *accept_encoding, enum content_coding coding);
+
+// Coding the client prefers among the supported ones, by quality value
+enum content_coding compress_negotiate(char const *accept_encoding);
+
+// Append the data to out compressed as a raw deflate stream, or in the gzip
+// or zlib wrapper for the codings of the same names. Levels go from 1, the
+// fastest, to 9, the smallest. Returns -1 if out cannot grow.
+int compress_encode(enum content_coding coding, int level, char const *data,
+                    size_t len, struct string_t *out);
+
+// Compress the body of the response if the client accepts it and it is worth
+// it: it is not read from a file, no smaller than the configured minimum if
+// its length is known, of a textual type and not already encoded. Runs between
+// the handler and serialization. Returns -1 on error, leaving the response
+// uncompressed.
+int compress_response(struct response_t *res, struct request_t const *req,
+                      struct compression_settings const *settings);
@@ -0,0 +1,210 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "conditional.h"
+#include "httpdate.h"
+
+// Mix the bits of x, as in splitmix64
+uint64_t etag_mix(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+void etag_format(char out[etag_size], uint64_t const hash) {
+  static char const hex[] = "0123456789abcdef";
+  out[0] = '"';
+  for (int i = 0; i < 16; ++i) {
+    out[1 + i] = hex[(hash >> (60 - 4 * i)) & 0xf];
+  }
+  out[17] = '"';
+  out[18] = '\0';
+}
+
+void etag_from_data(char out[etag_size], char const *const data,
+                    size_t const len) {
+  // Eight bytes at a time
+  uint64_t hash = 0x9e3779b97f4a7c15ULL ^ len;
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t word;
+    memcpy(&word, data + i, 8);
+    hash = etag_mix(hash ^ word);
+  }
+
+  uint64_t tail = 0;
+  memcpy(&tail, data + i, len - i);
+  etag_format(out, etag_mix(hash ^ tail));
+}
+
+void etag_from_stat(char out[etag_size], struct stat const *const st) {
+  uint64_t hash = etag_mix(st->st_ino);
+  hash = etag_mix(hash ^ st->st_size);
+  hash = etag_mix(hash ^ st->st_mtim.tv_sec);
+  etag_format(out, etag_mix(hash ^ st->st_mtim.tv_nsec));
+}
+
+// Find the opaque part of the tag, between the quotes, without a weak prefix
+// or a content coding suffix. Returns false if it is not a quoted tag.
+bool etag_opaque(char const *tag, size_t len, char const **const opaque,
+                 size_t *const opaque_len) {
+  if (len >= 2 && tag[0] == 'W' && tag[1] == '/') {
+    tag += 2;
+    len -= 2;
+  }
+  if (len < 2 || tag[0] != '"' || tag[len - 1] != '"') {
+    return false;
+  }
+
+  *opaque = tag + 1;
+  *opaque_len = len - 2;
+
+  static char const *const codings[] = {"-gzip", "-deflate"};
+  for (size_t i = 0; i < sizeof(codings) / sizeof(codings[0]); ++i) {
+    size_t const n = strlen(codings[i]);
+    if (*opaque_len > n &&
+        memcmp(*opaque + *opaque_len - n, codings[i], n) == 0) {
+      *opaque_len -= n;
+      break;
+    }
+  }
+  return true;
+}
+
+// Weak comparison, which is what If-None-Match uses
+bool etag_match(char const *const a, size_t const a_len, char const *const b,
+                size_t const b_len) {
+  char const *x;
+  char const *y;
+  size_t x_len;
+  size_t y_len;
+  return etag_opaque(a, a_len, &x, &x_len) &&
+         etag_opaque(b, b_len, &y, &y_len) && x_len == y_len &&
+         memcmp(x, y, x_len) == 0;
+}
+
+// Whether the If-None-Match list has the tag, or is "*"
+bool etag_list_match(char const *list, char const *const etag) {
+  size_t const etag_len = strlen(etag);
+  while (*list != '\0') {
+    list += strspn(list, " \t,");
+    if (*list == '\0') {
+      break;
+    }
+
+    // Tags may have commas inside their quotes
+    char const *end = list;
+    if (end[0] == 'W' && end[1] == '/') {
+      end += 2;
+    }
+    if (*end == '"') {
+      char const *const close = strchr(end + 1, '"');
+      end = close != NULL ? close + 1 : end + strlen(end);
+    } else {
+      end += strcspn(end, " \t,");
+    }
+
+    size_t const len = end - list;
+    if ((len == 1 && *list == '*') || etag_match(list, len, etag, etag_len)) {
+      return true;
+    }
+    list = end;
+  }
+  return false;
+}
+
+bool request_not_modified(struct request_t const *const req,
+                          char const *const etag, time_t const last_modified) {
+  // The tag is more precise than the date: when both are sent, only the tag
+  // counts
+  char const *const none_match =
+      request_header(req, HTTP_HEADER_IF_NONE_MATCH, NULL);
+  if (none_match != NULL) {
+    return etag != NULL && etag_list_match(none_match, etag);
+  }
+
+  char const *const modified_since =
+      request_header(req, HTTP_HEADER_IF_MODIFIED_SINCE, NULL);
+  if (modified_since == NULL || last_modified < 0) {
+    return false;
+  }
+
+  time_t const since = http_date_parse(modified_since);
+  return since >= 0 && last_modified <= since;
+}
+
+// Only safe methods are answered with 304
+bool request_conditional(struct request_t const *const req) {
+  return req != NULL && (strcmp(req->method, "GET") == 0 ||
+                         strcmp(req->method, "HEAD") == 0);
+}
+
+// Turn the response into a 304 without a body
+void response_not_modified(struct response_t *const res) {
+  res->status = HTTP_STATUS_NOT_MODIFIED;
+  res->body.len = 0;
+  response_stream_end(&res->stream);
+}
+
+bool response_validate(struct response_t *const res,
+                       struct request_t const *const req,
+                       char const *const etag, time_t const last_modified) {
+  if (etag != NULL) {
+    response_headers_set(res, "ETag", etag);
+  }
+
+  if (last_modified >= 0) {
+    char date[http_date_len + 1];
+    http_date_format(last_modified, date);
+    response_headers_set(res, "Last-Modified", date);
+  }
+
+  if (!request_conditional(req) ||
+      !request_not_modified(req, etag, last_modified)) {
+    return false;
+  }
+
+  response_not_modified(res);
+  return true;
+}
+
+void conditional_response(struct response_t *const res,
+                          struct request_t const *const req) {
+  if (!request_conditional(req) || res->status != HTTP_STATUS_OK) {
+    return;
+  }
+
+  if (res->frozen != NULL) {
+    struct frozen_response const *const frozen = res->frozen;
+    if (frozen->etag[0] != '\0' &&
+        request_not_modified(req, frozen->etag, -1)) {
+      res->frozen = NULL;
+      response_not_modified(res);
+      response_headers_set(res, "ETag", frozen->etag);
+    }
+    return;
+  }
+
+  if (response_stream_active(&res->stream)) {
+    return;
+  }
+
+  // Handlers may have tagged the response themselves
+  char buff[etag_size];
+  char const *etag = response_header(res, "ETag");
+  if (etag == NULL) {
+    if (res->body.len == 0) {
+      return;
+    }
+    etag_from_data(buff, res->body.data, res->body.len);
+    response_headers_set(res, "ETag", buff);
+    etag = buff;
+  }
+
+  if (request_not_modified(req, etag, -1)) {
+    response_not_modified(res);
+  }
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdbool.h>
+#include <time.h>
+
+#include <sys/stat.h>
+
+#include "http.h"
+
+// Conditional requests: validators for responses, and 304 Not Modified for
+// clients whose cached copy is still fresh.
+//
+// Responses are identified by a strong entity tag: a hash of the body for
+// buffered responses, or the inode, size and modification time of files.
+// Compressed bodies carry the tag of the uncompressed one with the coding
+// appended, as in "0123456789abcdef-gzip", and match it when compared.
+
+// Tag the data with a hash of its contents
+void etag_from_data(char out[etag_size], char const *data, size_t len);
+
+// Tag a file by its metadata, without reading it
+void etag_from_stat(char out[etag_size], struct stat const *st);
+
+// Whether the request's If-None-Match, or failing that If-Modified-Since,
+// says the client already has the response with the validators. The last
+// modification time may be -1 if unknown.
+bool request_not_modified(struct request_t const *req, char const *etag,
+                          time_t last_modified);
+
+// Validator hook for handlers, to call before building the body. Sets the
+// ETag, and Last-Modified unless it is -1. If the client's copy is fresh, the
+// response becomes a bodiless 304 and it returns true: the handler can return
+// right away.
+bool response_validate(struct response_t *res, struct request_t const *req,
+                       char const *etag, time_t last_modified);
+
+// Tag successful responses to GET and HEAD that have a buffered body and no
+// tag yet, and answer 304 instead if the client has them. Frozen responses
+// are tagged when frozen. Runs between the handler and compression.
+void conditional_response(struct response_t *res, struct request_t const *req);
@@ -0,0 +1,359 @@
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+
+#include "async.h"
+#include "compress.h"
+#include "conditional.h"
+#include "connection.h"
+#include "eventloop.h"
+#include "range.h"
+#include "shard.h"
+
+#define connection_read_size 4096
+
+void connection_init(struct connection *const conn, int const fd,
+                     struct sockaddr_in const *const addr,
+                     struct httpserver_shard *const shard) {
+  *conn = (struct connection){
+      .fd = fd,
+      .addr = *addr,
+      .shard = shard,
+      .in = null_string(),
+      .out = null_string(),
+      .out_offset = 0,
+      .stream =
+          {
+              .produce = NULL,
+              .file = -1,
+              .segment = NULL,
+          },
+      .suspended = NULL,
+      .suspended_req = NULL,
+      .served = 0,
+      .peer_closed = false,
+      .closing = false,
+      .linger = false,
+      .lingered = 0,
+      .linger_until = 0,
+  };
+  arena_init(&conn->arena);
+  parser_init(&conn->parser, &conn->arena, &shard->server->limits);
+}
+
+void connection_free(struct connection *const conn) {
+  response_stream_end(&conn->stream);
+  if (conn->suspended != NULL) {
+    // Cancels the suspension
+    response_free(conn->suspended);
+    free_request(conn->suspended_req);
+  }
+  parser_free(&conn->parser);
+  arena_free(&conn->arena);
+  string_free(&conn->in);
+  string_free(&conn->out);
+  conn->in = null_string();
+  conn->out = null_string();
+}
+
+ssize_t connection_read(struct connection *const conn) {
+  if (string_reserve(&conn->in, conn->in.len + connection_read_size) != 0) {
+    errno = ENOMEM;
+    return -1;
+  }
+
+  ssize_t const n = read(conn->fd, conn->in.data + conn->in.len,
+                         conn->in.cap - conn->in.len);
+  if (n > 0) {
+    conn->in.len += n;
+  } else if (n == 0) {
+    conn->peer_closed = true;
+  }
+
+  return n;
+}
+
+// Finish the response the handler completed and queue it for output.
+// Everything the request and its response allocated is released once the
+// response is serialized, so the arena holds at most one request at a time.
+void connection_complete(struct connection *const conn,
+                         struct request_t *const req,
+                         struct response_t *const res, bool keep_alive) {
+  struct httpserver *const server = conn->shard->server;
+
+  conditional_response(res, req);
+  compress_response(res, req, &server->compression);
+  range_response(res, req);
+
+  bool const streamed = response_stream_active(&res->stream);
+  if (streamed && res->stream.chunked && req != NULL &&
+      strcmp(req->protocol, "HTTP/1.1") != 0) {
+    // Older clients do not know chunks: the body ends with the connection
+    res->stream.chunked = false;
+    keep_alive = false;
+  }
+  response_set_keep_alive(res, req, keep_alive);
+  free_request(req);
+
+  response_serialize(res, &conn->out);
+  if (streamed) {
+    // The head goes out right away, and the body as the output drains
+    conn->stream = res->stream;
+    res->stream.produce = NULL;
+    res->stream.file = -1;
+  }
+  response_free(res);
+  arena_reset(&conn->arena);
+  conn->closing |= !keep_alive;
+}
+
+// Answer the request, or reject it with the error status if it is NULL.
+// Responses suspended by their handler are completed by connection_resume.
+void connection_respond(struct connection *const conn, size_t thread_id,
+                        struct request_t *const req,
+                        enum http_status const error) {
+  struct httpserver *const server = conn->shard->server;
+
+  struct response_t *res = new_response(conn->fd, &conn->arena);
+  if (res == NULL) {
+    static char const err[] = "HTTP/1.1 500 Internal Server Error\r\n\r\n";
+    string_append(&conn->out, err, sizeof(err) - 1);
+    free_request(req);
+    arena_reset(&conn->arena);
+    conn->closing = true;
+    return;
+  }
+
+  ++conn->served;
+  bool const keep_alive = request_keep_alive(req) &&
+                          conn->served < server->keepalive_max_requests;
+
+  if (req == NULL) {
+    res->status = error;
+  }
+  httpserver_dispatch(conn->shard, req, res, thread_id, &conn->addr);
+
+  if (res->async != NULL) {
+    // The request and the response keep the arena until then
+    conn->suspended = res;
+    conn->suspended_req = req;
+    conn->suspended_keep_alive = keep_alive;
+    return;
+  }
+  connection_complete(conn, req, res, keep_alive);
+}
+
+void connection_resume(struct connection *const conn) {
+  struct response_t *const res = conn->suspended;
+  struct request_t *const req = conn->suspended_req;
+  conn->suspended = NULL;
+  conn->suspended_req = NULL;
+
+  struct response_async *const async = res->async;
+  res->async = NULL;
+  response_async_resume(async, res, req);
+
+  if (res->async != NULL) {
+    // Suspended again by the resumer
+    conn->suspended = res;
+    conn->suspended_req = req;
+    return;
+  }
+  connection_complete(conn, req, res, conn->suspended_keep_alive);
+}
+
+// Parse and answer the requests in data until one of them closes the
+// connection, or streams or suspends its response. Returns the number of
+// bytes consumed.
+size_t connection_parse(struct connection *const conn, char const *const data,
+                        size_t const len, size_t const thread_id) {
+  size_t consumed = 0;
+
+  while (!conn->closing && !connection_blocked(conn) && consumed < len) {
+    ssize_t const n =
+        parser_feed(&conn->parser, data + consumed, len - consumed);
+
+    // Route the request as soon as its head is complete, so that the body
+    // goes wherever the route wants it
+    bool const routed = n >= 0 && parser_head_done(&conn->parser);
+    if (routed) {
+      httpserver_route(conn->shard->server, conn->parser.req);
+    }
+
+    if (n < 0 || (routed && parser_start_body(&conn->parser) != 0)) {
+      // Malformed or oversized request: answer with an error and close. The
+      // request being parsed is dropped before its arena is reset.
+      enum http_status const error = conn->parser.error;
+      conn->closing = true;
+      conn->linger = true;
+      parser_free(&conn->parser);
+      connection_respond(conn, thread_id, NULL, error);
+      break;
+    }
+    consumed += n;
+
+    struct request_t *const req = parser_consume(&conn->parser);
+    if (req != NULL) {
+      connection_respond(conn, thread_id, req, HTTP_STATUS_OK);
+    }
+  }
+
+  // Incomplete request: wait for more data unless the peer is gone
+  if (!connection_blocked(conn)) {
+    conn->closing |= conn->peer_closed;
+  }
+  return consumed;
+}
+
+void connection_feed(struct connection *const conn, char const *const data,
+                     size_t const len, size_t const thread_id) {
+  size_t consumed = 0;
+  if (conn->in.len == 0) {
+    consumed = connection_parse(conn, data, len, thread_id);
+  }
+
+  // Whatever is left waits for the stream to end or the response to be
+  // resumed, after what came before it
+  if (!conn->closing &&
+      string_append(&conn->in, data + consumed, len - consumed) != 0) {
+    conn->closing = true;
+  }
+}
+
+void connection_process(struct connection *const conn,
+                        size_t const thread_id) {
+  size_t const consumed =
+      connection_parse(conn, conn->in.data, conn->in.len, thread_id);
+
+  // The parser keeps its own copy of whatever it needs
+  conn->in.len -= consumed;
+  memmove(conn->in.data, conn->in.data + consumed, conn->in.len);
+}
+
+// Output kept ahead of the socket while a body is streamed
+#define connection_stream_window (64 * 1024)
+
+int connection_fill(struct connection *const conn, bool const read_files) {
+  while (connection_streaming(conn) &&
+         (read_files || !response_stream_sending_file(&conn->stream)) &&
+         conn->out.len - conn->out_offset < connection_stream_window) {
+    if (response_stream_next(&conn->stream, &conn->out) != 0) {
+      // The response cannot be completed
+      conn->closing = true;
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int connection_flush(struct connection *const conn) {
+  size_t writes = 0;
+  int retval = 0;
+
+  while (true) {
+    if (conn->out_offset == conn->out.len) {
+      conn->out.len = 0;
+      conn->out_offset = 0;
+    }
+
+    // Streamed bodies are produced only as fast as the socket takes them
+    if (connection_fill(conn, false) != 0) {
+      retval = -1;
+      break;
+    }
+
+    bool const sending_file = conn->out_offset == conn->out.len &&
+                              response_stream_sending_file(&conn->stream);
+    if (conn->out_offset == conn->out.len && !sending_file) {
+      break;
+    }
+
+    if (sending_file) {
+      // Everything before the file is out: the rest skips userspace
+      ++writes;
+      if (response_stream_sendfile(&conn->stream, conn->fd) >= 0) {
+        continue;
+      }
+    } else {
+      // The head of a file body is held back until the file joins it
+      int const more = conn->stream.file >= 0 ? MSG_MORE : 0;
+      ssize_t const n = send(conn->fd, conn->out.data + conn->out_offset,
+                             conn->out.len - conn->out_offset,
+                             MSG_NOSIGNAL | more);
+      ++writes;
+      if (n >= 0) {
+        conn->out_offset += n;
+        continue;
+      }
+    }
+
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      break;
+    }
+
+    if (errno != EINTR) {
+      retval = -1;
+      break;
+    }
+  }
+
+  if (writes > 0) {
+    atomic_fetch_add(&conn->shard->writes, writes);
+  }
+  return retval;
+}
+
+bool connection_pending_output(struct connection const *const conn) {
+  return conn->out_offset < conn->out.len || connection_blocked(conn);
+}
+
+bool connection_streaming(struct connection const *const conn) {
+  return response_stream_active(&conn->stream);
+}
+
+bool connection_linger(struct connection *const conn) {
+  if (!conn->linger || conn->peer_closed || shutdown(conn->fd, SHUT_WR) != 0) {
+    return false;
+  }
+  conn->linger_until = monotonic_seconds() + connection_linger_seconds;
+  return true;
+}
+
+bool connection_lingering(struct connection const *const conn) {
+  return conn->linger_until != 0;
+}
+
+int connection_discard(struct connection *const conn) {
+  char buf[4096];
+  while (conn->lingered < connection_linger_bytes) {
+    ssize_t const n = recv(conn->fd, buf, sizeof(buf), MSG_DONTWAIT);
+    if (n > 0) {
+      conn->lingered += n;
+      continue;
+    }
+
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return monotonic_seconds() < conn->linger_until ? 0 : -1;
+    }
+    break;
+  }
+  return -1;
+}
+
+bool connection_suspended(struct connection const *const conn) {
+  return conn->suspended != NULL;
+}
+
+bool connection_blocked(struct connection const *const conn) {
+  return connection_streaming(conn) || connection_suspended(conn);
+}
+
+int connection_async_fd(struct connection const *const conn) {
+  return conn->suspended != NULL ? conn->suspended->async->fd : -1;
+}
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <stdbool.h>
+#include <time.h>
+
+#include <netinet/in.h>
+#include <sys/types.h>
+
+#include "arena.h"
+#include "http.h"
+#include "parser.h"
+#include "string_t.h"
+
+// Buffered state of a client connection, shared by every serving mode.
+//
+// Received bytes are fed to the parser, and every complete request is answered
+// in order. Responses accumulate in the output buffer
+// so that all the responses to a batch of pipelined requests are written at
+// once.
+struct connection {
+  int fd;
+  struct sockaddr_in addr;
+
+  // Shard that accepted the connection
+  struct httpserver_shard *shard;
+
+  // Bytes received but not yet fed to the parser
+  struct string_t in;
+
+  // Parser of the request being received, resumed on every read
+  struct request_parser parser;
+
+  // Memory of the request being served and its response, reset after each
+  struct arena arena;
+
+  // Serialized responses not yet written, starting at out_offset
+  struct string_t out;
+  size_t out_offset;
+
+  // Body of the last response, produced as the output drains. Requests after
+  // it wait in the input buffer until it ends.
+  struct response_stream stream;
+
+  // Response suspended by its handler, with its request, until it is resumed.
+  // Requests after it wait in the input buffer as well.
+  struct response_t *suspended;
+  struct request_t *suspended_req;
+  bool suspended_keep_alive;
+
+  // Requests served so far
+  unsigned served;
+
+  // The peer will not send any more data
+  bool peer_closed;
+
+  // Close the connection once the output is flushed
+  bool closing;
+
+  // The peer may still be sending: drain its input before closing
+  bool linger;
+
+  // Input discarded while lingering, and when lingering gives up, from
+  // monotonic_seconds, or 0 if not lingering
+  size_t lingered;
+  time_t linger_until;
+};
+
+// Input a lingering close discards at most, and for how long
+#define connection_linger_bytes (64 * 1024)
+#define connection_linger_seconds 2
+
+void connection_init(struct connection *conn, int fd,
+                     struct sockaddr_in const *addr,
+                     struct httpserver_shard *shard);
+
+// Free the buffers. Does not close the file descriptor.
+void connection_free(struct connection *conn);
+
+// Read once from the socket into the input buffer.
+// Returns the number of bytes read, 0 when the peer closed its end and -1 on
+// error, with errno set (EAGAIN for non-blocking sockets with nothing to read).
+ssize_t connection_read(struct connection *conn);
+
+// Parse and answer every complete request in the received bytes, in order.
+// Stops early when a response closes the connection. Bytes after a request
+// whose response is streamed or suspended are kept in the input buffer until
+// the stream ends or the response is resumed.
+void connection_feed(struct connection *conn, char const *data, size_t len,
+                     size_t thread_id);
+
+// Feed the input buffer to the parser, keeping whatever waits for a stream or
+// a suspended response
+void connection_process(struct connection *conn, size_t thread_id);
+
+// Produce more of the streamed body while the output is short. File bodies
+// are read into the output only if read_files is set: otherwise they are left
+// for connection_flush to sendfile. Returns -1 if the stream failed.
+int connection_fill(struct connection *conn, bool read_files);
+
+// Write the pending output with as few system calls as possible, producing
+// the streamed body as it goes. Blocking sockets write all of it, non-blocking
+// sockets stop when they would block. Returns -1 if the connection failed.
+int connection_flush(struct connection *conn);
+
+// Whether there is output left to write or to produce
+bool connection_pending_output(struct connection const *conn);
+
+// Whether the body of a response is still being produced
+bool connection_streaming(struct connection const *conn);
+
+// Close a rejected connection gracefully once its output is flushed. Closing
+// with unread input makes the kernel reset the connection, which can destroy
+// the error response before the client reads it: so the write side is shut
+// down, and the input discarded until the peer closes its end. Returns false
+// if there is no need to linger, and the connection can be closed right away.
+bool connection_linger(struct connection *conn);
+
+// Whether the connection is lingering before its close
+bool connection_lingering(struct connection const *conn);
+
+// Discard the input of a lingering connection without blocking. Returns 0 if
+// more may come, or -1 once the connection can be closed: the peer closed its
+// end or failed, or it sent more than the cap, or the time is up.
+int connection_discard(struct connection *conn);
+
+// Whether a response waits for its handler to complete it
+bool connection_suspended(struct connection const *conn);
+
+// Whether requests wait for the response before them to be streamed or
+// resumed
+bool connection_blocked(struct connection const *conn);
+
+// File descriptor that becomes readable once the suspended response can be
+// resumed
+int connection_async_fd(struct connection const *conn);
+
+// Complete the suspended response and queue it for output, unless the resumer
+// suspends it again. Requests waiting behind it are left for
+// connection_process.
+void connection_resume(struct connection *conn);
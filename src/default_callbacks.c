@@ -1,8 +1,36 @@
+#include <pthread.h>
+
 #include "http.h"
 #include "string_t.h"
 
 #include "default_callbacks.h"
 
+// The most common error responses, built once for the whole process
+struct frozen_response frozen404;
+struct frozen_response frozen405;
+pthread_once_t frozen_once = PTHREAD_ONCE_INIT;
+
+// Build the frozen response, leaving it empty on failure
+void frozen_build(struct frozen_response *const frozen,
+                  enum http_status const status, char const *const body) {
+  struct response_t *const res = new_response(-1, NULL);
+  if (res == NULL) {
+    return;
+  }
+
+  res->status = status;
+  if (string_append(&res->body, body, strlen(body)) != 0 ||
+      response_freeze(res, frozen) != 0) {
+    *frozen = (struct frozen_response){.data = NULL};
+  }
+}
+
+void frozen_init() {
+  frozen_build(&frozen404, HTTP_STATUS_NOT_FOUND, "404 Not Found\n");
+  frozen_build(&frozen405, HTTP_STATUS_METHOD_NOT_ALLOWED,
+               "405 Method Not Allowed\n");
+}
+
 void callback_redirect(struct response_t *res, const char *location) {
   res->status = HTTP_STATUS_MOVED_PERMANENTLY;
   response_headers_append(res, "Location", location);
@@ -20,23 +48,67 @@ void callback400(struct response_t *res, struct request_t *req) {
     return;
   }
 
-  res->body = new_string_literal("400 Bad Request\n");
+  string_append_literal(&res->body, "400 Bad Request\n");
 }
 
 void callback404(struct response_t *res, struct request_t *req) {
+  pthread_once(&frozen_once, frozen_init);
+  if (frozen404.data != NULL) {
+    response_send_frozen(res, req, &frozen404);
+    return;
+  }
+
   res->status = HTTP_STATUS_NOT_FOUND;
   if (strncmp(req->method, "HEAD", sizeof("HEAD")) == 0) {
     // HEAD is not allowed to have a body
     return;
   }
-  res->body = new_string_literal("404 Not Found\n");
+  string_append_literal(&res->body, "404 Not Found\n");
 }
 
 void callback405(struct response_t *res, struct request_t *req) {
+  pthread_once(&frozen_once, frozen_init);
+  if (frozen405.data != NULL) {
+    response_send_frozen(res, req, &frozen405);
+    return;
+  }
+
   res->status = HTTP_STATUS_METHOD_NOT_ALLOWED;
   if (strncmp(req->method, "HEAD", sizeof("HEAD")) == 0) {
     // HEAD is not allowed to have a body
     return;
   }
-  res->body = new_string_literal("405 Method Not Allowed\n");
-}
\ No newline at end of file
+  string_append_literal(&res->body, "405 Method Not Allowed\n");
+}
+
+void callback413(struct response_t *res, struct request_t *req) {
+  res->status = HTTP_STATUS_PAYLOAD_TOO_LARGE;
+  if (req == NULL || strncmp(req->method, "HEAD", sizeof("HEAD")) == 0) {
+    return;
+  }
+  string_append_literal(&res->body, "413 Payload Too Large\n");
+}
+
+void callback414(struct response_t *res, struct request_t *req) {
+  res->status = HTTP_STATUS_URI_TOO_LONG;
+  if (req == NULL || strncmp(req->method, "HEAD", sizeof("HEAD")) == 0) {
+    return;
+  }
+  string_append_literal(&res->body, "414 URI Too Long\n");
+}
+
+void callback431(struct response_t *res, struct request_t *req) {
+  res->status = HTTP_STATUS_REQUEST_HEADER_FIELDS_TOO_LARGE;
+  if (req == NULL || strncmp(req->method, "HEAD", sizeof("HEAD")) == 0) {
+    return;
+  }
+  string_append_literal(&res->body, "431 Request Header Fields Too Large\n");
+}
+
+void callback501(struct response_t *res, struct request_t *req) {
+  res->status = HTTP_STATUS_NOT_IMPLEMENTED;
+  if (req == NULL || strncmp(req->method, "HEAD", sizeof("HEAD")) == 0) {
+    return;
+  }
+  string_append_literal(&res->body, "501 Not Implemented\n");
+}
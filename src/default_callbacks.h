@@ -6,4 +6,7 @@ void callback_redirect(struct response_t *res, const char *location);
 void callback400(struct response_t *res, struct request_t *req);
 void callback404(struct response_t *res, struct request_t *req);
 void callback405(struct response_t *res, struct request_t *req);
-
+void callback413(struct response_t *res, struct request_t *req);
+void callback414(struct response_t *res, struct request_t *req);
+void callback431(struct response_t *res, struct request_t *req);
+void callback501(struct response_t *res, struct request_t *req);
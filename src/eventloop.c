@@ -0,0 +1,381 @@
+#define _GNU_SOURCE // Required for accept4
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "eventloop.h"
+#include "http.h"
+
+time_t monotonic_seconds() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec;
+}
+
+#define event_loop_max_events 64
+
+// Maximum number of connections accepted in a row, so that a single loop does
+// not starve its own connections when a burst arrives
+#define event_loop_accept_burst 64
+
+int event_loop_init(struct event_loop *const loop,
+                    struct httpserver_shard *const shard, size_t const id,
+                    volatile bool *const interrupt) {
+  *loop = (struct event_loop){
+      .shard = shard,
+      .id = id,
+      .epollfd = epoll_create1(EPOLL_CLOEXEC),
+      .interrupt = interrupt,
+      .connections = NULL,
+      .batch = NULL,
+      .batch_len = 0,
+  };
+
+  if (loop->epollfd < 0) {
+    return -1;
+  }
+
+  // The listener is shared by all loops of the shard: wake up only one of
+  // them per incoming connection. A NULL pointer marks the listener.
+  struct epoll_event ev = {
+      .events = EPOLLIN | EPOLLEXCLUSIVE,
+      .data.ptr = NULL,
+  };
+
+  if (epoll_ctl(loop->epollfd, EPOLL_CTL_ADD, shard->sockfd, &ev) != 0) {
+    close(loop->epollfd);
+    return -1;
+  }
+
+  return 0;
+}
+
+// Events of the fd of a suspended response carry the pointer to its
+// connection with the lowest bit set
+#define event_loop_async_tag 1
+
+struct event_connection *event_loop_connection(struct epoll_event const *ev) {
+  return (struct event_connection *)((uintptr_t)ev->data.ptr &
+                                     ~(uintptr_t)event_loop_async_tag);
+}
+
+void event_connection_close(struct event_loop *const loop,
+                            struct event_connection *const conn) {
+  if (conn->prev != NULL) {
+    conn->prev->next = conn->next;
+  } else {
+    loop->connections = conn->next;
+  }
+  if (conn->next != NULL) {
+    conn->next->prev = conn->prev;
+  }
+
+  // The fd of a suspended response may outlive the connection
+  if (conn->waiting) {
+    epoll_ctl(loop->epollfd, EPOLL_CTL_DEL, connection_async_fd(&conn->conn),
+              NULL);
+  }
+
+  // Events of the connection still to be handled would find it gone
+  for (int i = 0; i < loop->batch_len; ++i) {
+    if (event_loop_connection(&loop->batch[i]) == conn) {
+      loop->batch[i].events = 0;
+    }
+  }
+
+  // Closing the fd also removes it from the epoll set
+  close(conn->conn.fd);
+  connection_free(&conn->conn);
+  free(conn);
+
+  atomic_fetch_sub(&loop->shard->active, 1);
+}
+
+void event_loop_accept(struct event_loop *const loop) {
+  for (int i = 0; i < event_loop_accept_burst; ++i) {
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+
+    int fd = accept4(loop->shard->sockfd, (struct sockaddr *)&addr, &addrlen,
+                     SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      // EAGAIN: no more pending connections, or another loop took them
+      return;
+    }
+
+    struct event_connection *conn = malloc(sizeof(*conn));
+    if (conn == NULL) {
+      close(fd);
+      continue;
+    }
+
+    connection_init(&conn->conn, fd, &addr, loop->shard);
+    conn->last_active = monotonic_seconds();
+    conn->waiting = false;
+    conn->prev = NULL;
+    conn->next = loop->connections;
+
+    struct epoll_event ev = {
+        .events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET,
+        .data.ptr = conn,
+    };
+
+    if (epoll_ctl(loop->epollfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+      close(fd);
+      free(conn);
+      continue;
+    }
+
+    if (loop->connections != NULL) {
+      loop->connections->prev = conn;
+    }
+    loop->connections = conn;
+
+    atomic_fetch_add(&loop->shard->accepted, 1);
+    atomic_fetch_add(&loop->shard->active, 1);
+  }
+}
+
+// Read and process everything available until the socket would block, or a
+// response is streamed or suspended. Every read is processed before the next
+// one, so the input buffer never holds more than a single read, however fast
+// the peer sends.
+int event_connection_receive(struct connection *const conn,
+                             size_t const thread_id) {
+  while (!conn->closing && !connection_blocked(conn)) {
+    ssize_t const n = connection_read(conn);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+
+    if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+      return -1;
+    }
+
+    connection_process(conn, thread_id);
+    if (n <= 0) {
+      return 0;
+    }
+  }
+  return 0;
+}
+
+// Wait for the suspended response of the connection to be resumable
+int event_connection_wait(struct event_loop *const loop,
+                          struct event_connection *const conn) {
+  struct epoll_event ev = {
+      .events = EPOLLIN,
+      .data.ptr = (char *)conn + event_loop_async_tag,
+  };
+  if (epoll_ctl(loop->epollfd, EPOLL_CTL_ADD, connection_async_fd(&conn->conn),
+                &ev) != 0) {
+    return -1;
+  }
+  conn->waiting = true;
+  return 0;
+}
+
+void event_connection_handle(struct event_loop *const loop,
+                             struct event_connection *const conn,
+                             uint32_t const events) {
+  if (events & EPOLLERR) {
+    event_connection_close(loop, conn);
+    return;
+  }
+
+  conn->last_active = monotonic_seconds();
+
+  if (connection_lingering(&conn->conn)) {
+    if (connection_discard(&conn->conn) != 0) {
+      event_connection_close(loop, conn);
+    }
+    return;
+  }
+
+  bool readable = events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP);
+  while (true) {
+    // Nothing is read while a response is streamed or suspended, so that the
+    // peer waits
+    if (readable && !conn->conn.closing && !connection_blocked(&conn->conn)) {
+      // Every response to the requests received so far goes out in one batch
+      if (event_connection_receive(&conn->conn, loop->id) != 0) {
+        event_connection_close(loop, conn);
+        return;
+      }
+    }
+
+    bool const streaming = connection_streaming(&conn->conn);
+    if (connection_flush(&conn->conn) != 0) {
+      event_connection_close(loop, conn);
+      return;
+    }
+
+    if (!streaming || connection_streaming(&conn->conn)) {
+      break;
+    }
+
+    // The stream ended: serve what the peer sent meanwhile, which no new
+    // edge will signal
+    readable = true;
+  }
+
+  if (connection_suspended(&conn->conn) && !conn->waiting &&
+      event_connection_wait(loop, conn) != 0) {
+    event_connection_close(loop, conn);
+    return;
+  }
+
+  if (conn->conn.closing && !connection_pending_output(&conn->conn)) {
+    // Lingering connections are closed once the peer is done, or by the sweep
+    if (!connection_linger(&conn->conn) ||
+        connection_discard(&conn->conn) != 0) {
+      event_connection_close(loop, conn);
+    }
+  }
+}
+
+// The suspended response of the connection can be completed
+void event_connection_resume(struct event_loop *const loop,
+                             struct event_connection *const conn) {
+  epoll_ctl(loop->epollfd, EPOLL_CTL_DEL, connection_async_fd(&conn->conn),
+            NULL);
+  conn->waiting = false;
+  connection_resume(&conn->conn);
+
+  // Serve what the peer sent meanwhile, which no new edge will signal
+  event_connection_handle(loop, conn, EPOLLIN);
+}
+
+// Close the connections that stayed idle for longer than the keep-alive
+// timeout, and those done lingering. Runs at most once per second.
+void event_loop_sweep(struct event_loop *const loop) {
+  time_t const now = monotonic_seconds();
+  if (now == loop->last_sweep) {
+    return;
+  }
+  loop->last_sweep = now;
+
+  time_t const timeout = loop->shard->server->keepalive_timeout;
+
+  struct event_connection *conn = loop->connections;
+  while (conn != NULL) {
+    struct event_connection *const next = conn->next;
+    bool const expired = connection_lingering(&conn->conn)
+                             ? now >= conn->conn.linger_until
+                             : !connection_pending_output(&conn->conn) &&
+                                   now - conn->last_active >= timeout;
+    if (expired) {
+      event_connection_close(loop, conn);
+    }
+    conn = next;
+  }
+}
+
+void *event_loop_run(void *ptr) {
+  struct event_loop *const loop = (struct event_loop *)ptr;
+  struct epoll_event events[event_loop_max_events];
+
+  while (!*loop->interrupt) {
+    int n = epoll_pwait(loop->epollfd, events, event_loop_max_events, 1000,
+                        &loop->shard->server->interruptmask);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+
+    loop->batch = events;
+    loop->batch_len = n;
+    for (int i = 0; i < n; ++i) {
+      if (events[i].events == 0) {
+        // Its connection was closed by an earlier event
+        continue;
+      }
+
+      if (events[i].data.ptr == NULL) {
+        event_loop_accept(loop);
+        continue;
+      }
+
+      struct event_connection *const conn = event_loop_connection(&events[i]);
+      if (conn != events[i].data.ptr) {
+        event_connection_resume(loop, conn);
+        continue;
+      }
+      event_connection_handle(loop, conn, events[i].events);
+    }
+    loop->batch_len = 0;
+
+    event_loop_sweep(loop);
+  }
+
+  return NULL;
+}
+
+void event_loop_close(struct event_loop *const loop) {
+  while (loop->connections != NULL) {
+    event_connection_close(loop, loop->connections);
+  }
+
+  close(loop->epollfd);
+  loop->epollfd = -1;
+}
+
+int shard_serve_events(struct httpserver_shard *const shard,
+                       size_t const nloops, volatile bool *interrupt) {
+  if (nloops == 0) {
+    return -1;
+  }
+
+  int const flags = fcntl(shard->sockfd, F_GETFL);
+  if (flags < 0 || fcntl(shard->sockfd, F_SETFL, flags | O_NONBLOCK) != 0) {
+    return -1;
+  }
+
+  struct event_loop *loops = calloc(nloops, sizeof(*loops));
+  if (loops == NULL) {
+    return -1;
+  }
+
+  int retval = 0;
+  size_t running = 0;
+  for (; running < nloops; ++running) {
+    struct event_loop *const loop = &loops[running];
+    if (event_loop_init(loop, shard, running, interrupt) != 0) {
+      retval = -1;
+      break;
+    }
+
+    if (pthread_create(&loop->thread, NULL, event_loop_run, loop) != 0) {
+      event_loop_close(loop);
+      retval = -1;
+      break;
+    }
+  }
+
+  if (retval != 0) {
+    // Stop the loops that did start
+    *interrupt = true;
+  }
+
+  for (size_t i = 0; i < running; ++i) {
+    pthread_join(loops[i].thread, NULL);
+    event_loop_close(&loops[i]);
+  }
+
+  free(loops);
+  fcntl(shard->sockfd, F_SETFL, flags);
+  return retval;
+}
+
+int httpserver_serve_events(struct httpserver *const server, int const sockfd,
+                            size_t const nloops, volatile bool *interrupt) {
+  return httpserver_serve_sharded(server, &sockfd, 1, nloops,
+                                  SERVE_MODE_EVENTS, interrupt);
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include <netinet/in.h>
+#include <sys/epoll.h>
+
+#include "connection.h"
+#include "http.h"
+#include "shard.h"
+
+// A non-blocking client connection owned by an event loop
+struct event_connection {
+  struct connection conn;
+
+  // Monotonic time of the last read or write, in seconds
+  time_t last_active;
+
+  // The fd of the suspended response is in the epoll set
+  bool waiting;
+
+  // Intrusive list of the connections owned by the loop
+  struct event_connection *prev;
+  struct event_connection *next;
+};
+
+// An edge-triggered epoll loop accepting and serving connections
+struct event_loop {
+  struct httpserver_shard *shard;
+  size_t id;
+  int epollfd;
+  volatile bool *interrupt;
+
+  struct event_connection *connections;
+  time_t last_sweep;
+
+  // Events being handled, dropped as their connection closes
+  struct epoll_event *batch;
+  int batch_len;
+
+  pthread_t thread;
+};
+
+// Monotonic clock, in seconds
+time_t monotonic_seconds();
+
+// Create the epoll instance and register the shard's listening socket
+int event_loop_init(struct event_loop *loop, struct httpserver_shard *shard,
+                    size_t id, volatile bool *interrupt);
+
+// Run the loop until the interrupt is raised. Meant as a pthread entry point.
+void *event_loop_run(void *loop);
+
+// Close all connections owned by the loop and its epoll instance
+void event_loop_close(struct event_loop *loop);
@@ -1,22 +1,35 @@
+#define _GNU_SOURCE // Required for ppoll and memmem
+
 #include <assert.h>
+#include <errno.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <strings.h>
 #include <time.h>
 #include <unistd.h>
 
-#define __USE_GNU // Required for ppoll and pthread_timedjoin_np
-#include <pthread.h>
+#include <sys/epoll.h>
 #include <sys/poll.h>
-#undef __USE_GNU
+#include <sys/sendfile.h>
 
 #include <sys/signal.h>
 #include <sys/socket.h>
 
 #include "net.h"
+#include "async.h"
+#include "cache.h"
+#include "connection.h"
+#include "conditional.h"
 #include "default_callbacks.h"
 #include "http.h"
+#include "httpdate.h"
+#include "objpool.h"
+#include "parser.h"
+#include "shard.h"
+#include "threadpool.h"
 
-// Increase the capacity of the headers_t to make sure one more item fits.
+// Increase the capacity of the headers_t to make sure one more item fits
 int headers_inc_cap(struct headers_t *headers) {
   if (headers->len < headers->cap) {
     return 0;
@@ -34,7 +47,45 @@ int headers_inc_cap(struct headers_t *headers) {
   return 0;
 }
 
-int request_headers_append(struct request_t *req, char *key, char *value) {
+struct http_header_name {
+  char const *name;
+  size_t len;
+};
+
+#define http_header_name(str) {str, sizeof(str) - 1}
+
+// Names of the well-known headers, in the order of enum http_header
+struct http_header_name const http_header_names[HTTP_HEADER_COUNT] = {
+    http_header_name("Accept"),
+    http_header_name("Accept-Encoding"),
+    http_header_name("Connection"),
+    http_header_name("Content-Length"),
+    http_header_name("Content-Type"),
+    http_header_name("Expect"),
+    http_header_name("Host"),
+    http_header_name("If-Modified-Since"),
+    http_header_name("If-None-Match"),
+    http_header_name("If-Range"),
+    http_header_name("Range"),
+    http_header_name("Transfer-Encoding"),
+    http_header_name("User-Agent"),
+};
+
+enum http_header http_header_from_name(char const *const name,
+                                       size_t const len) {
+  for (size_t i = 0; i < HTTP_HEADER_COUNT; ++i) {
+    // Comparing lengths first rules out almost every candidate
+    if (http_header_names[i].len == len &&
+        strncasecmp(http_header_names[i].name, name, len) == 0) {
+      return i;
+    }
+  }
+  return HTTP_HEADER_UNKNOWN;
+}
+
+int request_headers_append(struct request_t *req, char *key,
+                           size_t const key_len, char *value,
+                           size_t const value_len) {
   if (headers_inc_cap(&req->headers) != 0) {
     return -1;
   }
@@ -42,221 +93,239 @@ int request_headers_append(struct request_t *req, char *key, char *value) {
   req->headers.data[req->headers.len] = (struct header_t){
       .key = key,
       .value = value,
+      .value_len = value_len,
   };
   ++req->headers.len;
 
-  return 0;
-}
-
-int response_headers_append(struct response_t *resp, char const *const key,
-                            char const *const value) {
-  if (headers_inc_cap(&resp->headers) != 0) {
-    return -1;
+  enum http_header const h = http_header_from_name(key, key_len);
+  if (h != HTTP_HEADER_UNKNOWN && req->known_headers[h] == 0 &&
+      req->trailers == 0) {
+    req->known_headers[h] = req->headers.len;
   }
 
-  resp->headers.data[resp->headers.len] = (struct header_t){
-      .key = strndup(key, strnlen(key, 4096)),
-      .value = strndup(value, strnlen(value, 4096)),
-  };
-  ++resp->headers.len;
-
   return 0;
 }
 
-int headers_get(struct headers_t const *const headers, char *buff,
-                size_t buffsize, char const *const key) {
-  assert(buff != NULL);
+char const *request_header(struct request_t const *const req,
+                           enum http_header const header, size_t *const len) {
+  if (header >= HTTP_HEADER_COUNT || req->known_headers[header] == 0) {
+    return NULL;
+  }
 
-  for (size_t i = 0; i < headers->len; ++i) {
-    if (strcmp(headers->data[i].key, key) == 0) {
-      strncpy(buff, headers->data[i].value, buffsize);
-      return 0;
-    }
+  struct header_t const *const h =
+      &req->headers.data[req->known_headers[header] - 1];
+  if (len != NULL) {
+    *len = h->value_len;
   }
-  return -1;
+  return h->value;
 }
 
-char *findbefore(char *begin, char const *const end, char target, char *avoid,
-                 size_t avoid_len) {
-  for (; begin < end; ++begin) {
-    if (*begin == target) {
-      return begin;
-    }
-    for (size_t i = 0; i < avoid_len; ++i) {
-      if (*begin == avoid[i]) {
-        return NULL;
+char const *request_param(struct request_t const *const req,
+                          char const *const name, size_t *const len) {
+  for (size_t i = 0; i < req->params.len; ++i) {
+    if (strcmp(req->params.data[i].name, name) == 0) {
+      if (len != NULL) {
+        *len = req->params.data[i].len;
       }
+      return req->params.data[i].value;
     }
   }
-
   return NULL;
 }
 
-char *http_parse_first_line(struct request_t *req) {
-  char *it = req->pool;
-  char const *const end = req->pool + request_alloc_size;
-
-  req->method = it;
-  it = findbefore(it, end, ' ', "\0\n\r", 3);
-  if (it == NULL) {
-    return NULL;
+char const *request_header_find(struct request_t const *const req,
+                                char const *const name, size_t *const len) {
+  enum http_header const known = http_header_from_name(name, strlen(name));
+  if (known != HTTP_HEADER_UNKNOWN) {
+    return request_header(req, known, len);
   }
-  *it = '\0';
-  ++it;
 
-  req->path = it;
-  it = findbefore(it, end, ' ', "\0\n\r", 3);
-  if (it == NULL) {
-    return NULL;
+  for (size_t i = 0; i < req->headers.len; ++i) {
+    struct header_t const *const h = &req->headers.data[i];
+    if (strcasecmp(h->key, name) == 0) {
+      if (len != NULL) {
+        *len = h->value_len;
+      }
+      return h->value;
+    }
   }
-  *it = '\0';
-  ++it;
+  return NULL;
+}
 
-  req->protocol = it;
-  it = findbefore(it, end, '\r', "\0\n ", 3);
-  if (it == NULL) {
-    return NULL;
+int response_headers_append(struct response_t *resp, char const *const key,
+                            char const *const value) {
+  if (headers_inc_cap(&resp->headers) != 0) {
+    return -1;
   }
-  *it = '\0';
-
-  return it + 2; // Skip \r\n
-}
 
-char *http_parse_headers(struct request_t *req, char *it) {
-  char *const end = req->pool + request_alloc_size;
+  size_t const value_len = strnlen(value, 4096);
+  char *key_copy;
+  char *value_copy;
+  if (resp->arena != NULL) {
+    key_copy = arena_strndup(resp->arena, key, 4096);
+    value_copy = arena_strndup(resp->arena, value, value_len);
+  } else {
+    key_copy = strndup(key, strnlen(key, 4096));
+    value_copy = strndup(value, value_len);
+  }
 
-  while (it <= end) {
-    if (*it == '\r') {
+  if (key_copy == NULL || value_copy == NULL) {
+    // Arena copies are released with the arena
+    if (resp->arena == NULL) {
+      free(key_copy);
+      free(value_copy);
+    }
+    return -1;
+  }
 
-      ++it;
-      if (it == end) {
-        return NULL;
-      }
+  struct header_t *const h = &resp->headers.data[resp->headers.len];
+  h->key = key_copy;
+  h->value = value_copy;
+  h->value_len = value_len;
+  ++resp->headers.len;
 
-      if (*it != '\n') {
-        return NULL;
-      }
+  return 0;
+}
 
-      // Empty line
-      return it + 1;
+char const *response_header(struct response_t const *const res,
+                            char const *const key) {
+  for (size_t i = 0; i < res->headers.len; ++i) {
+    if (strcasecmp(res->headers.data[i].key, key) == 0) {
+      return res->headers.data[i].value;
     }
+  }
+  return NULL;
+}
 
-    // Parse header key
-    char *const key = it;
-    it = findbefore(it, end, ':', "\0\n\r", 3);
-    if (it == NULL) {
-      return NULL;
+int response_headers_set(struct response_t *const res, char const *const key,
+                         char const *const value) {
+  for (size_t i = 0; i < res->headers.len; ++i) {
+    struct header_t *const h = &res->headers.data[i];
+    if (strcasecmp(h->key, key) != 0) {
+      continue;
     }
-    *it = '\0';
 
-    // Parse header ' ' separator
-    ++it;
-    if (it == end || *it != ' ') {
-      return NULL;
+    size_t const value_len = strnlen(value, 4096);
+    char *const copy = res->arena != NULL
+                           ? arena_strndup(res->arena, value, value_len)
+                           : strndup(value, value_len);
+    if (copy == NULL) {
+      return -1;
     }
-    ++it;
-
-    // Parse header value
-    char *const value = it;
-    it = findbefore(it, end, '\r', "\0\n", 2);
-    if (it == NULL) {
-      return NULL;
+    if (res->arena == NULL) {
+      free(h->value);
     }
+    h->value = copy;
+    h->value_len = value_len;
+    return 0;
+  }
 
-    *it = '\0';
-    if (request_headers_append(req, key, value) != 0) {
-      return NULL;
-    }
+  return response_headers_append(res, key, value);
+}
 
-    ++it;
-    if (*it != '\n') {
-      return NULL;
-    }
+int headers_get(struct headers_t const *const headers, char *buff,
+                size_t buffsize, char const *const key) {
+  assert(buff != NULL);
 
-    ++it;
+  for (size_t i = 0; i < headers->len; ++i) {
+    if (strcasecmp(headers->data[i].key, key) == 0) {
+      strncpy(buff, headers->data[i].value, buffsize);
+      return 0;
+    }
   }
-
-  // No empty line found
-  return NULL;
+  return -1;
 }
 
-size_t request_content_length(struct request_t const *const req) {
-  char buff[32];
-  if (headers_get(&req->headers, buff, sizeof(buff), "Content-Length") != 0) {
-    return 0;
+// Parse a Content-Length value: digits only, and no more than a size_t holds
+int content_length_parse(char const *value, size_t *const length) {
+  if (*value == '\0') {
+    return -1;
   }
 
-  return atoll(buff);
-}
+  size_t n = 0;
+  for (; *value != '\0'; ++value) {
+    if (*value < '0' || *value > '9') {
+      return -1;
+    }
 
-int request_init_body(struct request_t *req, int fd, char *it) {
-  req->content_length = request_content_length(req);
-  if (req->content_length == 0) {
-    return 0;
+    size_t const digit = *value - '0';
+    if (n > (SIZE_MAX - digit) / 10) {
+      return -1;
+    }
+    n = n * 10 + digit;
   }
 
-  const size_t pool_slack =
-      request_alloc_size - (it - req->pool) - 1; // -1 for null terminator
-
-  // Extra byte for null terminator
-  // -> ignored in binary data as it is beyond the content length
-  const size_t body_size = req->content_length + 1;
+  *length = n;
+  return 0;
+}
 
-  if (body_size < pool_slack) {
-    // Optimize for small bodies: do not allocate
-    req->body = it;
+int request_content_length(struct request_t const *const req,
+                           size_t *const length) {
+  *length = 0;
+  size_t const first = req->known_headers[HTTP_HEADER_CONTENT_LENGTH];
+  if (first == 0) {
     return 0;
   }
 
-  req->body = malloc(body_size);
-  if (req->body == NULL) {
-    return -1;
-  }
+  // Only the first is indexed: repeated headers come after it
+  for (size_t i = first - 1; i < req->headers.len; ++i) {
+    struct header_t const *const h = &req->headers.data[i];
+    size_t n;
+    if (strcasecmp(h->key, "Content-Length") != 0) {
+      continue;
+    }
 
-  memcpy(req->body, it, pool_slack);
-  read(fd, req->body + pool_slack, req->content_length - pool_slack);
-  req->body[req->content_length] = '\0';
+    if (content_length_parse(h->value, &n) != 0 ||
+        (i != first - 1 && n != *length)) {
+      return -1;
+    }
+    *length = n;
+  }
   return 0;
 }
 
-struct request_t *parse_request(int fd) {
-  struct request_t *req = malloc(sizeof(*req));
+bool request_chunked(struct request_t const *const req) {
+  char const *const value =
+      request_header(req, HTTP_HEADER_TRANSFER_ENCODING, NULL);
+  return value != NULL && strcasecmp(value, "chunked") == 0;
+}
+
+struct request_t *new_request(struct arena *const arena) {
+  struct request_t *req;
+  if (arena != NULL) {
+    // Reuse a request of an earlier connection, header array included
+    req = request_pool_get();
+  } else {
+    req = malloc(sizeof(*req));
+    if (req != NULL) {
+      req->headers = (struct headers_t){
+          .data = NULL,
+          .len = 0,
+          .cap = 0,
+      };
+    }
+  }
+  if (req == NULL) {
+    return NULL;
+  }
+
+  req->arena = arena;
   req->method = NULL;
   req->protocol = NULL;
   req->path = NULL;
-  req->headers = (struct headers_t){
-      .data = NULL,
-      .len = 0,
+  memset(req->known_headers, 0, sizeof(req->known_headers));
+  req->route = ROUTE_NOT_FOUND;
+  req->handler = (struct route_handler){
+      .callback = NULL,
+      .on_body = NULL,
+      .context = NULL,
   };
+  req->params.len = 0;
+  req->body_context = NULL;
   req->body = NULL;
-
-  int n =
-      read(fd, req->pool, request_alloc_size - 1); // -1 to fit null terminator
-  if (n <= 0) {
-    goto on_error;
-  } else if (n < request_alloc_size) {
-    req->pool[n] = '\0';
-  }
-
-  char *it = http_parse_first_line(req);
-  if (it == NULL) {
-    goto on_error;
-  }
-
-  it = http_parse_headers(req, it);
-  if (it == NULL) {
-    goto on_error;
-  }
-
-  if (request_init_body(req, fd, it) != 0) {
-    goto on_error;
-  }
-
+  req->content_length = 0;
+  req->trailers = 0;
   return req;
-
-on_error:
-  free_request(req);
-  return NULL;
 }
 
 void free_request(struct request_t *req) {
@@ -264,6 +333,12 @@ void free_request(struct request_t *req) {
     return;
   }
 
+  if (req->arena != NULL) {
+    // The body is released with the arena
+    request_pool_put(req);
+    return;
+  }
+
   const char *pool_begin = req->pool;
   const char *pool_end = req->pool + request_alloc_size;
   if (pool_begin > req->body || req->body >= pool_end) {
@@ -275,6 +350,48 @@ void free_request(struct request_t *req) {
   free(req);
 }
 
+// Whether the comma-separated list has the token, compared case-insensitively
+bool header_list_has(char const *list, char const *const token) {
+  size_t const token_len = strlen(token);
+  while (true) {
+    list += strspn(list, " \t,");
+    if (*list == '\0') {
+      return false;
+    }
+
+    size_t len = strcspn(list, ",");
+    char const *const end = list + len;
+    while (len > 0 && (list[len - 1] == ' ' || list[len - 1] == '\t')) {
+      --len;
+    }
+
+    if (len == token_len && strncasecmp(list, token, len) == 0) {
+      return true;
+    }
+    list = end;
+  }
+}
+
+bool request_keep_alive(struct request_t const *const req) {
+  if (req == NULL) {
+    return false;
+  }
+
+  char const *const connection =
+      request_header(req, HTTP_HEADER_CONNECTION, NULL);
+  if (connection != NULL) {
+    if (header_list_has(connection, "close")) {
+      return false;
+    }
+    if (header_list_has(connection, "keep-alive")) {
+      return true;
+    }
+  }
+
+  // Persistent connections are the default since HTTP/1.1
+  return strcmp(req->protocol, "HTTP/1.1") == 0;
+}
+
 void request_print(struct request_t *req) {
   printf("request {\n");
   printf("  type: %s\n", req->method);
@@ -292,65 +409,464 @@ void request_print(struct request_t *req) {
   printf("}\n");
 }
 
-struct response_t *new_response(int fd) {
-  struct response_t *res = malloc(sizeof(*res));
+struct response_t *new_response(int fd, struct arena *const arena) {
+  struct response_t *res;
+  if (arena != NULL) {
+    res = response_pool_get();
+  } else {
+    res = malloc(sizeof(*res));
+    if (res != NULL) {
+      res->headers = (struct headers_t){
+          .data = NULL,
+          .len = 0,
+          .cap = 0,
+      };
+    }
+  }
   if (res == NULL) {
     return NULL;
   }
 
-  res->protocol = dupl_string_literal("HTTP/1.1");
+  res->arena = arena;
+  res->protocol = arena != NULL ? arena_strndup(arena, "HTTP/1.1", 8)
+                                : dupl_string_literal("HTTP/1.1");
   res->status = 200;
-  res->headers = (struct headers_t){
-      .data = NULL,
-      .len = 0,
+  res->body = arena_string(arena);
+  res->stream = (struct response_stream){
+      .produce = NULL,
+      .release = NULL,
+      .context = NULL,
+      .file = -1,
+      .offset = 0,
+      .remaining = -1,
+      .length = -1,
+      .segment = NULL,
+      .chunked = false,
   };
-  res->body = null_string();
+  res->frozen = NULL;
+  res->frozen_body = false;
+  res->async = NULL;
   res->fd = fd;
 
   return res;
 }
 
-int response_close(struct response_t *res) {
-  if (res->fd < 0) {
+void response_stream(struct response_t *const res,
+                     response_producer const produce,
+                     void (*const release)(void *context), void *const context,
+                     ssize_t const length) {
+  response_stream_end(&res->stream);
+  res->stream = (struct response_stream){
+      .produce = produce,
+      .release = release,
+      .context = context,
+      .file = -1,
+      .offset = 0,
+      .remaining = length,
+      .length = length,
+      .segment = NULL,
+      .chunked = length < 0,
+  };
+}
+
+void response_file(struct response_t *const res, int const file,
+                   off_t const offset, size_t const length,
+                   void (*const release)(void *context), void *const context) {
+  response_stream_end(&res->stream);
+  res->stream = (struct response_stream){
+      .produce = NULL,
+      .release = release,
+      .context = context,
+      .file = file,
+      .offset = offset,
+      .remaining = length,
+      .length = length,
+      .segment = NULL,
+      .chunked = false,
+  };
+
+  if (length == 0) {
+    // Nothing to send
+    response_stream_end(&res->stream);
+  }
+}
+
+void response_file_segments(struct response_t *const res, int const file,
+                            size_t const length,
+                            response_segmenter const segment,
+                            void (*const release)(void *context),
+                            void *const context) {
+  response_stream_end(&res->stream);
+  res->stream = (struct response_stream){
+      .produce = NULL,
+      .release = release,
+      .context = context,
+      .file = file,
+      .offset = 0,
+      .remaining = 0,
+      .length = length,
+      .segment = segment,
+      .chunked = false,
+  };
+}
+
+bool response_stream_active(struct response_stream const *const stream) {
+  return stream->produce != NULL || stream->file >= 0;
+}
+
+bool response_stream_sending_file(struct response_stream const *const stream) {
+  return stream->file >= 0 && stream->remaining > 0;
+}
+
+void response_stream_end(struct response_stream *const stream) {
+  if (!response_stream_active(stream)) {
+    return;
+  }
+
+  if (stream->release != NULL) {
+    stream->release(stream->context);
+  }
+  stream->produce = NULL;
+  stream->file = -1;
+}
+
+// Bytes of a file body sent at once, to give other connections a turn
+#define response_file_piece (1024 * 1024)
+
+ssize_t response_stream_sendfile(struct response_stream *const stream,
+                                 int const sockfd) {
+  size_t const piece = stream->remaining < response_file_piece
+                           ? stream->remaining
+                           : response_file_piece;
+
+  ssize_t const n = sendfile(sockfd, stream->file, &stream->offset, piece);
+  if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+    return -1;
+  }
+
+  if (n <= 0) {
+    // The file shrank since its length was announced
+    response_stream_end(stream);
+    errno = n == 0 ? EIO : errno;
+    return -1;
+  }
+
+  stream->remaining -= n;
+  if (stream->remaining == 0 && stream->segment == NULL) {
+    response_stream_end(stream);
+  }
+  return n;
+}
+
+// Read the next piece of a file body into out
+int response_stream_read(struct response_stream *const stream,
+                         struct string_t *const out) {
+  size_t const piece = stream->remaining < response_file_piece
+                           ? stream->remaining
+                           : response_file_piece;
+  if (string_reserve(out, out->len + piece) != 0) {
+    response_stream_end(stream);
+    return -1;
+  }
+
+  ssize_t const n = pread(stream->file, out->data + out->len, piece,
+                          stream->offset);
+  if (n <= 0) {
+    response_stream_end(stream);
+    return -1;
+  }
+
+  out->len += n;
+  stream->offset += n;
+  stream->remaining -= n;
+  if (stream->remaining == 0 && stream->segment == NULL) {
+    response_stream_end(stream);
+  }
+  return 0;
+}
+
+// Append what precedes the next segment of a file body, and move to it
+int response_stream_next_segment(struct response_stream *const stream,
+                                 struct string_t *const out) {
+  size_t length = 0;
+  int const status =
+      stream->segment(stream->context, out, &stream->offset, &length);
+  stream->remaining = length;
+  if (status != 0) {
+    response_stream_end(stream);
+  }
+  return status < 0 ? -1 : 0;
+}
+
+int response_stream_next(struct response_stream *const stream,
+                         struct string_t *const out) {
+  if (stream->file >= 0) {
+    return stream->remaining == 0 ? response_stream_next_segment(stream, out)
+                                  : response_stream_read(stream, out);
+  }
+
+  size_t const start = out->len;
+
+  // Room for the size of the chunk, filled in once it is produced. Sizes may
+  // have leading zeros.
+  if (stream->chunked && string_append_literal(out, "00000000\r\n") != 0) {
+    response_stream_end(stream);
+    return -1;
+  }
+
+  size_t const begin = out->len;
+  int const status = stream->produce(stream->context, out);
+  size_t const produced = out->len - begin;
+
+  bool failed = status < 0;
+  if (stream->chunked && !failed) {
+    if (produced == 0) {
+      out->len = start;
+    } else if (produced > 0xffffffff) {
+      failed = true;
+    } else {
+      char size[9];
+      snprintf(size, sizeof(size), "%08zx", produced);
+      memcpy(out->data + start, size, 8);
+      failed = string_append_literal(out, "\r\n") != 0;
+    }
+
+    if (status == 1 && !failed) {
+      failed = string_append_literal(out, "0\r\n\r\n") != 0;
+    }
+  } else if (stream->remaining >= 0 && !failed) {
+    // The body must match the length announced in the head
+    failed = produced > (size_t)stream->remaining ||
+             (status == 1 && produced != (size_t)stream->remaining);
+    stream->remaining -= failed ? 0 : produced;
+  }
+
+  if (failed) {
+    out->len = start;
+    response_stream_end(stream);
     return -1;
   }
 
+  if (status == 1) {
+    response_stream_end(stream);
+  }
+  return 0;
+}
+
+int response_set_keep_alive(struct response_t *const res,
+                            struct request_t const *const req,
+                            bool const keep_alive) {
+  if (!keep_alive) {
+    return response_headers_append(res, "Connection", "close");
+  }
+
+  if (strcmp(req->protocol, "HTTP/1.1") != 0) {
+    // Older clients need to be told explicitly
+    return response_headers_append(res, "Connection", "keep-alive");
+  }
+
+  return 0;
+}
+
+// Append the header fields of the response, one per line, after the Date
+int response_serialize_headers(struct response_t const *const res,
+                               struct string_t *const out) {
+  char date[http_date_len + 1];
+  http_date(date);
+  if (string_append_literal(out, "Date: ") != 0 ||
+      string_append(out, date, http_date_len) != 0 ||
+      string_append_literal(out, "\r\n") != 0) {
+    return -1;
+  }
+
+  char line[1200];
+  for (size_t i = 0; i < res->headers.len; ++i) {
+    int n = snprintf(line, sizeof(line), "%s: %s\r\n",
+                     res->headers.data[i].key, res->headers.data[i].value);
+    if (n >= sizeof(line)) {
+      // Too long for the stack buffer
+      string_append(out, res->headers.data[i].key,
+                    strlen(res->headers.data[i].key));
+      string_append(out, ": ", 2);
+      string_append(out, res->headers.data[i].value,
+                    strlen(res->headers.data[i].value));
+      n = snprintf(line, sizeof(line), "\r\n");
+    }
+    if (string_append(out, line, n) != 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+// Append the status line and the framing of the body
+int response_serialize_status(struct response_t const *const res,
+                              struct string_t *const out) {
   if (res->status > 999 || res->status < 0) {
     return -2;
   }
 
-  write(res->fd, res->protocol, strlen(res->protocol));
-  write(res->fd, " ", 1);
-  char status[4];
-  snprintf(status, sizeof(status), "%d", res->status);
-  write(res->fd, status, strlen(status));
-  write(res->fd, " ", 1);
+  // Status lines of HTTP/1.1 are all formatted ahead of time
+  size_t len;
+  char const *const status_line = httpcode_status_line(res->status, &len);
+  if (status_line != NULL && strcmp(res->protocol, "HTTP/1.1") == 0) {
+    if (string_append(out, status_line, len) != 0) {
+      return -1;
+    }
+  } else {
+    char line[1200];
+    int const n = snprintf(line, sizeof(line), "%s %d %s\r\n", res->protocol,
+                           res->status, httpcode_to_string(res->status));
+    if (string_append(out, line, n) != 0) {
+      return -1;
+    }
+  }
 
-  const char *const reason = httpcode_to_string(res->status);
-  if (reason != NULL) {
-    write(res->fd, reason, strnlen(reason, 1024));
+  // Bodiless statuses have no framing
+  bool const streamed = response_stream_active(&res->stream);
+  if (res->status < 200 || res->status == HTTP_STATUS_NO_CONTENT ||
+      res->status == HTTP_STATUS_NOT_MODIFIED) {
+    return 0;
   }
-  write(res->fd, "\r\n", 2);
 
-  char content_length[32];
-  snprintf(content_length, 32, "%ld", res->body.len);
-  response_headers_append(res, "Content-Length", content_length);
+  if (!streamed || res->stream.length >= 0) {
+    size_t const length = streamed ? res->stream.length : res->body.len;
+    if (string_append_literal(out, "Content-Length: ") != 0 ||
+        string_append_decimal(out, length) != 0 ||
+        string_append_literal(out, "\r\n") != 0) {
+      return -1;
+    }
+  } else if (res->stream.chunked) {
+    if (string_append_literal(out, "Transfer-Encoding: chunked\r\n") != 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int response_serialize_head(struct response_t *res, struct string_t *out) {
+  int const err = response_serialize_status(res, out);
+  if (err != 0) {
+    return err;
+  }
+
+  if (response_serialize_headers(res, out) != 0) {
+    return -1;
+  }
+  return string_append(out, "\r\n", 2) == 0 ? 0 : -1;
+}
+
+// Send the frozen response with the headers of res spliced in
+int response_serialize_frozen(struct response_t const *const res,
+                              struct string_t *const out) {
+  struct frozen_response const *const frozen = res->frozen;
+  size_t const end = res->frozen_body ? frozen->len : frozen->head_len + 2;
+
+  if (string_append(out, frozen->data, frozen->head_len) != 0 ||
+      response_serialize_headers(res, out) != 0) {
+    return -1;
+  }
+  return string_append(out, frozen->data + frozen->head_len,
+                       end - frozen->head_len);
+}
+
+int response_serialize(struct response_t *res, struct string_t *out) {
+  if (res->frozen != NULL) {
+    return response_serialize_frozen(res, out);
+  }
+
+  int const err = response_serialize_head(res, out);
+  if (err != 0 || response_stream_active(&res->stream)) {
+    return err;
+  }
+
+  return string_append(out, res->body.data, res->body.len) == 0 ? 0 : -1;
+}
+
+int response_freeze_copy(struct response_t const *const res,
+                         struct frozen_response *const frozen) {
+  // The Date is left out, to be spliced in with the live headers
+  struct string_t out = null_string();
+  if (res->frozen != NULL || response_stream_active(&res->stream) ||
+      response_serialize_status(res, &out) != 0) {
+    string_free(&out);
+    return -1;
+  }
+
+  // Successful responses are tagged, for conditional requests
+  frozen->etag[0] = '\0';
+  if (res->status == HTTP_STATUS_OK) {
+    etag_from_data(frozen->etag, res->body.data, res->body.len);
+    if (string_append_literal(&out, "ETag: ") != 0 ||
+        string_append(&out, frozen->etag, strlen(frozen->etag)) != 0 ||
+        string_append_literal(&out, "\r\n") != 0) {
+      string_free(&out);
+      return -1;
+    }
+  }
 
   for (size_t i = 0; i < res->headers.len; ++i) {
-    write(res->fd, res->headers.data[i].key, strlen(res->headers.data[i].key));
-    write(res->fd, ": ", 2);
-    write(res->fd, res->headers.data[i].value,
-          strlen(res->headers.data[i].value));
-    write(res->fd, "\r\n", 2);
+    struct header_t const *const h = &res->headers.data[i];
+    if (string_append(&out, h->key, strlen(h->key)) != 0 ||
+        string_append_literal(&out, ": ") != 0 ||
+        string_append(&out, h->value, strlen(h->value)) != 0 ||
+        string_append_literal(&out, "\r\n") != 0) {
+      string_free(&out);
+      return -1;
+    }
   }
-  write(res->fd, "\r\n", 2);
-  write(res->fd, res->body.data, res->body.len);
 
-  response_free(res);
+  // The empty line that ends the head stays with the body
+  size_t const head_len = out.len;
+  if (string_append_literal(&out, "\r\n") != 0 ||
+      string_append(&out, res->body.data, res->body.len) != 0) {
+    string_free(&out);
+    return -1;
+  }
+
+  frozen->status = res->status;
+  frozen->data = out.data;
+  frozen->len = out.len;
+  frozen->head_len = head_len;
   return 0;
 }
 
+int response_freeze(struct response_t *const res,
+                    struct frozen_response *const frozen) {
+  int const err = res->arena != NULL ? -1 : response_freeze_copy(res, frozen);
+  response_free(res);
+  return err;
+}
+
+void frozen_response_free(struct frozen_response *const frozen) {
+  free(frozen->data);
+  frozen->data = NULL;
+  frozen->len = 0;
+  frozen->head_len = 0;
+}
+
+void response_send_frozen(struct response_t *const res,
+                          struct request_t const *const req,
+                          struct frozen_response const *const frozen) {
+  res->status = frozen->status;
+  res->frozen = frozen;
+  res->frozen_body = req == NULL || strcmp(req->method, "HEAD") != 0;
+}
+
 void response_free(struct response_t *res) {
+  response_stream_end(&res->stream);
+  if (res->async != NULL) {
+    response_async_cancel(res->async);
+  }
+
+  if (res->arena != NULL) {
+    // Only the body may have been replaced by a heap string. Header keys
+    // and values are released with the arena.
+    string_free(&res->body);
+    response_pool_put(res);
+    return;
+  }
+
   free(res->protocol);
 
   // Unlike request_t, headers are not allocated in a pool
@@ -365,97 +881,98 @@ void response_free(struct response_t *res) {
 
 struct httpserver *new_httpserver() {
   struct httpserver *server = malloc(sizeof(*server));
-  server->multiplexer = (struct multiplexer_t){
-      .handlers = NULL,
-      .len = 0,
-      .cap = 0,
+  router_init(&server->router);
+
+  server->shards = NULL;
+  server->nshards = 0;
+  server->keepalive_timeout = 5;
+  server->keepalive_max_requests = 100;
+  server->limits = (struct request_limits){
+      .max_head_size = request_default_max_head_size,
+      .max_headers = request_default_max_headers,
+      .max_uri_length = request_default_max_uri_length,
+      .max_body_size = request_default_max_body_size,
   };
+  server->compression = (struct compression_settings){
+      .level = compression_default_level,
+      .min_size = compression_default_min_size,
+  };
+  server->cache_size = cache_default_size;
+  server->cache = NULL;
 
   sigemptyset(&server->interruptmask);
   return server;
 }
 
-int mux_append(struct multiplexer_t *mux, struct handler_t *handler) {
-  if (mux->len == mux->cap) {
-    const size_t new_cap = (mux->cap + 1) * 2;
-    struct handler_t *const new_data =
-        realloc(mux->handlers, new_cap * sizeof(*new_data));
-    if (new_data == NULL) {
-      return -1;
-    }
-    mux->handlers = new_data;
-    mux->cap = new_cap;
-  }
-
-  mux->handlers[mux->len] = *handler;
-  ++mux->len;
-  return 0;
+int httpserver_register(struct httpserver *server, char const *method,
+                        char const *path, httpserver_callback callback) {
+  return router_add(&server->router, method, path,
+                    (struct route_handler){.callback = callback});
 }
 
-void mux_free(struct multiplexer_t *mux) {
-  for (size_t i = 0; i < mux->len; ++i) {
-    free(mux->handlers[i].path);
-    free(mux->handlers[i].method);
-  }
-  free(mux->handlers);
+int httpserver_register_context(struct httpserver *server, char const *method,
+                                char const *path, httpserver_callback callback,
+                                void *context) {
+  return router_add(&server->router, method, path,
+                    (struct route_handler){
+                        .callback = callback,
+                        .context = context,
+                    });
 }
 
-bool mux_match(char const *const a, char const *const b) {
-  return strcmp(a, b) == 0 || strcmp(b, "*") == 0;
+// Answer with the frozen response registered as the context of the route
+void callback_frozen(struct response_t *res, struct request_t *req) {
+  response_send_frozen(res, req, req->handler.context);
 }
 
-httpserver_callback mux_get(struct multiplexer_t const *mux, char *method,
-                            const char *path) {
-
-  // Default to Not Found
-  httpserver_callback callback = callback404;
-
-  for (size_t i = 0; i < mux->len; ++i) {
-    if (mux_match(mux->handlers[i].path, path)) {
-      if (mux_match(mux->handlers[i].method, method)) {
-        return mux->handlers[i].handler;
-      }
-
-      // Path matched but method did not
-      callback = callback405;
-    }
-  }
-
-  return callback;
+int httpserver_register_frozen(struct httpserver *server, char const *method,
+                               char const *path,
+                               struct frozen_response const *frozen) {
+  // The context is only ever read
+  return httpserver_register_context(server, method, path, callback_frozen,
+                                     (void *)frozen);
 }
 
-int httpserver_register(struct httpserver *server, char const *method,
-                        char const *path, httpserver_callback callback) {
-  struct handler_t handler = {
-      .path = NULL,
-      .method = NULL,
-      .handler = NULL,
-  };
-
-  handler.path = strndup(path, 2048);
-  if (path == NULL) {
-    return -1;
+int httpserver_register_cached(struct httpserver *server, char const *method,
+                               char const *path, httpserver_callback callback,
+                               unsigned const ttl, char const *const *vary) {
+  if (server->cache == NULL) {
+    server->cache = response_cache_new(server->cache_size);
+    if (server->cache == NULL) {
+      return -1;
+    }
   }
 
-  handler.method = strndup(method, 32);
-  if (path == NULL) {
-    free(handler.path);
+  struct cache_route *const route =
+      response_cache_route(server->cache, callback, ttl, vary);
+  if (route == NULL) {
     return -1;
   }
+  return httpserver_register_context(server, method, path, callback_cached,
+                                     route);
+}
 
-  handler.handler = callback;
-
-  if (mux_append(&server->multiplexer, &handler) != 0) {
-    free(handler.path);
-    free(handler.method);
-    return -1;
-  }
+int httpserver_register_streaming(struct httpserver *server,
+                                  char const *method, char const *path,
+                                  route_body_callback on_body,
+                                  httpserver_callback callback) {
+  return router_add(&server->router, method, path,
+                    (struct route_handler){
+                        .callback = callback,
+                        .on_body = on_body,
+                    });
+}
 
-  return 0;
+void httpserver_route(struct httpserver const *server, struct request_t *req) {
+  req->route = router_get(&server->router, req->method, req->path,
+                          &req->handler, &req->params);
 }
 
 void httpserver_free(struct httpserver *server) {
-  mux_free(&server->multiplexer);
+  router_free(&server->router);
+  if (server->cache != NULL) {
+    response_cache_free(server->cache);
+  }
   free(server);
 }
 
@@ -479,173 +996,406 @@ int httpserver_wait_accept(sigset_t const sigmask, int const sockfd,
   return accept(sockfd, addr, addrlen);
 }
 
-struct connection_details {
-  struct httpserver *server;
-  int fd;
-  int thread_id;
-  struct sockaddr_in addr;
-};
-
-void handle_connection_imp(struct connection_details const *const cd) {
-  struct request_t *req = parse_request(cd->fd);
-  struct response_t *res = new_response(cd->fd);
-
-  if (res == NULL) {
-    write(cd->fd, "HTTP/1.1 500 Internal Server Error\n\n", 36);
-    free_request(req);
-    return;
-  }
-
+void httpserver_dispatch(struct httpserver_shard *const shard,
+                         struct request_t *const req,
+                         struct response_t *const res, size_t const thread_id,
+                         struct sockaddr_in const *const addr) {
   char address[128];
-  if (cd->addr.sin_family == AF_INET) {
-    format_address(address, sizeof(address), &cd->addr);
+  if (addr->sin_family == AF_INET) {
+    format_address(address, sizeof(address), addr);
   } else {
     snprintf(address, sizeof(address), "unknown");
   }
 
   httpserver_callback callback;
   if (req == NULL) {
-    printf("bad request (thread %d) %s\n", cd->thread_id, address);
-    callback = callback400; // Bad Request
+    // The request was rejected while parsing, with the status already set
+    printf("bad request %d (thread %zu.%zu) %s\n", res->status, shard->id,
+           thread_id, address);
+    switch (res->status) {
+    case HTTP_STATUS_PAYLOAD_TOO_LARGE:
+      callback = callback413;
+      break;
+    case HTTP_STATUS_URI_TOO_LONG:
+      callback = callback414;
+      break;
+    case HTTP_STATUS_REQUEST_HEADER_FIELDS_TOO_LARGE:
+      callback = callback431;
+      break;
+    case HTTP_STATUS_NOT_IMPLEMENTED:
+      callback = callback501;
+      break;
+    default:
+      callback = callback400; // Bad Request
+      break;
+    }
   } else {
-    printf("%s %s (thread %d) %s\n", req->method, req->path, cd->thread_id,
-           address);
-    callback = mux_get(&cd->server->multiplexer, req->method, req->path);
+    printf("%s %s (thread %zu.%zu) %s\n", req->method, req->path, shard->id,
+           thread_id, address);
+    switch (req->route) {
+    case ROUTE_FOUND:
+      callback = req->handler.callback;
+      break;
+    case ROUTE_METHOD_NOT_ALLOWED:
+      callback = callback405;
+      break;
+    case ROUTE_NOT_FOUND:
+    default:
+      callback = callback404;
+      break;
+    }
   }
 
   callback(res, req);
-
-  free_request(req);
-  response_close(res);
+  atomic_fetch_add(&shard->requests, 1);
 }
 
-void *handle_connection(void *ptr) {
-  struct connection_details *const cd = (struct connection_details *)ptr;
-  handle_connection_imp(cd);
-  close(cd->fd);
-  free(ptr);
-  return NULL;
-}
+struct connection_details {
+  struct httpserver_shard *shard;
+  volatile bool *interrupt;
+
+  // Kept across the jobs serving it while a response is suspended
+  struct connection conn;
+
+  // Neighbours in the list of parked connections
+  struct connection_details *prev;
+  struct connection_details *next;
+};
 
-struct thread_spinner {
-  pthread_t *threads;
-  size_t size;
-  size_t cursor;
+// Connections of the threads mode whose response is suspended. They wait
+// without a worker, watched by a single thread, and go back to the pool's
+// queue once the response can be completed.
+struct connection_parking {
+  struct threadpool *pool;
+  volatile bool *interrupt;
+  int epollfd;
+
+  // Parked connections, guarded by the mutex, freed with the parking
+  pthread_mutex_t mutex;
+  struct connection_details *parked;
+
+  atomic_bool stopping;
+  pthread_t thread;
 };
 
-struct thread_spinner new_thread_spinner(size_t const size) {
-  struct thread_spinner spinner = {
-      .threads = calloc(size, sizeof(pthread_t)),
-      .size = size,
-      .cursor = 0,
+void connection_details_free(struct connection_details *const cd) {
+  connection_free(&cd->conn);
+  close(cd->conn.fd);
+  atomic_fetch_sub(&cd->shard->active, 1);
+  free(cd);
+}
+
+// Wait for the connection to become readable.
+// Returns false when the connection should be closed instead: the idle
+// timeout expired, the server is stopping, or the connection is idle and
+// other connections are waiting for a worker.
+bool connection_wait_readable(struct connection_details const *const cd,
+                              bool const idle) {
+  struct pollfd fds = {
+      .fd = cd->conn.fd,
+      .events = POLLIN,
   };
 
-  if (spinner.threads == NULL) {
-    spinner.size = 0;
+  // Wake up periodically to check the interrupt and the pool
+  int const slice_ms = 100;
+  unsigned const timeout_ms = 1000 * cd->shard->server->keepalive_timeout;
+  for (unsigned waited = 0; waited < timeout_ms; waited += slice_ms) {
+    if (*cd->interrupt) {
+      return false;
+    }
+
+    if (idle && threadpool_queued(cd->shard->pool) > 0) {
+      return false;
+    }
+
+    int ret = poll(&fds, 1, slice_ms);
+    if (ret < 0 && errno != EINTR) {
+      return false;
+    }
+
+    if (ret > 0) {
+      // Data or hang-up: a hang-up is noticed when reading
+      return true;
+    }
   }
-  return spinner;
+
+  return false;
 }
 
-void thread_spinner_close(struct thread_spinner *t, volatile bool *interrupt) {
-  for (size_t i = 0; i < t->size && !interrupt; ++i) {
-    if (t->threads[i] == 0) {
-      continue;
+// Serve the connection until it closes, or until a response is suspended.
+// Returns true in the latter case, with the connection left to be parked.
+bool handle_connection_imp(struct connection_details *const cd,
+                           size_t const worker_id) {
+  struct connection *const conn = &cd->conn;
+
+  // A connection back from the parking sends the completed response, and
+  // serves what waited behind it, before reading any more
+  bool resumed = connection_suspended(conn);
+  if (resumed) {
+    connection_resume(conn);
+  }
+
+  while (resumed || !conn->closing) {
+    if (!resumed) {
+      bool const idle = conn->served > 0 && parser_idle(&conn->parser);
+      if (!connection_wait_readable(cd, idle)) {
+        break;
+      }
+
+      ssize_t const n = connection_read(conn);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n < 0) {
+        break;
+      }
+    }
+    resumed = false;
+
+    // Answer every complete request received so far, and send all the
+    // responses in a single batch. Requests that waited for a streamed
+    // response are answered once it is written.
+    bool failed = false;
+    do {
+      connection_process(conn, worker_id);
+      failed = connection_flush(conn) != 0;
+    } while (!failed && !conn->closing && !connection_suspended(conn) &&
+             conn->in.len > 0);
+
+    if (failed) {
+      break;
     }
 
-    pthread_join(t->threads[i], NULL);
-    t->threads[i] = 0;
+    if (connection_suspended(conn)) {
+      // The worker serves other connections meanwhile
+      return true;
+    }
   }
 
-  free(t->threads);
-  t->threads = NULL;
-  t->size = 0;
-  t->cursor = 0;
+  if (connection_linger(conn)) {
+    struct pollfd fds = {
+        .fd = conn->fd,
+        .events = POLLIN,
+    };
+    while (connection_discard(conn) == 0 && !*cd->interrupt) {
+      poll(&fds, 1, 100);
+    }
+  }
+  return false;
 }
 
-int thread_spinner_get(struct thread_spinner *t, volatile bool *interrupt) {
-  while (!*interrupt) {
-    if (t->threads[t->cursor] == 0) { // Free slot
-      size_t const i = t->cursor;
-      t->cursor = (t->cursor + 1) % t->size;
-      return i;
+// Wait without a worker for the suspended response of the connection to be
+// resumable. Returns -1 on error.
+int connection_park(struct connection_parking *const parking,
+                    struct connection_details *const cd) {
+  pthread_mutex_lock(&parking->mutex);
+
+  cd->prev = NULL;
+  cd->next = parking->parked;
+
+  // The connection may be resumed as soon as it is added, once the mutex is
+  // released
+  struct epoll_event ev = {
+      .events = EPOLLIN,
+      .data.ptr = cd,
+  };
+  int const err = epoll_ctl(parking->epollfd, EPOLL_CTL_ADD,
+                            connection_async_fd(&cd->conn), &ev);
+  if (err == 0) {
+    if (parking->parked != NULL) {
+      parking->parked->prev = cd;
     }
+    parking->parked = cd;
+  }
 
-    struct timespec abstime;
-    clock_gettime(CLOCK_REALTIME, &abstime);
-    const size_t millisecond = 1000 * 1000;
-    abstime.tv_nsec += 10 * millisecond;
+  pthread_mutex_unlock(&parking->mutex);
+  return err == 0 ? 0 : -1;
+}
 
-    const size_t i = t->cursor;
-    t->cursor = (t->cursor + 1) % t->size;
+void connection_unpark(struct connection_parking *const parking,
+                       struct connection_details *const cd) {
+  pthread_mutex_lock(&parking->mutex);
 
-    int x = pthread_timedjoin_np(t->threads[i], NULL, &abstime);
-    switch (x) {
-    case 0:
-      // Slot opened up
-      t->threads[i] = 0;
-      return i;
-    case EBUSY:
-      /* fallthrough */
-    case ETIMEDOUT:
-      continue;
+  if (cd->prev != NULL) {
+    cd->prev->next = cd->next;
+  } else {
+    parking->parked = cd->next;
+  }
+  if (cd->next != NULL) {
+    cd->next->prev = cd->prev;
+  }
+  epoll_ctl(parking->epollfd, EPOLL_CTL_DEL, connection_async_fd(&cd->conn),
+            NULL);
+
+  pthread_mutex_unlock(&parking->mutex);
+}
+
+void handle_connection(void *ptr, size_t const worker_id) {
+  struct connection_details *const cd = (struct connection_details *)ptr;
+  if (handle_connection_imp(cd, worker_id) &&
+      connection_park(cd->shard->parking, cd) == 0) {
+    return;
+  }
+
+  // Also cancels a suspended response that could not be parked
+  connection_details_free(cd);
+}
+
+#define connection_parking_events 64
+
+void *connection_parking_run(void *ptr) {
+  struct connection_parking *const parking = ptr;
+  struct epoll_event events[connection_parking_events];
+
+  while (!atomic_load(&parking->stopping)) {
+    // Wake up periodically to check whether to stop
+    int const n =
+        epoll_wait(parking->epollfd, events, connection_parking_events, 100);
+
+    for (int i = 0; i < n; ++i) {
+      struct connection_details *const cd = events[i].data.ptr;
+      connection_unpark(parking, cd);
+
+      struct threadpool_job const job = {
+          .run = handle_connection,
+          .arg = cd,
+      };
+      if (threadpool_submit(parking->pool, job, parking->interrupt) != 0) {
+        connection_details_free(cd);
+      }
     }
+  }
 
-    return -1;
+  return NULL;
+}
+
+// Start watching parked connections for the pool. Returns NULL on error.
+struct connection_parking *
+new_connection_parking(struct threadpool *const pool,
+                       volatile bool *const interrupt) {
+  struct connection_parking *const parking = malloc(sizeof(*parking));
+  if (parking == NULL) {
+    return NULL;
   }
 
-  return -1;
+  *parking = (struct connection_parking){
+      .pool = pool,
+      .interrupt = interrupt,
+      .epollfd = epoll_create1(EPOLL_CLOEXEC),
+      .parked = NULL,
+  };
+  atomic_init(&parking->stopping, false);
+
+  if (parking->epollfd < 0) {
+    free(parking);
+    return NULL;
+  }
+
+  pthread_mutex_init(&parking->mutex, NULL);
+  if (pthread_create(&parking->thread, NULL, connection_parking_run,
+                     parking) != 0) {
+    pthread_mutex_destroy(&parking->mutex);
+    close(parking->epollfd);
+    free(parking);
+    return NULL;
+  }
+
+  return parking;
 }
 
-int httpserver_serve(struct httpserver *const server, const int sockfd,
-                     const size_t max_threads, volatile bool *interrupt) {
-  bool dummy = false;
-  if (interrupt == NULL) {
-    interrupt = &dummy;
+// Stop resuming parked connections. Workers may still park more.
+void connection_parking_stop(struct connection_parking *const parking) {
+  atomic_store(&parking->stopping, true);
+  pthread_join(parking->thread, NULL);
+}
+
+// Close the connections left parked, once no worker is running
+void connection_parking_free(struct connection_parking *const parking) {
+  while (parking->parked != NULL) {
+    struct connection_details *const cd = parking->parked;
+    parking->parked = cd->next;
+    connection_details_free(cd);
   }
 
-  struct thread_spinner tspinner = new_thread_spinner(max_threads);
-  if (tspinner.threads == NULL) {
+  pthread_mutex_destroy(&parking->mutex);
+  close(parking->epollfd);
+  free(parking);
+}
+
+// Number of accepted connections that may wait for a worker, per worker
+#define connection_queue_factor 16
+
+int shard_serve_threads(struct httpserver_shard *const shard,
+                        const size_t max_threads, volatile bool *interrupt) {
+  struct threadpool *pool =
+      new_threadpool(max_threads, max_threads * connection_queue_factor);
+  if (pool == NULL) {
+    return -1;
+  }
+
+  struct connection_parking *parking = new_connection_parking(pool, interrupt);
+  if (parking == NULL) {
+    threadpool_close(pool);
     return -1;
   }
+  shard->pool = pool;
+  shard->parking = parking;
 
+  int retval = 0;
   while (!*interrupt) {
     struct sockaddr_in addr;
     socklen_t addrlen = sizeof(addr);
 
-    int fd = httpserver_wait_accept(server->interruptmask, sockfd,
-                                    (struct sockaddr *)&addr, &addrlen);
+    int fd = httpserver_wait_accept(shard->server->interruptmask,
+                                    shard->sockfd, (struct sockaddr *)&addr,
+                                    &addrlen);
     if (fd < 0) {
-      thread_spinner_close(&tspinner, interrupt);
-      return -1;
+      retval = -1;
+      break;
     } else if (fd == 0) {
       continue;
     }
 
-    int idx = thread_spinner_get(&tspinner, interrupt);
-    if (idx < 0) {
+    struct connection_details *deets = malloc(sizeof(*deets));
+    if (deets == NULL) {
       close(fd);
       continue;
     }
 
-    pthread_t *thread = &tspinner.threads[idx];
-
-    struct connection_details *deets = malloc(sizeof(*deets));
     *deets = (struct connection_details){
-        .server = server,
-        .fd = fd,
-        .thread_id = idx,
-        .addr = addr,
+        .shard = shard,
+        .interrupt = interrupt,
     };
+    connection_init(&deets->conn, fd, &addr, shard);
 
-    if (pthread_create(thread, NULL, handle_connection, (void *)deets) != 0) {
-      free(deets);
-      close(fd);
-      *thread = 0; // Mark slot as free
+    struct threadpool_job const job = {
+        .run = handle_connection,
+        .arg = deets,
+    };
+
+    atomic_fetch_add(&shard->accepted, 1);
+    atomic_fetch_add(&shard->active, 1);
+
+    if (threadpool_submit(pool, job, interrupt) != 0) {
+      connection_details_free(deets);
       continue;
     }
   }
 
-  *interrupt = false;
-  thread_spinner_close(&tspinner, interrupt);
-  return 0;
+  threadpool_print_stats(pool);
+
+  // The parking submits to the pool, so it stops first. The connections
+  // parked as the pool finishes its jobs are closed with it.
+  connection_parking_stop(parking);
+  threadpool_close(pool);
+  connection_parking_free(parking);
+  shard->pool = NULL;
+  shard->parking = NULL;
+  return retval;
+}
+
+int httpserver_serve(struct httpserver *const server, const int sockfd,
+                     const size_t max_threads, volatile bool *interrupt) {
+  return httpserver_serve_sharded(server, &sockfd, 1, max_threads,
+                                  SERVE_MODE_THREADS, interrupt);
 }
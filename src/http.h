@@ -2,15 +2,23 @@
 
 #include <stdbool.h>
 
+#include <netinet/in.h>
 #include <sys/signal.h>
+#include <sys/types.h>
 
+#include "arena.h"
 #include "defines.h"
 #include "httpcodes.h"
+#include "router.h"
 #include "string_t.h"
 
+struct httpserver_shard;
+struct response_cache;
+
 struct header_t {
   char *key;
   char *value;
+  size_t value_len;
 };
 
 struct headers_t {
@@ -19,84 +27,448 @@ struct headers_t {
   size_t cap;
 };
 
+// Copy the value of the header into buff. Names are matched case-insensitively.
+// Prefer request_header, which does not copy.
 int headers_get(struct headers_t const *headers, char *buff, size_t buffsize,
                 char const *key);
 
+// Well-known headers, indexed by the parser as it scans them
+enum http_header {
+  HTTP_HEADER_ACCEPT,
+  HTTP_HEADER_ACCEPT_ENCODING,
+  HTTP_HEADER_CONNECTION,
+  HTTP_HEADER_CONTENT_LENGTH,
+  HTTP_HEADER_CONTENT_TYPE,
+  HTTP_HEADER_EXPECT,
+  HTTP_HEADER_HOST,
+  HTTP_HEADER_IF_MODIFIED_SINCE,
+  HTTP_HEADER_IF_NONE_MATCH,
+  HTTP_HEADER_IF_RANGE,
+  HTTP_HEADER_RANGE,
+  HTTP_HEADER_TRANSFER_ENCODING,
+  HTTP_HEADER_USER_AGENT,
+  HTTP_HEADER_COUNT,
+
+  // Any other header
+  HTTP_HEADER_UNKNOWN = HTTP_HEADER_COUNT,
+};
+
+// Classify a header name, case-insensitively
+enum http_header http_header_from_name(char const *name, size_t len);
+
 #define request_alloc_size 1024
 
+// Caps on the head of a request, checked as its bytes arrive. Heads larger
+// than the inline pool are chained into extra buffers up to these.
+struct request_limits {
+  // Bytes of the request line and headers, with their line breaks
+  size_t max_head_size;
+
+  // Header fields
+  size_t max_headers;
+
+  // Bytes of the request target, query string included
+  size_t max_uri_length;
+
+  // Bytes of a body buffered in the request. Routes that stream the body
+  // are not limited.
+  size_t max_body_size;
+};
+
+#define request_default_max_head_size (32 * 1024)
+#define request_default_max_headers 100
+#define request_default_max_uri_length (8 * 1024)
+#define request_default_max_body_size (1024 * 1024)
+
+// Compression of buffered response bodies
+struct compression_settings {
+  // From 1, the fastest, to 9, the smallest. 0 disables compression.
+  int level;
+
+  // Bodies smaller than this are sent as they are
+  size_t min_size;
+};
+
+#define compression_default_level 6
+#define compression_default_min_size 1024
+
+// Bytes of responses the cached routes keep by default, all of them together
+#define cache_default_size (64 * 1024 * 1024)
+
 struct request_t {
   char pool[request_alloc_size];
+
+  // Arena the body lives in, or NULL for the heap
+  struct arena *arena;
+
   char *method;
   char *path;
   char *protocol;
   struct headers_t headers;
 
+  // Index in headers of the first occurrence of every well-known header, plus
+  // one. Zero when absent.
+  size_t known_headers[HTTP_HEADER_COUNT];
+
+  // Route of the request and its handlers, found once the head is complete
+  enum route_result route;
+  struct route_handler handler;
+
+  // Parameters captured from the path by the route
+  struct route_params params;
+
+  // Free for a streaming route to keep its state in while the body arrives.
+  // NULL at first.
+  void *body_context;
+
+  // Whole body, null-terminated, unless the route streams it
   char *body;
+
+  // Bytes of the body. Chunked bodies are counted as they are decoded.
   size_t content_length;
+
+  // Trailer fields received after a chunked body, at the end of headers.
+  // They are not indexed as well-known headers.
+  size_t trailers;
 };
 
-struct request_t *parse_request(int fd);
+// Create an empty request. Arena requests are taken from the thread's
+// freelist and store their body in the arena. Otherwise everything is
+// allocated from the heap.
+struct request_t *new_request(struct arena *arena);
+
+// Append a header pointing into the request's pool, indexing it if it is a
+// well-known one
+int request_headers_append(struct request_t *req, char *key, size_t key_len,
+                           char *value, size_t value_len);
+
+// Value of a well-known header, or NULL when absent. Points into the request,
+// null-terminated, with its length stored in *len if len is not NULL.
+char const *request_header(struct request_t const *req, enum http_header header,
+                           size_t *len);
+
+// Value of the path parameter captured as ":name" or "*name", or NULL if the
+// route has none. Points into the path, not null-terminated, with its length
+// stored in *len.
+char const *request_param(struct request_t const *req, char const *name,
+                          size_t *len);
+
+// Value of any header, looked up by its case-insensitive name. Well-known
+// headers are found without scanning.
+char const *request_header_find(struct request_t const *req, char const *name,
+                                size_t *len);
+
 void free_request(struct request_t *req);
-size_t request_content_length(struct request_t const *req);
+
+// Length of the body announced by Content-Length, or 0 without one. Returns
+// -1 if a value is not a plain number, or if repeated headers disagree.
+int request_content_length(struct request_t const *req, size_t *length);
+
+// Whether the body is sent with the chunked transfer coding
+bool request_chunked(struct request_t const *req);
 void request_print(struct request_t *req);
 
+// Whether the client wants the connection to persist after the request
+bool request_keep_alive(struct request_t const *req);
+
+// Produces the next piece of a streamed body by appending it to out. Must
+// append something unless the body is complete. Returns 1 once the body is
+// complete, 0 if more is to come, and -1 on error, which cuts the response
+// short and closes the connection.
+typedef int (*response_producer)(void *context, struct string_t *out);
+
+// Appends what goes before the next segment of a file body to out, and sets
+// where the segment is. Returns 1 once no segment is left, having appended
+// what ends the body, 0 if the segment is to be sent, and -1 on error.
+typedef int (*response_segmenter)(void *context, struct string_t *out,
+                                  off_t *offset, size_t *length);
+
+// A body produced piece by piece, as fast as the client takes it, instead of
+// held whole in memory
+struct response_stream {
+  // Produces the body unless it is read from a file
+  response_producer produce;
+
+  // Called on the context once the stream ends, also when it fails, or NULL
+  void (*release)(void *context);
+
+  // Outlives the response, so it cannot come from the request's arena
+  void *context;
+
+  // File the body is read from, or -1. Sent with sendfile where the socket
+  // allows it, so that it never goes through userspace.
+  int file;
+  off_t offset;
+
+  // Bytes still to come when the length is known, or -1. Of the current
+  // segment only, for file bodies sent in segments.
+  ssize_t remaining;
+
+  // Bytes of the whole body announced in the head, or -1
+  ssize_t length;
+
+  // Finds the next segment of the file once one is sent, or NULL if the body
+  // is a single one
+  response_segmenter segment;
+
+  // Pieces are framed as chunks. Otherwise a body of unknown length ends
+  // when the connection closes.
+  bool chunked;
+};
+
 struct response_t {
   int fd;
+
+  // Arena the header keys and values live in, or NULL for the heap
+  struct arena *arena;
+
   char *protocol;
   enum http_status status;
   struct headers_t headers;
   struct string_t body;
+
+  // Replaces the body when set with response_stream
+  struct response_stream stream;
+
+  // Replaces the status, the headers and the body when set with
+  // response_send_frozen, or NULL
+  struct frozen_response const *frozen;
+
+  // Whether the body of the frozen response is sent, unlike for HEAD
+  bool frozen_body;
+
+  // Set by handlers that complete the response later with response_suspend,
+  // or NULL
+  struct response_async *async;
+};
+
+// Bytes of an entity tag, quotes, coding suffix and null terminator included
+#define etag_size 32
+
+// A response serialized once, ahead of time, and sent as it is to every
+// request it answers. Only the headers appended to the response being sent,
+// such as Connection, are spliced in between its headers and its body.
+struct frozen_response {
+  enum http_status status;
+
+  // Status line, headers, empty line and body, as they go on the wire
+  char *data;
+  size_t len;
+
+  // Bytes before the empty line, where the spliced headers go
+  size_t head_len;
+
+  // Entity tag of successful responses, sent as their ETag, or empty
+  char etag[etag_size];
 };
 
-// Create a new response wrapper for the given file descriptor
-struct response_t *new_response(int fd);
+// Create a new response wrapper for the given file descriptor. Arena responses
+// are taken from the thread's freelist and allocate from the arena, including
+// the body, which starts out as an empty string. Otherwise everything is
+// allocated from the heap.
+struct response_t *new_response(int fd, struct arena *arena);
+
+// Append the status line and the headers to out, up to the empty line that
+// precedes the body
+int response_serialize_head(struct response_t *res, struct string_t *out);
+
+// Append the response as it goes on the wire to out, without freeing it. Only
+// the head is appended when the body is streamed.
+int response_serialize(struct response_t *res, struct string_t *out);
+
+// Value of the first header of the response with the name, case-insensitively,
+// or NULL
+char const *response_header(struct response_t const *res, char const *key);
+
+// Replace the value of the header, or append it if the response has none
+int response_headers_set(struct response_t *res, char const *key,
+                         char const *value);
+
+// Serialize a heap response with a buffered body into frozen, and free it.
+// Returns -1 on error, or if the body is streamed.
+int response_freeze(struct response_t *res, struct frozen_response *frozen);
+
+// Serialize the response into frozen like response_freeze, but leave it as
+// it is, so that it can still be sent. Arena responses are copied too.
+int response_freeze_copy(struct response_t const *res,
+                         struct frozen_response *frozen);
+
+void frozen_response_free(struct frozen_response *frozen);
+
+// Answer with the frozen response. Headers appended to res are sent after its
+// own headers, and the rest of res is ignored. The body is left out for HEAD
+// requests.
+void response_send_frozen(struct response_t *res, struct request_t const *req,
+                          struct frozen_response const *frozen);
+
+// Stream the body instead of sending res->body. The head goes out as soon as
+// the handler returns, and then the producer is called whenever the socket
+// can take more, so that only a window of the body is ever in memory. With a
+// known length the body is sent as is, otherwise with chunked encoding.
+void response_stream(struct response_t *res, response_producer produce,
+                     void (*release)(void *context), void *context,
+                     ssize_t length);
+
+// Send length bytes of the open file from offset as the body. The file is not
+// closed: release is called on the context once the body is sent instead.
+void response_file(struct response_t *res, int file, off_t offset,
+                   size_t length, void (*release)(void *context),
+                   void *context);
+
+// Send segments of the open file as the body, length bytes in all, with what
+// the segmenter appends before each of them. The first segment is found right
+// away. Segments go out with sendfile like any file body.
+void response_file_segments(struct response_t *res, int file, size_t length,
+                            response_segmenter segment,
+                            void (*release)(void *context), void *context);
+
+// Whether the stream has a body left to send
+bool response_stream_active(struct response_stream const *stream);
+
+// Produce the next piece of the stream and append it to out, framed. File
+// bodies are read into out. Ends the stream once the body is complete.
+// Returns -1 on error, having ended it.
+int response_stream_next(struct response_stream *stream, struct string_t *out);
+
+// Whether the stream is in the middle of a segment of a file body, which
+// can be sent with response_stream_sendfile
+bool response_stream_sending_file(struct response_stream const *stream);
+
+// Send the next piece of a file body straight from the file to the socket.
+// Ends the stream once the body is complete. Returns the bytes sent, or -1
+// with errno set, having ended the stream unless the socket would block or the
+// call was interrupted.
+ssize_t response_stream_sendfile(struct response_stream *stream, int sockfd);
 
-// Write the response to the fd and free the response
-int response_close(struct response_t *res);
+// Release the context of the stream, if any is active
+void response_stream_end(struct response_stream *stream);
+
+// Let the client know whether the connection persists after the response
+int response_set_keep_alive(struct response_t *res, struct request_t const *req,
+                            bool keep_alive);
 
 // Append a header to the response
 int response_headers_append(struct response_t *headers, char const *key,
                             char const *value);
 
 // Free the response without writing to the socket
-// Do not call if response_close was already called
 void response_free(struct response_t *res);
 
-struct handler_t {
-  char *path;
-  char *method;
-  void (*handler)(struct response_t *, struct request_t *);
-};
-
-struct multiplexer_t {
-  struct handler_t *handlers;
-  size_t len;
-  size_t cap;
+enum serve_mode {
+  // A pool of worker threads, each serving one connection at a time
+  SERVE_MODE_THREADS,
+  // Non-blocking sockets driven by epoll event loops
+  SERVE_MODE_EVENTS,
+  // Completion-based io_uring loops, falling back to events if unsupported
+  SERVE_MODE_URING,
 };
 
 struct httpserver {
-  // Multiplexer for the server, mapping paths to handlers
-  struct multiplexer_t multiplexer;
+  // Radix tree mapping methods and paths to handlers
+  struct router router;
 
   // Mask with signals that are handler externally
   sigset_t interruptmask;
+
+  // Listener shards with their counters. Only set while serving.
+  struct httpserver_shard *shards;
+  size_t nshards;
+
+  // Seconds a persistent connection may stay idle between requests, and a
+  // new one before its first request. At least 1.
+  unsigned keepalive_timeout;
+
+  // Maximum number of requests served over a single connection
+  unsigned keepalive_max_requests;
+
+  // Requests past these are rejected with 414 or 431 before being read whole
+  struct request_limits limits;
+
+  // Compression of the bodies of responses to clients that accept it
+  struct compression_settings compression;
+
+  // Bytes of responses the cached routes keep at most, all of them together
+  size_t cache_size;
+
+  // Responses of the cached routes. Created along with the first of them.
+  struct response_cache *cache;
 };
 
-typedef void (*httpserver_callback)(struct response_t *, struct request_t *);
+typedef route_callback httpserver_callback;
 
 // Create a new http server
 struct httpserver *new_httpserver();
 
 // Register a handler for the given method and path
-// Either may be "*" to match any method or path
+// Either may be "*" to match any method or path. Path segments may be
+// parameters, as in "/users/:id", and the last one a wildcard, as in
+// "/static/*file". Handlers read them with request_param.
 int httpserver_register(struct httpserver *server, char const *method,
                         char const *path, httpserver_callback handler);
 
+// Register a handler along with a context it reads from
+// req->handler.context, so that one callback can serve several routes. The
+// context must outlive the server.
+int httpserver_register_context(struct httpserver *server, char const *method,
+                                char const *path, httpserver_callback handler,
+                                void *context);
+
+// Answer every request for the method and path with the frozen response,
+// which must outlive the server. Nothing is formatted or allocated to send it.
+int httpserver_register_frozen(struct httpserver *server, char const *method,
+                               char const *path,
+                               struct frozen_response const *frozen);
+
+// Register a handler whose successful responses are kept in the server's
+// response cache for ttl seconds, keyed on the method, the path and the values
+// of the request headers named in vary, a NULL-terminated list that may be
+// NULL and must outlive the server. Requests hitting the cache are answered
+// without calling the handler, and concurrent misses call it only once.
+int httpserver_register_cached(struct httpserver *server, char const *method,
+                               char const *path, httpserver_callback handler,
+                               unsigned ttl, char const *const *vary);
+
+// Register a handler that receives the body in chunks through on_body as it
+// arrives, straight from the connection's receive buffer, instead of in
+// req->body. The handler runs once the whole body was received. The
+// connection reads no more from the socket until on_body returns, so slow
+// handlers slow down the client instead of buffering its upload.
+int httpserver_register_streaming(struct httpserver *server, char const *method,
+                                  char const *path, route_body_callback on_body,
+                                  httpserver_callback handler);
+
+// Find the route of the request and its handlers. Called once its head is
+// complete, before dispatching it.
+void httpserver_route(struct httpserver const *server, struct request_t *req);
+
 // Serve the http server on the given socket file descriptor
+// Connections are handled by a pool of max_threads long-lived workers
 // If interrupt is not NULL, it'll be used to stop the server when set to true
 int httpserver_serve(struct httpserver *server, int sockfd, size_t max_threads,
                      volatile bool *interrupt);
 
+// Serve the http server on the given socket file descriptor using
+// non-blocking sockets and nloops epoll event loops, each on its own thread.
+// Handlers are run by the event loop once a request is complete.
+// If interrupt is not NULL, it'll be used to stop the server when set to true
+int httpserver_serve_events(struct httpserver *server, int sockfd,
+                            size_t nloops, volatile bool *interrupt);
+
+// Serve the http server on nshards sockets bound with SO_REUSEPORT, each with
+// its own accept loop and max_threads workers or event loops, depending on the
+// mode. Prints the counters of every shard, and of the response cache, when
+// done.
+// If interrupt is not NULL, it'll be used to stop the server when set to true
+int httpserver_serve_sharded(struct httpserver *server, int const *sockfds,
+                             size_t nshards, size_t max_threads,
+                             enum serve_mode mode, volatile bool *interrupt);
+
+// Let the handler of the routed request fill in the response. A NULL request
+// was rejected while parsing, with the status already set in the response.
+void httpserver_dispatch(struct httpserver_shard *shard, struct request_t *req,
+                         struct response_t *res, size_t thread_id,
+                         struct sockaddr_in const *addr);
+
 // Close the http server and free its resources
 // Does not close the socket file descriptor
 void httpserver_free(struct httpserver *server);
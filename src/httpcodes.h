@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stddef.h>
+
 enum http_status {
   HTTP_STATUS_OK = 200,
   HTTP_STATUS_CREATED = 201,
@@ -63,4 +65,8 @@ enum http_status {
   HTTP_STATUS_NETWORK_AUTHENTICATION_REQUIRED = 511,
 };
 
-char const *const httpcode_to_string(int code);
\ No newline at end of file
+char const *const httpcode_to_string(int code);
+
+// Status line of the code for HTTP/1.1, with its line break, as in
+// "HTTP/1.1 200 OK\r\n". Returns NULL for unknown codes.
+char const *httpcode_status_line(int code, size_t *len);
@@ -0,0 +1,141 @@
+#define _GNU_SOURCE // Required for timegm
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include "httpdate.h"
+
+struct http_date_slot {
+  // Odd while the slot is being written
+  atomic_uint version;
+
+  // Second the text stands for
+  atomic_llong second;
+
+  char text[http_date_len + 1];
+};
+
+struct http_date_slot http_date_slots[2];
+
+// Slot readers copy from
+atomic_uint http_date_current;
+
+// Held by the thread formatting the next second
+atomic_flag http_date_updating = ATOMIC_FLAG_INIT;
+
+char const http_date_days[7][4] = {"Sun", "Mon", "Tue", "Wed",
+                                   "Thu", "Fri", "Sat"};
+char const http_date_months[12][4] = {"Jan", "Feb", "Mar", "Apr",
+                                      "May", "Jun", "Jul", "Aug",
+                                      "Sep", "Oct", "Nov", "Dec"};
+
+void http_date_put2(char *const out, int const n) {
+  out[0] = '0' + n / 10;
+  out[1] = '0' + n % 10;
+}
+
+// Formatted without strftime, which depends on the locale
+void http_date_format(time_t const now, char out[http_date_len + 1]) {
+  struct tm tm;
+  gmtime_r(&now, &tm);
+
+  memcpy(out, "Sun, 00 Jan 0000 00:00:00 GMT", http_date_len + 1);
+  memcpy(out, http_date_days[tm.tm_wday], 3);
+  http_date_put2(out + 5, tm.tm_mday);
+  memcpy(out + 8, http_date_months[tm.tm_mon], 3);
+  http_date_put2(out + 12, (tm.tm_year + 1900) / 100);
+  http_date_put2(out + 14, (tm.tm_year + 1900) % 100);
+  http_date_put2(out + 17, tm.tm_hour);
+  http_date_put2(out + 20, tm.tm_min);
+  http_date_put2(out + 23, tm.tm_sec);
+}
+
+// Two digits at the position, or -1
+int http_date_get2(char const *const text) {
+  if (text[0] < '0' || text[0] > '9' || text[1] < '0' || text[1] > '9') {
+    return -1;
+  }
+  return (text[0] - '0') * 10 + text[1] - '0';
+}
+
+time_t http_date_parse(char const *const text) {
+  if (text == NULL || strnlen(text, http_date_len) != http_date_len ||
+      text[3] != ',' || text[4] != ' ' || text[7] != ' ' || text[11] != ' ' ||
+      text[16] != ' ' || text[19] != ':' || text[22] != ':' ||
+      strncmp(text + 25, " GMT", 4) != 0) {
+    return -1;
+  }
+
+  int month = 0;
+  while (month < 12 && strncmp(text + 8, http_date_months[month], 3) != 0) {
+    ++month;
+  }
+
+  int const century = http_date_get2(text + 12);
+  int const year = http_date_get2(text + 14);
+  struct tm tm = {
+      .tm_mday = http_date_get2(text + 5),
+      .tm_mon = month,
+      .tm_year = century * 100 + year - 1900,
+      .tm_hour = http_date_get2(text + 17),
+      .tm_min = http_date_get2(text + 20),
+      .tm_sec = http_date_get2(text + 23),
+  };
+  if (month == 12 || century < 0 || year < 0 || tm.tm_mday < 1 ||
+      tm.tm_hour < 0 || tm.tm_min < 0 || tm.tm_sec < 0) {
+    return -1;
+  }
+  return timegm(&tm);
+}
+
+// Format the second into the slot not in use and publish it
+void http_date_update(unsigned const current, time_t const now) {
+  struct http_date_slot *const slot = &http_date_slots[current ^ 1];
+
+  atomic_fetch_add_explicit(&slot->version, 1, memory_order_acq_rel);
+  http_date_format(now, slot->text);
+  atomic_store_explicit(&slot->second, now, memory_order_relaxed);
+  atomic_fetch_add_explicit(&slot->version, 1, memory_order_release);
+
+  atomic_store_explicit(&http_date_current, current ^ 1, memory_order_release);
+}
+
+void http_date(char out[http_date_len + 1]) {
+  time_t const now = time(NULL);
+
+  while (true) {
+    unsigned const current =
+        atomic_load_explicit(&http_date_current, memory_order_acquire);
+    struct http_date_slot *const slot = &http_date_slots[current];
+
+    if (atomic_load_explicit(&slot->second, memory_order_relaxed) != now &&
+        !atomic_flag_test_and_set_explicit(&http_date_updating,
+                                           memory_order_acquire)) {
+      http_date_update(current, now);
+      atomic_flag_clear_explicit(&http_date_updating, memory_order_release);
+      continue;
+    }
+
+    unsigned const version =
+        atomic_load_explicit(&slot->version, memory_order_acquire);
+    if (version % 2 == 1) {
+      // Rewritten under our feet: it is only being published for a moment
+      continue;
+    }
+
+    if (atomic_load_explicit(&slot->second, memory_order_relaxed) == 0) {
+      // Another thread is formatting the very first date
+      http_date_format(now, out);
+      return;
+    }
+
+    memcpy(out, slot->text, http_date_len + 1);
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&slot->version, memory_order_relaxed) ==
+        version) {
+      return;
+    }
+  }
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <time.h>
+
+// Current date in the format of the Date header, shared by every thread.
+//
+// The date is formatted at most once per second, into one of two slots: the
+// thread that notices the second changed formats the slot not in use and then
+// publishes it. Readers never wait, and retry the copy in the rare case that
+// a slot was rewritten while they read it.
+
+// Bytes of an HTTP-date, as in "Sun, 06 Nov 1994 08:49:37 GMT"
+#define http_date_len 29
+
+// Copy the current HTTP-date into out, null-terminated
+void http_date(char out[http_date_len + 1]);
+
+// Format the time as an HTTP-date into out, null-terminated
+void http_date_format(time_t time, char out[http_date_len + 1]);
+
+// Parse an HTTP-date in the preferred format, the only one sent nowadays.
+// Returns -1 if it is not one.
+time_t http_date_parse(char const *text);
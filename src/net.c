@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <stdbool.h>
 
 #include "defines.h"
 #include "net.h"
@@ -24,8 +25,8 @@ struct in_addr ip_address(uint8_t addr[4]) {
                                     addr[1] << 8 | addr[0]};
 }
 
-int bind_and_listen(struct sockaddr_in const *const addr,
-                    size_t const maxqueue) {
+int bind_and_listen_opt(struct sockaddr_in const *const addr,
+                        size_t const maxqueue, bool const reuseport) {
   int sockfd = socket(AF_INET, SOCK_STREAM, 0);
   if (sockfd < 0) {
     exiterr(1, "Could not create socket\n");
@@ -34,6 +35,13 @@ int bind_and_listen(struct sockaddr_in const *const addr,
   // Allow immediate reuse of the address
   setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &(int){1}, sizeof(int));
 
+  // Allow several sockets to share the port, with the kernel balancing the
+  // incoming connections between them
+  if (reuseport && setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &(int){1},
+                              sizeof(int)) != 0) {
+    exiterrno(1, "could not set SO_REUSEPORT");
+  }
+
   if (bind(sockfd, (struct sockaddr const *)addr, sizeof(*addr)) < 0) {
     exiterrno(1, "could not bind");
   }
@@ -44,3 +52,13 @@ int bind_and_listen(struct sockaddr_in const *const addr,
 
   return sockfd;
 }
+
+int bind_and_listen(struct sockaddr_in const *const addr,
+                    size_t const maxqueue) {
+  return bind_and_listen_opt(addr, maxqueue, false);
+}
+
+int bind_and_listen_reuseport(struct sockaddr_in const *const addr,
+                              size_t const maxqueue) {
+  return bind_and_listen_opt(addr, maxqueue, true);
+}
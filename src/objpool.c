@@ -0,0 +1,149 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "objpool.h"
+
+struct object_pool {
+  void *items[object_pool_max];
+  size_t len;
+};
+
+_Thread_local struct object_pool request_pool;
+_Thread_local struct object_pool response_pool;
+_Thread_local struct object_pool arena_block_pool;
+
+// Registers the thread for object_pool_drain on its first return
+_Thread_local bool object_pool_registered;
+
+pthread_key_t object_pool_key;
+pthread_once_t object_pool_once = PTHREAD_ONCE_INIT;
+
+// Free everything the exiting thread holds
+void object_pool_drain(void *unused) {
+  (void)unused;
+
+  while (request_pool.len > 0) {
+    struct request_t *const req = request_pool.items[--request_pool.len];
+    free(req->headers.data);
+    free(req);
+  }
+
+  while (response_pool.len > 0) {
+    struct response_t *const res = response_pool.items[--response_pool.len];
+    free(res->headers.data);
+    free(res);
+  }
+
+  while (arena_block_pool.len > 0) {
+    free(arena_block_pool.items[--arena_block_pool.len]);
+  }
+}
+
+void object_pool_create_key() {
+  pthread_key_create(&object_pool_key, object_pool_drain);
+}
+
+// Whether the object fits in the thread's freelist
+bool object_pool_push(struct object_pool *const pool, void *const item) {
+  if (!object_pool_registered) {
+    // Only threads with a non-NULL value get their destructor called
+    pthread_once(&object_pool_once, object_pool_create_key);
+    pthread_setspecific(object_pool_key, &object_pool_registered);
+    object_pool_registered = true;
+  }
+
+  if (pool->len == object_pool_max) {
+    return false;
+  }
+  pool->items[pool->len++] = item;
+  return true;
+}
+
+void *object_pool_pop(struct object_pool *const pool) {
+  return pool->len > 0 ? pool->items[--pool->len] : NULL;
+}
+
+// Allocate a header array of the default capacity, or NULL on failure
+struct headers_t object_pool_new_headers() {
+  struct header_t *const data =
+      malloc(object_pool_headers * sizeof(struct header_t));
+  return (struct headers_t){
+      .data = data,
+      .len = 0,
+      .cap = data != NULL ? object_pool_headers : 0,
+  };
+}
+
+// Empty the header array, dropping it if it grew too big to keep
+void object_pool_trim_headers(struct headers_t *const headers) {
+  if (headers->cap > object_pool_max_headers) {
+    free(headers->data);
+    *headers = object_pool_new_headers();
+  }
+  headers->len = 0;
+}
+
+struct request_t *request_pool_get() {
+  struct request_t *req = object_pool_pop(&request_pool);
+  if (req != NULL) {
+    return req;
+  }
+
+  req = malloc(sizeof(*req));
+  if (req != NULL) {
+    req->headers = object_pool_new_headers();
+  }
+  return req;
+}
+
+void request_pool_put(struct request_t *const req) {
+  object_pool_trim_headers(&req->headers);
+  if (!object_pool_push(&request_pool, req)) {
+    free(req->headers.data);
+    free(req);
+  }
+}
+
+struct response_t *response_pool_get() {
+  struct response_t *res = object_pool_pop(&response_pool);
+  if (res != NULL) {
+    return res;
+  }
+
+  res = malloc(sizeof(*res));
+  if (res != NULL) {
+    res->headers = object_pool_new_headers();
+  }
+  return res;
+}
+
+void response_pool_put(struct response_t *const res) {
+  object_pool_trim_headers(&res->headers);
+  if (!object_pool_push(&response_pool, res)) {
+    free(res->headers.data);
+    free(res);
+  }
+}
+
+struct arena_block *arena_block_pool_get() {
+  struct arena_block *block = object_pool_pop(&arena_block_pool);
+  if (block == NULL) {
+    block = malloc(sizeof(*block) + arena_block_size);
+    if (block == NULL) {
+      return NULL;
+    }
+  }
+
+  block->prev = NULL;
+  block->size = arena_block_size;
+  block->used = 0;
+  return block;
+}
+
+void arena_block_pool_put(struct arena_block *const block) {
+  if (block->size != arena_block_size ||
+      !object_pool_push(&arena_block_pool, block)) {
+    free(block);
+  }
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "arena.h"
+#include "http.h"
+
+// Thread-local freelists of the objects every connection needs: requests,
+// responses and arena blocks. Objects are reset and reused instead of freed,
+// so that once a thread has served a few connections, serving a small request
+// allocates nothing from malloc.
+//
+// Objects may be returned by a different thread than the one that took them.
+// Whatever a thread holds is freed when it exits.
+
+// Objects of each kind kept per thread at most. Anything past the high-water
+// mark is freed.
+#define object_pool_max 64
+
+// Header capacity of new pooled objects
+#define object_pool_headers 16
+
+// Header capacity a returned object may keep. Bigger arrays are freed.
+#define object_pool_max_headers 256
+
+// Take a request from the freelist, or allocate one. Its fields are not
+// initialised, except for the header array.
+struct request_t *request_pool_get();
+
+// Return a request whose memory is not owned by the caller anymore
+void request_pool_put(struct request_t *req);
+
+// Take a response from the freelist, or allocate one. Its fields are not
+// initialised, except for the header array.
+struct response_t *response_pool_get();
+
+void response_pool_put(struct response_t *res);
+
+// Take an empty block of arena_block_size bytes from the freelist, or allocate
+// one
+struct arena_block *arena_block_pool_get();
+
+// Return a block. Blocks of any other size are freed.
+void arena_block_pool_put(struct arena_block *block);
@@ -0,0 +1,523 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "parser.h"
+#include "scan.h"
+
+void parser_init(struct request_parser *const p, struct arena *const arena,
+                 struct request_limits const *const limits) {
+  *p = (struct request_parser){
+      .arena = arena,
+      .limits = limits,
+      .state = PARSER_METHOD,
+      .error = HTTP_STATUS_BAD_REQUEST,
+      .req = NULL,
+      .head = NULL,
+      .head_cap = 0,
+      .head_len = 0,
+      .head_total = 0,
+      .token = 0,
+      .value = 0,
+      .body_len = 0,
+      .body_cap = 0,
+      .chunk = 0,
+      .chunk_line = 0,
+      .trailers = false,
+  };
+}
+
+void parser_free(struct request_parser *const p) {
+  free_request(p->req);
+  parser_init(p, p->arena, p->limits);
+}
+
+ssize_t parser_reject(struct request_parser *const p,
+                      enum http_status const status) {
+  p->error = status;
+  return -1;
+}
+
+// Make room for n more bytes of the head, plus a null terminator. When the
+// buffer is full, the token being parsed moves on to a bigger one.
+int parser_reserve(struct request_parser *const p, size_t const n) {
+  if (p->head_total + n > p->limits->max_head_size) {
+    return parser_reject(p, HTTP_STATUS_REQUEST_HEADER_FIELDS_TOO_LARGE);
+  }
+
+  if (p->head_len + n < p->head_cap) {
+    return 0;
+  }
+
+  if (p->arena == NULL) {
+    return parser_reject(p, HTTP_STATUS_REQUEST_HEADER_FIELDS_TOO_LARGE);
+  }
+
+  size_t const kept = p->head_len - p->token;
+  size_t cap = p->head_cap * 2;
+  while (cap <= kept + n) {
+    cap *= 2;
+  }
+
+  char *const head = arena_alloc(p->arena, cap);
+  if (head == NULL) {
+    return -1;
+  }
+  memcpy(head, p->head + p->token, kept);
+
+  if (p->state == PARSER_HEADER_VALUE) {
+    p->value -= p->token;
+  }
+  p->head = head;
+  p->head_cap = cap;
+  p->head_len = kept;
+  p->token = 0;
+  return 0;
+}
+
+// Append a byte of the head to the buffer
+int parser_store(struct request_parser *const p, char const c) {
+  if (parser_reserve(p, 1) != 0) {
+    return -1;
+  }
+  p->head[p->head_len++] = c;
+  ++p->head_total;
+  return 0;
+}
+
+// Delimiters of every kind of token
+struct scan_set const parser_method_delims = {" \r\n"};
+struct scan_set const parser_path_delims = {" \r\n"};
+struct scan_set const parser_protocol_delims = {"\r\n "};
+struct scan_set const parser_key_delims = {":\r\n"};
+struct scan_set const parser_value_delims = {"\r\n"};
+
+// Scan a token ending at term, copying it into the head. Returns the number of
+// bytes consumed, including the terminator if it was found, or -1 on error.
+// Sets *complete once a delimiter is found. The delimiters include the
+// terminator.
+ssize_t parser_token(struct request_parser *const p, char const *const data,
+                     size_t const len, char const term,
+                     struct scan_set const *const delims,
+                     bool *const complete) {
+  size_t const n = scan_delimiters(data, len, delims);
+  if (p->state == PARSER_PATH &&
+      p->head_len - p->token + n > p->limits->max_uri_length) {
+    return parser_reject(p, HTTP_STATUS_URI_TOO_LONG);
+  }
+
+  // The terminator must follow in the same buffer
+  if (parser_reserve(p, n + 1) != 0) {
+    return -1;
+  }
+
+  memcpy(p->head + p->head_len, data, n);
+  p->head_len += n;
+  p->head_total += n;
+
+  *complete = n < len;
+  if (!*complete) {
+    return n;
+  }
+
+  if (data[n] != term) {
+    return -1;
+  }
+
+  // Terminate the token in place of its delimiter
+  if (parser_store(p, '\0') != 0) {
+    return -1;
+  }
+  return n + 1;
+}
+
+int parser_start_body(struct request_parser *const p) {
+  if (p->state != PARSER_HEAD_DONE) {
+    return -1;
+  }
+
+  struct request_t *const req = p->req;
+  if (req->known_headers[HTTP_HEADER_TRANSFER_ENCODING] != 0) {
+    if (!request_chunked(req)) {
+      p->state = PARSER_ERROR;
+      return parser_reject(p, HTTP_STATUS_NOT_IMPLEMENTED);
+    }
+
+    if (req->known_headers[HTTP_HEADER_CONTENT_LENGTH] != 0) {
+      // Ambiguous framing, as used to smuggle requests
+      p->state = PARSER_ERROR;
+      return -1;
+    }
+
+    // The length is counted as the chunks are decoded
+    req->content_length = 0;
+    p->state = PARSER_CHUNK_SIZE;
+    return 0;
+  }
+
+  if (req->content_length == 0) {
+    p->state = PARSER_DONE;
+    return 0;
+  }
+
+  p->body_len = 0;
+  p->state = PARSER_BODY;
+  if (req->handler.on_body != NULL) {
+    // Chunks go to the route as they arrive
+    return 0;
+  }
+
+  if (req->content_length > p->limits->max_body_size) {
+    p->state = PARSER_ERROR;
+    return parser_reject(p, HTTP_STATUS_PAYLOAD_TOO_LARGE);
+  }
+
+  // Extra byte for null terminator
+  // -> ignored in binary data as it is beyond the content length
+  size_t const slack = p->head_cap - p->head_len - 1;
+  size_t const body_size = req->content_length + 1;
+
+  // Optimize for small bodies: do not allocate
+  if (body_size < slack) {
+    req->body = p->head + p->head_len;
+  } else if (req->arena != NULL) {
+    req->body = arena_alloc(req->arena, body_size);
+  } else {
+    req->body = malloc(body_size);
+  }
+  if (req->body == NULL) {
+    p->state = PARSER_ERROR;
+    return -1;
+  }
+
+  return 0;
+}
+
+// Make room in the buffered body for the chunk about to be decoded and a null
+// terminator
+int parser_reserve_chunk(struct request_parser *const p) {
+  struct request_t *const req = p->req;
+  if (p->chunk > p->limits->max_body_size - req->content_length) {
+    return parser_reject(p, HTTP_STATUS_PAYLOAD_TOO_LARGE);
+  }
+  size_t const size = req->content_length + p->chunk + 1;
+
+  if (size <= p->body_cap) {
+    return 0;
+  }
+
+  size_t cap = p->body_cap > 0 ? p->body_cap * 2 : request_alloc_size;
+  while (cap < size) {
+    cap *= 2;
+  }
+
+  char *const body =
+      req->arena != NULL
+          ? arena_realloc(req->arena, req->body, p->body_cap, cap)
+          : realloc(req->body, cap);
+  if (body == NULL) {
+    return -1;
+  }
+
+  req->body = body;
+  p->body_cap = cap;
+  return 0;
+}
+
+// Hand decoded body bytes to the route, or append them to the buffered body
+int parser_deliver(struct request_parser *const p, char const *const data,
+                   size_t const len) {
+  struct request_t *const req = p->req;
+  if (req->handler.on_body != NULL) {
+    if (req->handler.on_body(req, data, len) != 0) {
+      return -1;
+    }
+  } else {
+    memcpy(req->body + p->body_len, data, len);
+  }
+  p->body_len += len;
+  return 0;
+}
+
+// Consume a byte of the chunk size line
+ssize_t parser_chunk_size(struct request_parser *const p, char const c) {
+  if (++p->chunk_line > parser_max_chunk_line) {
+    return -1;
+  }
+
+  int digit;
+  if (c >= '0' && c <= '9') {
+    digit = c - '0';
+  } else if (c >= 'a' && c <= 'f') {
+    digit = c - 'a' + 10;
+  } else if (c >= 'A' && c <= 'F') {
+    digit = c - 'A' + 10;
+  } else if (p->chunk_line == 1) {
+    // The size needs at least one digit
+    return -1;
+  } else if (c == ';') {
+    p->state = PARSER_CHUNK_EXT;
+    return 1;
+  } else if (c == '\r') {
+    p->state = PARSER_CHUNK_SIZE_LF;
+    return 1;
+  } else {
+    return -1;
+  }
+
+  // Bound the size before it grows, so that it cannot wrap around: by what
+  // is left of the body if it is buffered, else by what fits
+  size_t const max = p->req->handler.on_body == NULL
+                         ? p->limits->max_body_size - p->req->content_length
+                         : SIZE_MAX;
+  if (p->chunk > max >> 4 || (p->chunk << 4 | digit) > max) {
+    return parser_reject(p, HTTP_STATUS_PAYLOAD_TOO_LARGE);
+  }
+  p->chunk = p->chunk << 4 | digit;
+  return 1;
+}
+
+// The chunk size line is complete: get ready for its data, or for the
+// trailers after the last chunk
+ssize_t parser_chunk_start(struct request_parser *const p) {
+  p->chunk_line = 0;
+  if (p->chunk == 0) {
+    p->trailers = true;
+    p->state = PARSER_HEADER_START;
+    return 1;
+  }
+
+  if (p->req->handler.on_body == NULL && parser_reserve_chunk(p) != 0) {
+    return -1;
+  }
+  p->state = PARSER_CHUNK_DATA;
+  return 1;
+}
+
+// Consume a single framing byte of a chunked body, which must match want
+ssize_t parser_skip(struct request_parser *const p, char const c,
+                    char const want, enum parser_state const next) {
+  if (c != want) {
+    return -1;
+  }
+  p->state = next;
+  return 1;
+}
+
+// Consume a single delimiter byte, which must match want
+ssize_t parser_expect(struct request_parser *const p, char const c,
+                      char const want, enum parser_state const next) {
+  if (c != want || parser_store(p, c) != 0) {
+    return -1;
+  }
+  p->state = next;
+  return 1;
+}
+
+ssize_t parser_step(struct request_parser *const p, char const *const data,
+                    size_t const len) {
+  struct request_t *const req = p->req;
+  bool complete = false;
+  ssize_t n;
+
+  switch (p->state) {
+  case PARSER_METHOD:
+    n = parser_token(p, data, len, ' ', &parser_method_delims, &complete);
+    if (complete) {
+      req->method = p->head + p->token;
+      p->token = p->head_len;
+      p->state = PARSER_PATH;
+    }
+    return n;
+  case PARSER_PATH:
+    n = parser_token(p, data, len, ' ', &parser_path_delims, &complete);
+    if (complete) {
+      req->path = p->head + p->token;
+      p->token = p->head_len;
+      p->state = PARSER_PROTOCOL;
+    }
+    return n;
+  case PARSER_PROTOCOL:
+    n = parser_token(p, data, len, '\r', &parser_protocol_delims, &complete);
+    if (complete) {
+      req->protocol = p->head + p->token;
+      p->state = PARSER_REQUEST_LINE_LF;
+    }
+    return n;
+  case PARSER_REQUEST_LINE_LF:
+    return parser_expect(p, *data, '\n', PARSER_HEADER_START);
+  case PARSER_HEADER_START:
+    if (*data == '\r') {
+      return parser_expect(p, *data, '\r', PARSER_HEAD_LF);
+    }
+    if (req->headers.len == p->limits->max_headers) {
+      return parser_reject(p, HTTP_STATUS_REQUEST_HEADER_FIELDS_TOO_LARGE);
+    }
+    p->token = p->head_len;
+    p->state = PARSER_HEADER_KEY;
+    return 0;
+  case PARSER_HEADER_KEY:
+    n = parser_token(p, data, len, ':', &parser_key_delims, &complete);
+    if (complete) {
+      p->state = PARSER_HEADER_SPACE;
+    }
+    return n;
+  case PARSER_HEADER_SPACE:
+    n = parser_expect(p, *data, ' ', PARSER_HEADER_VALUE);
+    p->value = p->head_len;
+    return n;
+  case PARSER_HEADER_VALUE:
+    n = parser_token(p, data, len, '\r', &parser_value_delims, &complete);
+    if (complete) {
+      // The key is followed by its null terminator and the space
+      size_t const key_len = p->value - p->token - 2;
+      size_t const value_len = p->head_len - p->value - 1;
+      // Trailers are counted first, so that they are not indexed
+      req->trailers += p->trailers;
+      if (request_headers_append(req, p->head + p->token, key_len,
+                                 p->head + p->value, value_len) != 0) {
+        return -1;
+      }
+      p->state = PARSER_HEADER_LF;
+    }
+    return n;
+  case PARSER_HEADER_LF:
+    return parser_expect(p, *data, '\n', PARSER_HEADER_START);
+  case PARSER_HEAD_LF:
+    if (p->trailers) {
+      // End of the trailers, and of the chunked body
+      if (parser_skip(p, *data, '\n', PARSER_DONE) != 1) {
+        return -1;
+      }
+      if (req->body != NULL) {
+        req->body[p->body_len] = '\0';
+      }
+      req->content_length = p->body_len;
+      return 1;
+    }
+
+    if (parser_expect(p, *data, '\n', PARSER_HEAD_DONE) != 1) {
+      return -1;
+    }
+    p->head[p->head_len] = '\0';
+    if (request_content_length(req, &req->content_length) != 0) {
+      // A body that cannot be framed, or is framed two ways, as used to
+      // smuggle requests
+      return parser_reject(p, HTTP_STATUS_BAD_REQUEST);
+    }
+    return 1;
+  case PARSER_HEAD_DONE:
+    return 0;
+  case PARSER_BODY: {
+    size_t const missing = req->content_length - p->body_len;
+    size_t const take = len < missing ? len : missing;
+    if (parser_deliver(p, data, take) != 0) {
+      return -1;
+    }
+
+    if (p->body_len == req->content_length) {
+      if (req->body != NULL) {
+        req->body[req->content_length] = '\0';
+      }
+      p->state = PARSER_DONE;
+    }
+    return take;
+  }
+  case PARSER_CHUNK_SIZE:
+    return parser_chunk_size(p, *data);
+  case PARSER_CHUNK_EXT: {
+    // Extensions are skipped
+    char const *const cr = memchr(data, '\r', len);
+    size_t const n = cr == NULL ? len : (size_t)(cr - data);
+    p->chunk_line += n;
+    if (p->chunk_line > parser_max_chunk_line) {
+      return -1;
+    }
+    if (cr != NULL) {
+      p->state = PARSER_CHUNK_SIZE_LF;
+      return n + 1;
+    }
+    return n;
+  }
+  case PARSER_CHUNK_SIZE_LF:
+    if (*data != '\n') {
+      return -1;
+    }
+    return parser_chunk_start(p);
+  case PARSER_CHUNK_DATA: {
+    size_t const take = len < p->chunk ? len : p->chunk;
+    if (parser_deliver(p, data, take) != 0) {
+      return -1;
+    }
+    req->content_length = p->body_len;
+
+    p->chunk -= take;
+    if (p->chunk == 0) {
+      p->state = PARSER_CHUNK_DATA_CR;
+    }
+    return take;
+  }
+  case PARSER_CHUNK_DATA_CR:
+    return parser_skip(p, *data, '\r', PARSER_CHUNK_DATA_LF);
+  case PARSER_CHUNK_DATA_LF:
+    return parser_skip(p, *data, '\n', PARSER_CHUNK_SIZE);
+  case PARSER_DONE:
+    return 0;
+  case PARSER_ERROR:
+    return -1;
+  }
+
+  return -1;
+}
+
+ssize_t parser_feed(struct request_parser *const p, char const *const data,
+                    size_t const len) {
+  if (p->state == PARSER_ERROR) {
+    return -1;
+  }
+
+  if (p->req == NULL && len > 0) {
+    p->req = new_request(p->arena);
+    if (p->req == NULL) {
+      p->state = PARSER_ERROR;
+      return -1;
+    }
+    p->head = p->req->pool;
+    p->head_cap = request_alloc_size;
+  }
+
+  size_t consumed = 0;
+  while (consumed < len && p->state != PARSER_HEAD_DONE &&
+         p->state != PARSER_DONE) {
+    ssize_t const n = parser_step(p, data + consumed, len - consumed);
+    if (n < 0) {
+      p->state = PARSER_ERROR;
+      return -1;
+    }
+    consumed += n;
+  }
+
+  return consumed;
+}
+
+bool parser_head_done(struct request_parser const *const p) {
+  return p->state == PARSER_HEAD_DONE;
+}
+
+bool parser_done(struct request_parser const *const p) {
+  return p->state == PARSER_DONE;
+}
+
+bool parser_idle(struct request_parser const *const p) {
+  return p->req == NULL;
+}
+
+struct request_t *parser_consume(struct request_parser *const p) {
+  if (p->state != PARSER_DONE) {
+    return NULL;
+  }
+
+  struct request_t *const req = p->req;
+  p->req = NULL;
+  parser_init(p, p->arena, p->limits);
+  return req;
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <sys/types.h>
+
+#include "http.h"
+
+enum parser_state {
+  PARSER_METHOD,
+  PARSER_PATH,
+  PARSER_PROTOCOL,
+  PARSER_REQUEST_LINE_LF,
+  PARSER_HEADER_START,
+  PARSER_HEADER_KEY,
+  PARSER_HEADER_SPACE,
+  PARSER_HEADER_VALUE,
+  PARSER_HEADER_LF,
+  PARSER_HEAD_LF,
+  PARSER_HEAD_DONE,
+  PARSER_BODY,
+  PARSER_CHUNK_SIZE,
+  PARSER_CHUNK_EXT,
+  PARSER_CHUNK_SIZE_LF,
+  PARSER_CHUNK_DATA,
+  PARSER_CHUNK_DATA_CR,
+  PARSER_CHUNK_DATA_LF,
+  PARSER_DONE,
+  PARSER_ERROR,
+};
+
+// Resumable request parser.
+//
+// Bytes are fed as they arrive, in chunks of any size. The parser remembers
+// where it stopped, so no byte is ever scanned twice, no matter how the request
+// was split across reads. The head is copied into the request's pool as it is
+// scanned, with the delimiters replaced by null terminators.
+//
+// Heads that outgrow the pool continue in bigger buffers from the arena. Only
+// the token being scanned is moved, so earlier tokens never change address.
+struct request_parser {
+  // Arena requests are allocated from, or NULL for the heap
+  struct arena *arena;
+
+  // Caps on the head, enforced as it arrives
+  struct request_limits const *limits;
+
+  enum parser_state state;
+
+  // Status to reject the request with once the state is PARSER_ERROR
+  enum http_status error;
+
+  // Request being built. Owned by the parser until consumed.
+  struct request_t *req;
+
+  // Buffer the head is stored in: the request's pool, or one chained to it
+  char *head;
+  size_t head_cap;
+
+  // Bytes stored in the current buffer so far
+  size_t head_len;
+
+  // Bytes of the head received so far, in all buffers
+  size_t head_total;
+
+  // Start of the token or header line being parsed, within the buffer
+  size_t token;
+
+  // Start of the header value being parsed, within the buffer
+  size_t value;
+
+  // Bytes of the body received so far
+  size_t body_len;
+
+  // Capacity of a chunked body being buffered
+  size_t body_cap;
+
+  // Bytes of the chunk being decoded still to come
+  size_t chunk;
+
+  // Bytes of the chunk size line seen so far, extensions included
+  size_t chunk_line;
+
+  // The header fields being parsed are the trailers of a chunked body
+  bool trailers;
+};
+
+// Bytes of a chunk size line, with its extensions, at most
+#define parser_max_chunk_line 1024
+
+void parser_init(struct request_parser *p, struct arena *arena,
+                 struct request_limits const *limits);
+
+// Free the request being built, if any
+void parser_free(struct request_parser *p);
+
+// Feed received bytes to the parser. Stops right after the end of the head,
+// so that the request can be routed before its body is received, and right
+// after the end of the request, so that the remaining bytes can be fed once
+// the request is consumed.
+// Returns the number of bytes consumed, or -1 if the request is malformed or
+// over the limits, with the status to answer with in p->error.
+ssize_t parser_feed(struct request_parser *p, char const *data, size_t len);
+
+// Whether the head is complete, waiting for parser_start_body
+bool parser_head_done(struct request_parser const *p);
+
+// Get ready to receive the body of the routed request: through the route's
+// on_body callback if it has one, otherwise into req->body. Chunked bodies are
+// decoded as they arrive, and their trailers appended to the headers. Returns
+// -1 if the body is too large to buffer or its transfer coding is not
+// supported, with the status in p->error.
+int parser_start_body(struct request_parser *p);
+
+// Whether a complete request is ready to be consumed
+bool parser_done(struct request_parser const *p);
+
+// Whether the parser is between requests, with no byte of the next one seen
+bool parser_idle(struct request_parser const *p);
+
+// Take ownership of the complete request and get ready for the next one.
+// Returns NULL if no request is complete.
+struct request_t *parser_consume(struct request_parser *p);
@@ -0,0 +1,411 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <sys/random.h>
+
+#include "httpdate.h"
+#include "range.h"
+
+// Parse the digits at *p into n, saturating, and move past them. Returns
+// false if there are none.
+bool range_number(char const **const p, size_t *const n) {
+  char const *c = *p;
+  size_t value = 0;
+  for (; *c >= '0' && *c <= '9'; ++c) {
+    size_t const digit = *c - '0';
+    value = value > (SIZE_MAX - digit) / 10 ? SIZE_MAX : value * 10 + digit;
+  }
+
+  bool const found = c != *p;
+  *p = c;
+  *n = value;
+  return found;
+}
+
+int range_parse(char const *const header, size_t const size,
+                struct byte_range *const ranges, size_t const max) {
+  if (strncasecmp(header, "bytes=", 6) != 0) {
+    return -1;
+  }
+
+  char const *p = header + 6;
+  size_t seen = 0;
+  size_t count = 0;
+  while (true) {
+    p += strspn(p, " \t,");
+    if (*p == '\0') {
+      break;
+    }
+
+    // "first-last", "first-" or "-suffix"
+    size_t first = 0;
+    size_t last = SIZE_MAX;
+    bool const suffix = *p == '-';
+    if (suffix) {
+      ++p;
+      if (!range_number(&p, &last)) {
+        return -1;
+      }
+    } else {
+      if (!range_number(&p, &first) || *p != '-') {
+        return -1;
+      }
+      ++p;
+      size_t n;
+      if (range_number(&p, &n)) {
+        if (n < first) {
+          return -1;
+        }
+        last = n;
+      }
+    }
+
+    p += strspn(p, " \t");
+    if ((*p != ',' && *p != '\0') || ++seen > max) {
+      return -1;
+    }
+
+    if (suffix) {
+      // The last bytes, as many as there are
+      if (last == 0 || size == 0) {
+        continue;
+      }
+      first = last >= size ? 0 : size - last;
+      last = size - 1;
+    } else {
+      if (first >= size) {
+        continue;
+      }
+      last = last >= size ? size - 1 : last;
+    }
+    ranges[count++] = (struct byte_range){.first = first, .last = last};
+  }
+
+  return seen == 0 ? -1 : (int)count;
+}
+
+size_t range_merge(struct byte_range *const ranges, size_t const count) {
+  // By first byte. There are few ranges.
+  for (size_t i = 1; i < count; ++i) {
+    struct byte_range const range = ranges[i];
+    size_t j = i;
+    for (; j > 0 && ranges[j - 1].first > range.first; --j) {
+      ranges[j] = ranges[j - 1];
+    }
+    ranges[j] = range;
+  }
+
+  size_t merged = 0;
+  for (size_t i = 0; i < count; ++i) {
+    struct byte_range *const prev = merged > 0 ? &ranges[merged - 1] : NULL;
+    if (prev != NULL && ranges[i].first <= prev->last + 1) {
+      prev->last = ranges[i].last > prev->last ? ranges[i].last : prev->last;
+    } else {
+      ranges[merged++] = ranges[i];
+    }
+  }
+  return merged;
+}
+
+// Whether the If-Range of the request, if any, matches the response, so that
+// the ranges can be sent. Tags are compared strongly, and dates exactly.
+bool range_if_range(struct request_t const *const req,
+                    struct response_t const *const res) {
+  char const *const if_range = request_header(req, HTTP_HEADER_IF_RANGE, NULL);
+  if (if_range == NULL) {
+    return true;
+  }
+
+  if (if_range[0] == '"') {
+    char const *const etag = response_header(res, "ETag");
+    return etag != NULL && strcmp(etag, if_range) == 0;
+  }
+
+  char const *const last_modified = response_header(res, "Last-Modified");
+  time_t const since = http_date_parse(if_range);
+  return since >= 0 && last_modified != NULL &&
+         http_date_parse(last_modified) == since;
+}
+
+// Append the head of every part of a multipart body to heads, and what ends
+// the body, noting in ends where each of them ends
+int range_render(struct string_t *const heads, size_t *const ends,
+                 struct byte_range const *const ranges, size_t const count,
+                 size_t const size, char const *const boundary,
+                 char const *const content_type) {
+  for (size_t i = 0; i < count; ++i) {
+    if ((i > 0 && string_append_literal(heads, "\r\n") != 0) ||
+        string_append_literal(heads, "--") != 0 ||
+        string_append(heads, boundary, strlen(boundary)) != 0 ||
+        string_append_literal(heads, "\r\n") != 0) {
+      return -1;
+    }
+
+    if (content_type != NULL &&
+        (string_append_literal(heads, "Content-Type: ") != 0 ||
+         string_append(heads, content_type, strlen(content_type)) != 0 ||
+         string_append_literal(heads, "\r\n") != 0)) {
+      return -1;
+    }
+
+    if (string_append_literal(heads, "Content-Range: bytes ") != 0 ||
+        string_append_decimal(heads, ranges[i].first) != 0 ||
+        string_append_literal(heads, "-") != 0 ||
+        string_append_decimal(heads, ranges[i].last) != 0 ||
+        string_append_literal(heads, "/") != 0 ||
+        string_append_decimal(heads, size) != 0 ||
+        string_append_literal(heads, "\r\n\r\n") != 0) {
+      return -1;
+    }
+    ends[i] = heads->len;
+  }
+
+  if (string_append_literal(heads, "\r\n--") != 0 ||
+      string_append(heads, boundary, strlen(boundary)) != 0 ||
+      string_append_literal(heads, "--\r\n") != 0) {
+    return -1;
+  }
+  ends[count] = heads->len;
+  return 0;
+}
+
+// Parts of a file body, sent one segment after another
+struct range_parts {
+  struct byte_range ranges[range_max];
+  size_t count;
+
+  // Part being sent
+  size_t next;
+
+  // Offset of the body within the file
+  off_t base;
+
+  // Heads of the parts, back to back, and where each of them ends
+  struct string_t heads;
+  size_t ends[range_max + 1];
+
+  // Stream the parts were cut from
+  void (*release)(void *context);
+  void *context;
+};
+
+int range_segment(void *const context, struct string_t *const out,
+                  off_t *const offset, size_t *const length) {
+  struct range_parts *const parts = context;
+
+  size_t const start = parts->next == 0 ? 0 : parts->ends[parts->next - 1];
+  if (string_append(out, parts->heads.data + start,
+                    parts->ends[parts->next] - start) != 0) {
+    return -1;
+  }
+
+  if (parts->next == parts->count) {
+    return 1;
+  }
+
+  struct byte_range const *const range = &parts->ranges[parts->next++];
+  *offset = parts->base + range->first;
+  *length = range->last - range->first + 1;
+  return 0;
+}
+
+void range_release(void *const context) {
+  struct range_parts *const parts = context;
+  if (parts->release != NULL) {
+    parts->release(parts->context);
+  }
+  string_free(&parts->heads);
+  free(parts);
+}
+
+// Send the parts of the file body as segments of it
+int range_file_parts(struct response_t *const res,
+                     struct byte_range const *const ranges, size_t const count,
+                     size_t const size, char const *const boundary,
+                     char const *const content_type) {
+  struct range_parts *const parts = malloc(sizeof(*parts));
+  if (parts == NULL) {
+    return -1;
+  }
+
+  parts->heads = null_string();
+  if (range_render(&parts->heads, parts->ends, ranges, count, size, boundary,
+                   content_type) != 0) {
+    string_free(&parts->heads);
+    free(parts);
+    return -1;
+  }
+
+  size_t length = parts->heads.len;
+  for (size_t i = 0; i < count; ++i) {
+    length += ranges[i].last - ranges[i].first + 1;
+  }
+
+  memcpy(parts->ranges, ranges, count * sizeof(*ranges));
+  parts->count = count;
+  parts->next = 0;
+  parts->base = res->stream.offset;
+
+  // The parts take over the stream, and release it once they are sent
+  int const file = res->stream.file;
+  parts->release = res->stream.release;
+  parts->context = res->stream.context;
+  res->stream.produce = NULL;
+  res->stream.file = -1;
+
+  response_file_segments(res, file, length, range_segment, range_release,
+                         parts);
+  return 0;
+}
+
+// Replace the buffered body with its parts
+int range_body_parts(struct response_t *const res,
+                     struct byte_range const *const ranges, size_t const count,
+                     char const *const boundary,
+                     char const *const content_type) {
+  struct string_t heads = null_string();
+  size_t ends[range_max + 1];
+  if (range_render(&heads, ends, ranges, count, res->body.len, boundary,
+                   content_type) != 0) {
+    string_free(&heads);
+    return -1;
+  }
+
+  struct string_t body = res->body.arena != NULL
+                             ? arena_string(res->body.arena)
+                             : null_string();
+  size_t start = 0;
+  int err = 0;
+  for (size_t i = 0; i <= count && err == 0; ++i) {
+    err = string_append(&body, heads.data + start, ends[i] - start);
+    start = ends[i];
+    if (i < count && err == 0) {
+      err = string_append(&body, res->body.data + ranges[i].first,
+                          ranges[i].last - ranges[i].first + 1);
+    }
+  }
+  string_free(&heads);
+
+  if (err != 0) {
+    string_free(&body);
+    return -1;
+  }
+  string_free(&res->body);
+  res->body = body;
+  return 0;
+}
+
+// Answer with the ranges as multipart/byteranges
+int range_multipart(struct response_t *const res, bool const file,
+                    struct byte_range const *const ranges, size_t const count,
+                    size_t const size) {
+  // Unlikely to appear in the body by chance
+  uint64_t bits = 0;
+  if (getrandom(&bits, sizeof(bits), GRND_NONBLOCK) != sizeof(bits)) {
+    bits = (uintptr_t)res ^ (uint64_t)size << 32;
+  }
+  char boundary[32];
+  snprintf(boundary, sizeof(boundary), "range_%016llx",
+           (unsigned long long)bits);
+
+  // Every part is of the type of the whole body
+  char const *const type = response_header(res, "Content-Type");
+  char *const content_type = type != NULL ? strdup(type) : NULL;
+  if (type != NULL && content_type == NULL) {
+    return -1;
+  }
+
+  int err = file ? range_file_parts(res, ranges, count, size, boundary,
+                                    content_type)
+                 : range_body_parts(res, ranges, count, boundary,
+                                    content_type);
+  free(content_type);
+  if (err != 0) {
+    return -1;
+  }
+
+  char multipart[64];
+  snprintf(multipart, sizeof(multipart),
+           "multipart/byteranges; boundary=%s", boundary);
+  response_headers_set(res, "Content-Type", multipart);
+  return 0;
+}
+
+void range_response(struct response_t *const res,
+                    struct request_t const *const req) {
+  if (req == NULL || strcmp(req->method, "GET") != 0 ||
+      res->status != HTTP_STATUS_OK || res->frozen != NULL) {
+    return;
+  }
+
+  // Bodies produced piece by piece have no known bytes to pick from
+  bool const file = res->stream.file >= 0 && res->stream.segment == NULL;
+  if (response_stream_active(&res->stream) && !file) {
+    return;
+  }
+
+  size_t const size = file ? (size_t)res->stream.remaining : res->body.len;
+  if (file && response_headers_append(res, "Accept-Ranges", "bytes") != 0) {
+    return;
+  }
+
+  char const *const header = request_header(req, HTTP_HEADER_RANGE, NULL);
+  if (header == NULL || !range_if_range(req, res)) {
+    return;
+  }
+
+  struct byte_range ranges[range_max];
+  int const parsed = range_parse(header, size, ranges, range_max);
+  if (parsed < 0) {
+    return;
+  }
+
+  // Ranges that ask for more than the whole body overlap: it is cheaper to
+  // send it once
+  size_t requested = 0;
+  for (int i = 0; i < parsed; ++i) {
+    requested += ranges[i].last - ranges[i].first + 1;
+  }
+  if (requested > size) {
+    return;
+  }
+  size_t const count = range_merge(ranges, parsed);
+
+  char content_range[80];
+  if (count == 0) {
+    snprintf(content_range, sizeof(content_range), "bytes */%zu", size);
+    res->status = HTTP_STATUS_RANGE_NOT_SATISFIABLE;
+    res->body.len = 0;
+    response_stream_end(&res->stream);
+    response_headers_set(res, "Content-Range", content_range);
+    return;
+  }
+
+  if (count > 1) {
+    if (range_multipart(res, file, ranges, count, size) == 0) {
+      res->status = HTTP_STATUS_PARTIAL_CONTENT;
+    }
+    return;
+  }
+
+  struct byte_range const range = ranges[0];
+  size_t const length = range.last - range.first + 1;
+  snprintf(content_range, sizeof(content_range), "bytes %zu-%zu/%zu",
+           range.first, range.last, size);
+  if (response_headers_set(res, "Content-Range", content_range) != 0) {
+    return;
+  }
+
+  res->status = HTTP_STATUS_PARTIAL_CONTENT;
+  if (file) {
+    res->stream.offset += range.first;
+    res->stream.remaining = length;
+    res->stream.length = length;
+  } else {
+    memmove(res->body.data, res->body.data + range.first, length);
+    res->body.len = length;
+  }
+}
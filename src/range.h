@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <sys/types.h>
+
+#include "http.h"
+
+// Byte range requests: 206 Partial Content for clients that ask for parts of
+// a response, such as downloads resuming where they were cut short.
+//
+// Ranges apply to buffered bodies and to file bodies, whose ranges are still
+// sent with sendfile. Overlapping and adjacent ranges are merged, and those
+// left are sent in order, as multipart/byteranges if there are several. A
+// Range header that cannot be parsed, that asks for more than range_max
+// ranges, or for more bytes than the body has, is ignored and the whole
+// response sent.
+
+// Ranges of a request at most
+#define range_max 16
+
+// First and last byte of a range, both included
+struct byte_range {
+  size_t first;
+  size_t last;
+};
+
+// Parse the value of a Range header into ranges, resolved against the size of
+// the body. Returns the number of ranges that can be satisfied, 0 if none,
+// or -1 if the header is to be ignored.
+int range_parse(char const *header, size_t size, struct byte_range *ranges,
+                size_t max);
+
+// Sort the ranges and merge those that overlap or touch. Returns how many are
+// left.
+size_t range_merge(struct byte_range *ranges, size_t count);
+
+// Answer GET requests with a Range header with the parts they ask for, or 416
+// if none can be sent. Successful file responses announce Accept-Ranges.
+// Runs after compression, so that ranges count bytes of the body as sent.
+void range_response(struct response_t *res, struct request_t const *req);
@@ -0,0 +1,373 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "router.h"
+
+void route_node_init(struct route_node *const node) {
+  *node = (struct route_node){
+      .prefix = NULL,
+      .prefix_len = 0,
+      .children = NULL,
+      .nchildren = 0,
+      .param = NULL,
+      .param_name = NULL,
+      .wildcard = NULL,
+      .wildcard_name = NULL,
+      .methods = NULL,
+      .nmethods = 0,
+  };
+}
+
+struct route_node *new_route_node(char const *const prefix, size_t const len) {
+  struct route_node *const node = malloc(sizeof(*node));
+  if (node == NULL) {
+    return NULL;
+  }
+  route_node_init(node);
+
+  node->prefix = strndup(prefix, len);
+  if (node->prefix == NULL) {
+    free(node);
+    return NULL;
+  }
+  node->prefix_len = len;
+  return node;
+}
+
+void route_node_free(struct route_node *const node) {
+  for (size_t i = 0; i < node->nchildren; ++i) {
+    route_node_free(node->children[i]);
+    free(node->children[i]);
+  }
+  free(node->children);
+
+  if (node->param != NULL) {
+    route_node_free(node->param);
+    free(node->param);
+  }
+  free(node->param_name);
+
+  if (node->wildcard != NULL) {
+    route_node_free(node->wildcard);
+    free(node->wildcard);
+  }
+  free(node->wildcard_name);
+
+  for (size_t i = 0; i < node->nmethods; ++i) {
+    free(node->methods[i].method);
+  }
+  free(node->methods);
+  free(node->prefix);
+}
+
+void router_init(struct router *const router) {
+  route_node_init(&router->root);
+}
+
+void router_free(struct router *const router) {
+  route_node_free(&router->root);
+  route_node_init(&router->root);
+}
+
+int route_node_append_child(struct route_node *const node,
+                            struct route_node *const child) {
+  struct route_node **const children =
+      realloc(node->children, (node->nchildren + 1) * sizeof(*children));
+  if (children == NULL) {
+    return -1;
+  }
+
+  node->children = children;
+  node->children[node->nchildren] = child;
+  ++node->nchildren;
+  return 0;
+}
+
+// Split the child's prefix after its first len characters, so that the first
+// part can be shared with a new sibling. Returns the node holding the first
+// part, which takes the child's place.
+struct route_node *route_node_split(struct route_node *const node,
+                                    size_t const idx, size_t const len) {
+  struct route_node *const child = node->children[idx];
+
+  struct route_node *const head = new_route_node(child->prefix, len);
+  if (head == NULL) {
+    return NULL;
+  }
+
+  char *const rest =
+      strndup(child->prefix + len, child->prefix_len - len);
+  if (rest == NULL || route_node_append_child(head, child) != 0) {
+    free(rest);
+    route_node_free(head);
+    free(head);
+    return NULL;
+  }
+
+  free(child->prefix);
+  child->prefix = rest;
+  child->prefix_len -= len;
+
+  node->children[idx] = head;
+  return head;
+}
+
+// Insert the static text below the node, splitting prefixes as needed.
+// Returns the node where the text ends.
+struct route_node *route_insert_static(struct route_node *node,
+                                       char const *text, size_t len) {
+  while (len > 0) {
+    size_t idx = 0;
+    while (idx < node->nchildren && node->children[idx]->prefix[0] != *text) {
+      ++idx;
+    }
+
+    if (idx == node->nchildren) {
+      struct route_node *const child = new_route_node(text, len);
+      if (child == NULL) {
+        return NULL;
+      }
+      if (route_node_append_child(node, child) != 0) {
+        route_node_free(child);
+        free(child);
+        return NULL;
+      }
+      return child;
+    }
+
+    struct route_node *child = node->children[idx];
+
+    size_t common = 0;
+    while (common < len && common < child->prefix_len &&
+           child->prefix[common] == text[common]) {
+      ++common;
+    }
+
+    if (common < child->prefix_len) {
+      child = route_node_split(node, idx, common);
+      if (child == NULL) {
+        return NULL;
+      }
+    }
+
+    node = child;
+    text += common;
+    len -= common;
+  }
+
+  return node;
+}
+
+// Get the child of the node matching a ":name" or "*name" segment, creating it
+// if needed. Fails if a different name was registered for the same child.
+struct route_node *route_dynamic_child(struct route_node **const child,
+                                       char **const child_name,
+                                       char const *const name,
+                                       size_t const len) {
+  if (*child != NULL) {
+    bool const same =
+        strlen(*child_name) == len && strncmp(*child_name, name, len) == 0;
+    return same ? *child : NULL;
+  }
+
+  *child_name = strndup(name, len);
+  if (*child_name == NULL) {
+    return NULL;
+  }
+
+  *child = new_route_node("", 0);
+  if (*child == NULL) {
+    free(*child_name);
+    *child_name = NULL;
+  }
+  return *child;
+}
+
+// Whether the pattern starts a ":param" or "*" segment at it
+bool route_dynamic_at(char const *const pattern, char const *const it) {
+  return (*it == ':' || *it == '*') && (it == pattern || it[-1] == '/');
+}
+
+int route_node_add_method(struct route_node *const node,
+                          char const *const method,
+                          struct route_handler const handler) {
+  for (size_t i = 0; i < node->nmethods; ++i) {
+    if (strcmp(node->methods[i].method, method) == 0) {
+      // The first registered handler wins
+      return 0;
+    }
+  }
+
+  struct route_method *const methods =
+      realloc(node->methods, (node->nmethods + 1) * sizeof(*methods));
+  if (methods == NULL) {
+    return -1;
+  }
+  node->methods = methods;
+
+  char *const copy = strndup(method, 32);
+  if (copy == NULL) {
+    return -1;
+  }
+
+  node->methods[node->nmethods] = (struct route_method){
+      .method = copy,
+      .handler = handler,
+  };
+  ++node->nmethods;
+  return 0;
+}
+
+int router_add(struct router *const router, char const *const method,
+               char const *const pattern, struct route_handler const handler) {
+  struct route_node *node = &router->root;
+  size_t nparams = 0;
+
+  char const *it = pattern;
+  while (*it != '\0') {
+    if (!route_dynamic_at(pattern, it)) {
+      char const *end = it;
+      while (*end != '\0' && !route_dynamic_at(pattern, end)) {
+        ++end;
+      }
+
+      node = route_insert_static(node, it, end - it);
+      if (node == NULL) {
+        return -1;
+      }
+      it = end;
+      continue;
+    }
+
+    if (++nparams > route_max_params) {
+      return -1;
+    }
+
+    char const *const name = it + 1;
+    size_t const len = strcspn(name, "/");
+
+    if (*it == '*') {
+      if (name[len] != '\0') {
+        // Wildcards must be the last segment
+        return -1;
+      }
+      node = route_dynamic_child(&node->wildcard, &node->wildcard_name, name,
+                                 len);
+    } else {
+      if (len == 0) {
+        return -1;
+      }
+      node = route_dynamic_child(&node->param, &node->param_name, name, len);
+    }
+
+    if (node == NULL) {
+      return -1;
+    }
+    it = name + len;
+  }
+
+  return route_node_add_method(node, method, handler);
+}
+
+// Find the handlers for the method among the node's. Sets *not_allowed when
+// the route exists but not for this method.
+bool route_node_method(struct route_node const *const node,
+                       char const *const method,
+                       struct route_handler *const handler,
+                       bool *const not_allowed) {
+  for (size_t i = 0; i < node->nmethods; ++i) {
+    if (strcmp(node->methods[i].method, method) == 0 ||
+        strcmp(node->methods[i].method, "*") == 0) {
+      *handler = node->methods[i].handler;
+      return true;
+    }
+  }
+
+  *not_allowed |= node->nmethods > 0;
+  return false;
+}
+
+bool route_params_push(struct route_params *const params,
+                       char const *const name, char const *const value,
+                       size_t const len) {
+  if (params->len == route_max_params) {
+    return false;
+  }
+  params->data[params->len++] = (struct route_param){
+      .name = name,
+      .value = value,
+      .len = len,
+  };
+  return true;
+}
+
+// Match the rest of the path below the node, whose prefix is already matched.
+// Backtracks to less specific routes when a more specific one fails.
+bool route_lookup(struct route_node const *const node, char const *const method,
+                  char const *const path, size_t const len,
+                  struct route_handler *const handler,
+                  struct route_params *const params, bool *const not_allowed) {
+  if (len == 0) {
+    if (route_node_method(node, method, handler, not_allowed)) {
+      return true;
+    }
+  } else {
+    for (size_t i = 0; i < node->nchildren; ++i) {
+      struct route_node const *const child = node->children[i];
+      if (child->prefix[0] != *path) {
+        continue;
+      }
+
+      // Siblings never share their first character
+      if (child->prefix_len <= len &&
+          memcmp(child->prefix, path, child->prefix_len) == 0 &&
+          route_lookup(child, method, path + child->prefix_len,
+                       len - child->prefix_len, handler, params,
+                       not_allowed)) {
+        return true;
+      }
+      break;
+    }
+  }
+
+  if (node->param != NULL && len > 0 && *path != '/') {
+    char const *const slash = memchr(path, '/', len);
+    size_t const seg = slash == NULL ? len : (size_t)(slash - path);
+
+    size_t const saved = params->len;
+    if (route_params_push(params, node->param_name, path, seg) &&
+        route_lookup(node->param, method, path + seg, len - seg, handler,
+                     params, not_allowed)) {
+      return true;
+    }
+    params->len = saved;
+  }
+
+  if (node->wildcard != NULL) {
+    size_t const saved = params->len;
+    if (route_params_push(params, node->wildcard_name, path, len) &&
+        route_node_method(node->wildcard, method, handler, not_allowed)) {
+      return true;
+    }
+    params->len = saved;
+  }
+
+  return false;
+}
+
+enum route_result router_get(struct router const *const router,
+                             char const *const method, char const *const path,
+                             struct route_handler *const handler,
+                             struct route_params *const params) {
+  params->len = 0;
+  bool not_allowed = false;
+
+  if (route_lookup(&router->root, method, path, strcspn(path, "?"), handler,
+                   params, &not_allowed)) {
+    return ROUTE_FOUND;
+  }
+
+  params->len = 0;
+  return not_allowed ? ROUTE_METHOD_NOT_ALLOWED : ROUTE_NOT_FOUND;
+}
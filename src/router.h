@@ -0,0 +1,93 @@
+#pragma once
+
+#include <stddef.h>
+
+struct request_t;
+struct response_t;
+
+typedef void (*route_callback)(struct response_t *, struct request_t *);
+
+// Receives a chunk of the request body as it arrives. Returns 0 to keep
+// receiving it, or -1 to reject the request.
+typedef int (*route_body_callback)(struct request_t *, char const *, size_t);
+
+#define route_max_params 8
+
+// A path parameter captured while routing. The value points into the request
+// path and is not null-terminated.
+struct route_param {
+  char const *name;
+  char const *value;
+  size_t len;
+};
+
+struct route_params {
+  struct route_param data[route_max_params];
+  size_t len;
+};
+
+// Handlers of a route for a method
+struct route_handler {
+  route_callback callback;
+
+  // Receives the body in chunks before the callback runs, or NULL to have
+  // the body buffered in the request
+  route_body_callback on_body;
+
+  // Passed to the handlers in req->handler.context, or NULL
+  void *context;
+};
+
+struct route_method {
+  char *method;
+  struct route_handler handler;
+};
+
+// A node of the compressed radix tree. Static children are keyed by the first
+// character of their prefix, which is unique among siblings.
+struct route_node {
+  char *prefix;
+  size_t prefix_len;
+
+  struct route_node **children;
+  size_t nchildren;
+
+  // Child matching a whole ":name" segment
+  struct route_node *param;
+  char *param_name;
+
+  // Child matching the rest of the path, "*" or "*name"
+  struct route_node *wildcard;
+  char *wildcard_name;
+
+  // Handlers of the route ending at this node, by method
+  struct route_method *methods;
+  size_t nmethods;
+};
+
+// Routes paths to callbacks. Paths are matched segment by segment, preferring
+// static segments over ":param" segments over trailing "*" wildcards.
+struct router {
+  struct route_node root;
+};
+
+enum route_result {
+  ROUTE_FOUND,
+  ROUTE_NOT_FOUND,
+  ROUTE_METHOD_NOT_ALLOWED,
+};
+
+void router_init(struct router *router);
+void router_free(struct router *router);
+
+// Register handlers for the method and path pattern. Either may be "*" to
+// match any method or path. Returns -1 if the pattern is invalid or conflicts
+// with the parameter names of a registered one.
+int router_add(struct router *router, char const *method, char const *pattern,
+               struct route_handler handler);
+
+// Find the handlers for the method and path, capturing the path parameters.
+// The query string, if any, is ignored.
+enum route_result router_get(struct router const *router, char const *method,
+                             char const *path, struct route_handler *handler,
+                             struct route_params *params);
@@ -0,0 +1,201 @@
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+#define scan_ones (~(uint64_t)0 / 0xff)
+#define scan_highs (scan_ones * 0x80)
+
+// High bit of every null byte of the word. Bytes above a null one may be
+// flagged too, so only the lowest flag is reliable.
+#define scan_zeros(word) (((word) - scan_ones) & ~(word) & scan_highs)
+
+// Flags of the delimiters in the word
+uint64_t scan_word(uint64_t const word, uint64_t const *const spread) {
+  return scan_zeros(word ^ spread[0]) | scan_zeros(word ^ spread[1]) |
+         scan_zeros(word ^ spread[2]) | scan_zeros(word ^ spread[3]) |
+         scan_zeros(word ^ spread[4]);
+}
+
+// Index of the byte flagged first in memory
+size_t scan_first(uint64_t const flags) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  return __builtin_ctzll(flags) / 8;
+#else
+  return __builtin_clzll(flags) / 8;
+#endif
+}
+
+// Looks at a word at a time, like the vector implementations do with wider
+// registers
+size_t scan_delimiters_scalar(char const *const data, size_t const len,
+                              struct scan_set const *const set) {
+  uint64_t spread[scan_max_delims];
+  for (size_t j = 0; j < scan_max_delims; ++j) {
+    spread[j] = scan_ones * (unsigned char)set->delims[j];
+  }
+
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t word;
+    memcpy(&word, data + i, sizeof(word));
+    uint64_t const flags = scan_word(word, spread);
+    if (flags != 0) {
+      return i + scan_first(flags);
+    }
+  }
+
+  if (len >= 8 && i < len) {
+    // Rescan the last 8 bytes. Those already scanned hold no delimiter, so
+    // they raise no flags.
+    i = len - 8;
+    uint64_t word;
+    memcpy(&word, data + i, sizeof(word));
+    uint64_t const flags = scan_word(word, spread);
+    return flags != 0 ? i + scan_first(flags) : len;
+  }
+
+  char const *const n = set->delims;
+  for (; i < len; ++i) {
+    char const c = data[i];
+    if ((c == n[0]) | (c == n[1]) | (c == n[2]) | (c == n[3]) | (c == n[4])) {
+      return i;
+    }
+  }
+  return len;
+}
+
+#ifdef SCAN_X86
+
+// Bytes of chunk matching any of the needles, as a bit mask
+#define scan_match16(chunk, n)                                                 \
+  (unsigned)_mm_movemask_epi8(_mm_or_si128(                                    \
+      _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, n[0]),                   \
+                                _mm_cmpeq_epi8(chunk, n[1])),                  \
+                   _mm_or_si128(_mm_cmpeq_epi8(chunk, n[2]),                   \
+                                _mm_cmpeq_epi8(chunk, n[3]))),                 \
+      _mm_cmpeq_epi8(chunk, n[4])))
+
+#define scan_match32(chunk, n)                                                 \
+  (unsigned)_mm256_movemask_epi8(_mm256_or_si256(                              \
+      _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(chunk, n[0]),          \
+                                      _mm256_cmpeq_epi8(chunk, n[1])),         \
+                      _mm256_or_si256(_mm256_cmpeq_epi8(chunk, n[2]),          \
+                                      _mm256_cmpeq_epi8(chunk, n[3]))),        \
+      _mm256_cmpeq_epi8(chunk, n[4])))
+
+__attribute__((target("sse2"))) size_t
+scan_delimiters_sse2(char const *const data, size_t const len,
+                     struct scan_set const *const set) {
+  __m128i n[scan_max_delims];
+  for (size_t j = 0; j < scan_max_delims; ++j) {
+    n[j] = _mm_set1_epi8(set->delims[j]);
+  }
+
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i const chunk = _mm_loadu_si128((__m128i const *)(data + i));
+    unsigned const mask = scan_match16(chunk, n);
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+
+  if (len >= 16 && i < len) {
+    // Rescan the last 16 bytes. Those already scanned hold no delimiter.
+    i = len - 16;
+    __m128i const chunk = _mm_loadu_si128((__m128i const *)(data + i));
+    unsigned const mask = scan_match16(chunk, n);
+    return mask != 0 ? i + __builtin_ctz(mask) : len;
+  }
+
+  return i + scan_delimiters_scalar(data + i, len - i, set);
+}
+
+__attribute__((target("avx2"))) size_t
+scan_delimiters_avx2(char const *const data, size_t const len,
+                     struct scan_set const *const set) {
+  if (len < 32) {
+    return scan_delimiters_sse2(data, len, set);
+  }
+
+  __m256i n[scan_max_delims];
+  for (size_t j = 0; j < scan_max_delims; ++j) {
+    n[j] = _mm256_set1_epi8(set->delims[j]);
+  }
+
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i const chunk = _mm256_loadu_si256((__m256i const *)(data + i));
+    unsigned const mask = scan_match32(chunk, n);
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+
+  if (i < len) {
+    // Rescan the last 32 bytes. Those already scanned hold no delimiter.
+    i = len - 32;
+    __m256i const chunk = _mm256_loadu_si256((__m256i const *)(data + i));
+    unsigned const mask = scan_match32(chunk, n);
+    return mask != 0 ? i + __builtin_ctz(mask) : len;
+  }
+
+  return len;
+}
+
+#else
+
+size_t scan_delimiters_sse2(char const *const data, size_t const len,
+                            struct scan_set const *const set) {
+  return scan_delimiters_scalar(data, len, set);
+}
+
+size_t scan_delimiters_avx2(char const *const data, size_t const len,
+                            struct scan_set const *const set) {
+  return scan_delimiters_scalar(data, len, set);
+}
+
+#endif
+
+typedef size_t (*scan_fn)(char const *, size_t, struct scan_set const *);
+
+struct scan_impl {
+  scan_fn fn;
+  char const *name;
+};
+
+struct scan_impl scan_resolve() {
+#ifdef SCAN_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return (struct scan_impl){scan_delimiters_avx2, "avx2"};
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return (struct scan_impl){scan_delimiters_sse2, "sse2"};
+  }
+#endif
+  return (struct scan_impl){scan_delimiters_scalar, "scalar"};
+}
+
+// Resolved on first use. Every thread resolves to the same implementation, so
+// racing on the first call is harmless.
+_Atomic(scan_fn) scan_selected = NULL;
+
+size_t scan_delimiters(char const *const data, size_t const len,
+                       struct scan_set const *const set) {
+  scan_fn fn = atomic_load_explicit(&scan_selected, memory_order_relaxed);
+  if (fn == NULL) {
+    fn = scan_resolve().fn;
+    atomic_store_explicit(&scan_selected, fn, memory_order_relaxed);
+  }
+  return fn(data, len, set);
+}
+
+char const *scan_implementation() { return scan_resolve().name; }
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stddef.h>
+
+#define scan_max_delims 5
+
+// A set of up to scan_max_delims delimiters. Unused slots are null characters,
+// so the null character is always a delimiter. Meant to be initialized from a
+// string literal:
+//
+//   struct scan_set const header_key = {":\r\n"};
+struct scan_set {
+  char delims[scan_max_delims];
+};
+
+// Length of the prefix of data that holds none of the delimiters in set.
+// Picks the widest vector implementation the CPU supports on first use.
+size_t scan_delimiters(char const *data, size_t len,
+                       struct scan_set const *set);
+
+// Implementations, exposed for benchmarking. Only call the vector ones on CPUs
+// that support them. On other architectures they are the scalar one.
+size_t scan_delimiters_scalar(char const *data, size_t len,
+                              struct scan_set const *set);
+size_t scan_delimiters_sse2(char const *data, size_t len,
+                            struct scan_set const *set);
+size_t scan_delimiters_avx2(char const *data, size_t len,
+                            struct scan_set const *set);
+
+// Name of the implementation scan_delimiters uses
+char const *scan_implementation();
@@ -1,3 +1,4 @@
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -13,12 +14,40 @@ enum stage {
   ADDR,
   PORT,
   MAX_THREADS,
+  MODE,
+  KEEPALIVE_TIMEOUT,
+  KEEPALIVE_MAX,
+  SHARDS,
+  MAX_HEAD_SIZE,
+  MAX_HEADERS,
+  MAX_URI_LENGTH,
+  MAX_BODY_SIZE,
+  STATIC_DIR,
+  COMPRESSION_LEVEL,
+  COMPRESSION_MIN_SIZE,
+  CACHE_SIZE,
 };
 
 enum stage next_word_NONE(char const *word);
 enum stage next_word_ADDR(struct settings *settings, char const *word);
 enum stage next_word_PORT(struct settings *settings, char const *word);
 enum stage next_word_MAX_THREADS(struct settings *setting, char const *word);
+enum stage next_word_MODE(struct settings *setting, char const *word);
+enum stage next_word_KEEPALIVE_TIMEOUT(struct settings *setting,
+                                       char const *word);
+enum stage next_word_KEEPALIVE_MAX(struct settings *setting, char const *word);
+enum stage next_word_SHARDS(struct settings *setting, char const *word);
+enum stage next_word_MAX_HEAD_SIZE(struct settings *setting, char const *word);
+enum stage next_word_MAX_HEADERS(struct settings *setting, char const *word);
+enum stage next_word_MAX_URI_LENGTH(struct settings *setting,
+                                    char const *word);
+enum stage next_word_MAX_BODY_SIZE(struct settings *setting, char const *word);
+enum stage next_word_STATIC_DIR(struct settings *setting, char const *word);
+enum stage next_word_COMPRESSION_LEVEL(struct settings *setting,
+                                       char const *word);
+enum stage next_word_COMPRESSION_MIN_SIZE(struct settings *setting,
+                                          char const *word);
+enum stage next_word_CACHE_SIZE(struct settings *setting, char const *word);
 
 void print_help();
 
@@ -27,6 +56,24 @@ struct settings parse_cli(int argc, char **argv) {
       .address = {127, 0, 0, 1},
       .port = 8080,
       .max_threads = get_nprocs(),
+      .mode = SERVE_MODE_THREADS,
+      .keepalive_timeout = 5,
+      .keepalive_max_requests = 100,
+      .shards = 1,
+      .limits =
+          {
+              .max_head_size = request_default_max_head_size,
+              .max_headers = request_default_max_headers,
+              .max_uri_length = request_default_max_uri_length,
+              .max_body_size = request_default_max_body_size,
+          },
+      .compression =
+          {
+              .level = compression_default_level,
+              .min_size = compression_default_min_size,
+          },
+      .cache_size = cache_default_size,
+      .static_dir = NULL,
   };
 
   enum stage status = NONE;
@@ -45,6 +92,42 @@ struct settings parse_cli(int argc, char **argv) {
     case MAX_THREADS:
       status = next_word_MAX_THREADS(&settings, argv[i]);
       break;
+    case MODE:
+      status = next_word_MODE(&settings, argv[i]);
+      break;
+    case KEEPALIVE_TIMEOUT:
+      status = next_word_KEEPALIVE_TIMEOUT(&settings, argv[i]);
+      break;
+    case KEEPALIVE_MAX:
+      status = next_word_KEEPALIVE_MAX(&settings, argv[i]);
+      break;
+    case SHARDS:
+      status = next_word_SHARDS(&settings, argv[i]);
+      break;
+    case MAX_HEAD_SIZE:
+      status = next_word_MAX_HEAD_SIZE(&settings, argv[i]);
+      break;
+    case MAX_HEADERS:
+      status = next_word_MAX_HEADERS(&settings, argv[i]);
+      break;
+    case MAX_URI_LENGTH:
+      status = next_word_MAX_URI_LENGTH(&settings, argv[i]);
+      break;
+    case MAX_BODY_SIZE:
+      status = next_word_MAX_BODY_SIZE(&settings, argv[i]);
+      break;
+    case STATIC_DIR:
+      status = next_word_STATIC_DIR(&settings, argv[i]);
+      break;
+    case COMPRESSION_LEVEL:
+      status = next_word_COMPRESSION_LEVEL(&settings, argv[i]);
+      break;
+    case COMPRESSION_MIN_SIZE:
+      status = next_word_COMPRESSION_MIN_SIZE(&settings, argv[i]);
+      break;
+    case CACHE_SIZE:
+      status = next_word_CACHE_SIZE(&settings, argv[i]);
+      break;
     case ERROR:
       break;
     }
@@ -62,6 +145,42 @@ struct settings parse_cli(int argc, char **argv) {
   case MAX_THREADS:
     fprintf(stderr, "Missing argument NUM\n");
     break;
+  case MODE:
+    fprintf(stderr, "Missing argument MODE\n");
+    break;
+  case KEEPALIVE_TIMEOUT:
+    fprintf(stderr, "Missing argument SECONDS\n");
+    break;
+  case KEEPALIVE_MAX:
+    fprintf(stderr, "Missing argument NUM\n");
+    break;
+  case SHARDS:
+    fprintf(stderr, "Missing argument NUM\n");
+    break;
+  case MAX_HEAD_SIZE:
+    fprintf(stderr, "Missing argument BYTES\n");
+    break;
+  case MAX_HEADERS:
+    fprintf(stderr, "Missing argument NUM\n");
+    break;
+  case MAX_URI_LENGTH:
+    fprintf(stderr, "Missing argument BYTES\n");
+    break;
+  case MAX_BODY_SIZE:
+    fprintf(stderr, "Missing argument BYTES\n");
+    break;
+  case STATIC_DIR:
+    fprintf(stderr, "Missing argument DIR\n");
+    break;
+  case COMPRESSION_LEVEL:
+    fprintf(stderr, "Missing argument LEVEL\n");
+    break;
+  case COMPRESSION_MIN_SIZE:
+    fprintf(stderr, "Missing argument BYTES\n");
+    break;
+  case CACHE_SIZE:
+    fprintf(stderr, "Missing argument BYTES\n");
+    break;
   case ERROR:
     break;
   }
@@ -88,6 +207,54 @@ enum stage next_word_NONE(char const *const word) {
     return MAX_THREADS;
   }
 
+  if (strcmp(word, "--mode") == 0 || strcmp(word, "-m") == 0) {
+    return MODE;
+  }
+
+  if (strcmp(word, "--keepalive-timeout") == 0) {
+    return KEEPALIVE_TIMEOUT;
+  }
+
+  if (strcmp(word, "--keepalive-max") == 0) {
+    return KEEPALIVE_MAX;
+  }
+
+  if (strcmp(word, "--shards") == 0 || strcmp(word, "-s") == 0) {
+    return SHARDS;
+  }
+
+  if (strcmp(word, "--max-head-size") == 0) {
+    return MAX_HEAD_SIZE;
+  }
+
+  if (strcmp(word, "--max-headers") == 0) {
+    return MAX_HEADERS;
+  }
+
+  if (strcmp(word, "--max-uri-length") == 0) {
+    return MAX_URI_LENGTH;
+  }
+
+  if (strcmp(word, "--max-body-size") == 0) {
+    return MAX_BODY_SIZE;
+  }
+
+  if (strcmp(word, "--static-dir") == 0) {
+    return STATIC_DIR;
+  }
+
+  if (strcmp(word, "--compression-level") == 0) {
+    return COMPRESSION_LEVEL;
+  }
+
+  if (strcmp(word, "--compression-min-size") == 0) {
+    return COMPRESSION_MIN_SIZE;
+  }
+
+  if (strcmp(word, "--cache-size") == 0) {
+    return CACHE_SIZE;
+  }
+
   fprintf(stderr, "Unexpected argument: %s\n", word);
   return ERROR;
 }
@@ -144,6 +311,156 @@ enum stage next_word_MAX_THREADS(struct settings *settings,
   return NONE;
 }
 
+enum stage next_word_MODE(struct settings *settings, char const *const word) {
+  if (strcmp(word, "threads") == 0) {
+    settings->mode = SERVE_MODE_THREADS;
+    return NONE;
+  }
+
+  if (strcmp(word, "events") == 0) {
+    settings->mode = SERVE_MODE_EVENTS;
+    return NONE;
+  }
+
+  if (strcmp(word, "uring") == 0) {
+    settings->mode = SERVE_MODE_URING;
+    return NONE;
+  }
+
+  fprintf(stderr, "Unknown mode: %s\n", word);
+  return ERROR;
+}
+
+enum stage next_word_KEEPALIVE_TIMEOUT(struct settings *settings,
+                                       char const *const word) {
+  // A timeout of 0 would close connections before their first request
+  char *end;
+  long const timeout = strtol(word, &end, 10);
+  if (*end != '\0' || timeout < 1 || timeout > UINT_MAX / 1000) {
+    fprintf(stderr, "Could not parse keep-alive timeout: %s\n", word);
+    return ERROR;
+  }
+
+  settings->keepalive_timeout = timeout;
+  return NONE;
+}
+
+enum stage next_word_KEEPALIVE_MAX(struct settings *settings,
+                                   char const *const word) {
+  char *end;
+  long const max = strtol(word, &end, 10);
+  if (*end != '\0' || max < 1 || max > UINT_MAX) {
+    fprintf(stderr, "Could not parse keep-alive requests: %s\n", word);
+    return ERROR;
+  }
+
+  settings->keepalive_max_requests = max;
+  return NONE;
+}
+
+enum stage next_word_SHARDS(struct settings *settings,
+                            char const *const word) {
+  char *end;
+  settings->shards = strtol(word, &end, 10);
+  if (*end != '\0' || settings->shards == 0) {
+    fprintf(stderr, "Could not parse number of shards: %s\n", word);
+    return ERROR;
+  }
+
+  return NONE;
+}
+
+enum stage next_word_MAX_HEAD_SIZE(struct settings *settings,
+                                   char const *const word) {
+  char *end;
+  settings->limits.max_head_size = strtol(word, &end, 10);
+  if (*end != '\0' || settings->limits.max_head_size == 0) {
+    fprintf(stderr, "Could not parse maximum head size: %s\n", word);
+    return ERROR;
+  }
+
+  return NONE;
+}
+
+enum stage next_word_MAX_HEADERS(struct settings *settings,
+                                 char const *const word) {
+  char *end;
+  settings->limits.max_headers = strtol(word, &end, 10);
+  if (*end != '\0') {
+    fprintf(stderr, "Could not parse maximum number of headers: %s\n", word);
+    return ERROR;
+  }
+
+  return NONE;
+}
+
+enum stage next_word_MAX_URI_LENGTH(struct settings *settings,
+                                    char const *const word) {
+  char *end;
+  settings->limits.max_uri_length = strtol(word, &end, 10);
+  if (*end != '\0' || settings->limits.max_uri_length == 0) {
+    fprintf(stderr, "Could not parse maximum URI length: %s\n", word);
+    return ERROR;
+  }
+
+  return NONE;
+}
+
+enum stage next_word_MAX_BODY_SIZE(struct settings *settings,
+                                   char const *const word) {
+  char *end;
+  settings->limits.max_body_size = strtol(word, &end, 10);
+  if (*end != '\0') {
+    fprintf(stderr, "Could not parse maximum body size: %s\n", word);
+    return ERROR;
+  }
+
+  return NONE;
+}
+
+enum stage next_word_STATIC_DIR(struct settings *settings,
+                                char const *const word) {
+  settings->static_dir = word;
+  return NONE;
+}
+
+enum stage next_word_COMPRESSION_LEVEL(struct settings *settings,
+                                       char const *const word) {
+  char *end;
+  settings->compression.level = strtol(word, &end, 10);
+  if (*end != '\0' || settings->compression.level < 0 ||
+      settings->compression.level > 9) {
+    fprintf(stderr, "Could not parse compression level: %s\n", word);
+    return ERROR;
+  }
+
+  return NONE;
+}
+
+enum stage next_word_COMPRESSION_MIN_SIZE(struct settings *settings,
+                                          char const *const word) {
+  char *end;
+  settings->compression.min_size = strtol(word, &end, 10);
+  if (*end != '\0') {
+    fprintf(stderr, "Could not parse minimum compressed size: %s\n", word);
+    return ERROR;
+  }
+
+  return NONE;
+}
+
+enum stage next_word_CACHE_SIZE(struct settings *settings,
+                                char const *const word) {
+  char *end;
+  settings->cache_size = strtoull(word, &end, 10);
+  if (*end != '\0') {
+    fprintf(stderr, "Could not parse cache size: %s\n", word);
+    return ERROR;
+  }
+
+  return NONE;
+}
+
 void print_help() {
   printf("Usage: httpserver [OPTION]...\n");
   printf("Start a simple HTTP server\n\n");
@@ -151,6 +468,44 @@ void print_help() {
   printf("  -h, --help\t\t\tDisplay this help and exit\n");
   printf("  -a, --address ADDR\t\tBind to ADDR (default: 127.0.0.1)\n");
   printf("  -p, --port PORT\t\tListen on PORT (default: 8080)\n");
-  printf("  -t, --threads NUM\t\tUse NUM threads (default: %d)\n",
+  printf("  -t, --threads NUM\t\tUse NUM threads per shard (default: %d)\n",
          get_nprocs());
+  printf("  -m, --mode MODE\t\tServe with MODE (default: threads):\n");
+  printf("\t\t\t\t  threads: NUM workers, one connection each\n");
+  printf("\t\t\t\t  events: NUM epoll event loops\n");
+  printf("\t\t\t\t  uring: NUM io_uring loops\n");
+  printf("      --keepalive-timeout SECONDS\n");
+  printf("\t\t\t\tClose idle persistent connections after SECONDS\n");
+  printf("\t\t\t\t(default: 5)\n");
+  printf("      --keepalive-max NUM\tServe at most NUM requests per "
+         "connection\n");
+  printf("\t\t\t\t(default: 100)\n");
+  printf("  -s, --shards NUM\t\tListen on NUM SO_REUSEPORT sockets, each with "
+         "its\n");
+  printf("\t\t\t\town accept loop and threads (default: 1)\n");
+  printf("      --max-head-size BYTES\tReject requests whose request line and "
+         "headers\n");
+  printf("\t\t\t\ttake more than BYTES with 431 (default: %d)\n",
+         request_default_max_head_size);
+  printf("      --max-headers NUM\t\tReject requests with more than NUM "
+         "headers with\n");
+  printf("\t\t\t\t431 (default: %d)\n", request_default_max_headers);
+  printf("      --max-uri-length BYTES\tReject request targets longer than "
+         "BYTES with\n");
+  printf("\t\t\t\t414 (default: %d)\n", request_default_max_uri_length);
+  printf("      --max-body-size BYTES\tReject bodies longer than BYTES with "
+         "413, unless\n");
+  printf("\t\t\t\tthe route streams them (default: %d)\n",
+         request_default_max_body_size);
+  printf("      --static-dir DIR\t\tServe the files in DIR under /static/\n");
+  printf("      --compression-level LEVEL\n");
+  printf("\t\t\t\tCompress bodies with LEVEL, from 1 to 9, for clients\n");
+  printf("\t\t\t\tthat accept it. 0 disables it (default: %d)\n",
+         compression_default_level);
+  printf("      --compression-min-size BYTES\n");
+  printf("\t\t\t\tSend bodies smaller than BYTES uncompressed\n");
+  printf("\t\t\t\t(default: %d)\n", compression_default_min_size);
+  printf("      --cache-size BYTES\tKeep up to BYTES of responses of cached "
+         "routes\n");
+  printf("\t\t\t\t(default: %d)\n", cache_default_size);
 }
@@ -1,10 +1,24 @@
 #pragma once
 #include <stdint.h>
 
+#include "http.h"
+
 struct settings {
     uint8_t address[4];
     uint16_t port;
     unsigned int max_threads;
+    enum serve_mode mode;
+    unsigned int keepalive_timeout;
+    unsigned int keepalive_max_requests;
+    unsigned int shards;
+    struct request_limits limits;
+    struct compression_settings compression;
+
+    // Bytes of responses the cached routes keep at most
+    size_t cache_size;
+
+    // Directory served under /static/, or NULL
+    char const* static_dir;
 };
 
 struct settings parse_cli(int argc, char** argv);
@@ -0,0 +1,144 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cache.h"
+#include "http.h"
+#include "shard.h"
+
+void shard_init(struct httpserver_shard *const shard,
+                struct httpserver *const server, size_t const id,
+                int const sockfd) {
+  shard->server = server;
+  shard->id = id;
+  shard->sockfd = sockfd;
+  shard->pool = NULL;
+  shard->parking = NULL;
+  atomic_init(&shard->accepted, 0);
+  atomic_init(&shard->active, 0);
+  atomic_init(&shard->requests, 0);
+  atomic_init(&shard->writes, 0);
+}
+
+void shard_print_stats(struct httpserver_shard *const shard) {
+  printf("shard %zu {\n", shard->id);
+  printf("  accepted: %zu\n", atomic_load(&shard->accepted));
+  printf("  active: %zu\n", atomic_load(&shard->active));
+  printf("  requests: %zu\n", atomic_load(&shard->requests));
+
+  size_t const requests = atomic_load(&shard->requests);
+  size_t const writes = atomic_load(&shard->writes);
+  printf("  writes: %zu (%.2f per request)\n", writes,
+         requests == 0 ? 0.0 : (double)writes / requests);
+  printf("}\n");
+}
+
+struct shard_runner {
+  struct httpserver_shard *shard;
+  size_t max_threads;
+  enum serve_mode mode;
+  volatile bool *interrupt;
+
+  pthread_t thread;
+  int retval;
+};
+
+void *shard_run(void *ptr) {
+  struct shard_runner *const r = (struct shard_runner *)ptr;
+
+  switch (r->mode) {
+  case SERVE_MODE_THREADS:
+    r->retval = shard_serve_threads(r->shard, r->max_threads, r->interrupt);
+    break;
+  case SERVE_MODE_EVENTS:
+    r->retval = shard_serve_events(r->shard, r->max_threads, r->interrupt);
+    break;
+  case SERVE_MODE_URING:
+    r->retval = shard_serve_uring(r->shard, r->max_threads, r->interrupt);
+    break;
+  default:
+    r->retval = -1;
+  }
+
+  if (r->retval != 0) {
+    // A failing shard stops the whole server
+    *r->interrupt = true;
+  }
+
+  return NULL;
+}
+
+int httpserver_serve_sharded(struct httpserver *const server,
+                             int const *const sockfds, size_t const nshards,
+                             size_t const max_threads,
+                             enum serve_mode const mode,
+                             volatile bool *interrupt) {
+  bool dummy = false;
+  if (interrupt == NULL) {
+    interrupt = &dummy;
+  }
+
+  if (nshards == 0) {
+    return -1;
+  }
+
+  struct httpserver_shard *shards = calloc(nshards, sizeof(*shards));
+  struct shard_runner *runners = calloc(nshards, sizeof(*runners));
+  if (shards == NULL || runners == NULL) {
+    free(shards);
+    free(runners);
+    return -1;
+  }
+
+  for (size_t i = 0; i < nshards; ++i) {
+    shard_init(&shards[i], server, i, sockfds[i]);
+    runners[i] = (struct shard_runner){
+        .shard = &shards[i],
+        .max_threads = max_threads,
+        .mode = mode,
+        .interrupt = interrupt,
+    };
+  }
+
+  server->shards = shards;
+  server->nshards = nshards;
+
+  int retval = 0;
+  if (nshards == 1) {
+    // No need for an extra thread
+    shard_run(&runners[0]);
+    retval = runners[0].retval;
+  } else {
+    size_t running = 0;
+    for (; running < nshards; ++running) {
+      if (pthread_create(&runners[running].thread, NULL, shard_run,
+                         &runners[running]) != 0) {
+        *interrupt = true;
+        retval = -1;
+        break;
+      }
+    }
+
+    for (size_t i = 0; i < running; ++i) {
+      pthread_join(runners[i].thread, NULL);
+      if (runners[i].retval != 0) {
+        retval = -1;
+      }
+    }
+  }
+
+  for (size_t i = 0; i < nshards; ++i) {
+    shard_print_stats(&shards[i]);
+  }
+  if (server->cache != NULL) {
+    response_cache_print_stats(server->cache);
+  }
+
+  server->shards = NULL;
+  server->nshards = 0;
+  free(runners);
+  free(shards);
+
+  *interrupt = false;
+  return retval;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// A listening socket with its own accept loop and workers. Sharded servers
+// open one SO_REUSEPORT socket per shard and let the kernel spread the
+// incoming connections across them.
+struct httpserver_shard {
+  struct httpserver *server;
+  size_t id;
+  int sockfd;
+
+  // Worker pool of the threads mode. Only set while serving.
+  struct threadpool *pool;
+
+  // Connections of the threads mode waiting for a suspended response, without
+  // a worker. Only set while serving.
+  struct connection_parking *parking;
+
+  atomic_size_t accepted; // Connections accepted
+  atomic_size_t active;   // Connections currently open
+  atomic_size_t requests; // Requests answered
+  atomic_size_t writes;   // Write system calls, or io_uring sends
+};
+
+void shard_init(struct httpserver_shard *shard, struct httpserver *server,
+                size_t id, int sockfd);
+
+// Print the shard's counters to stdout
+void shard_print_stats(struct httpserver_shard *shard);
+
+// Serve the shard's socket with a pool of max_threads workers until the
+// interrupt is raised. Implemented in http.c.
+int shard_serve_threads(struct httpserver_shard *shard, size_t max_threads,
+                        volatile bool *interrupt);
+
+// Serve the shard's socket with nloops event loops until the interrupt is
+// raised. Implemented in eventloop.c.
+int shard_serve_events(struct httpserver_shard *shard, size_t nloops,
+                       volatile bool *interrupt);
+
+// Serve the shard's socket with nloops io_uring loops until the interrupt is
+// raised, or with event loops if the kernel lacks io_uring support.
+// Implemented in uringloop.c.
+int shard_serve_uring(struct httpserver_shard *shard, size_t nloops,
+                      volatile bool *interrupt);
@@ -0,0 +1,428 @@
+#define _GNU_SOURCE // Required for syscall
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include <linux/openat2.h>
+#include <sys/syscall.h>
+
+#include "compress.h"
+#include "conditional.h"
+#include "default_callbacks.h"
+#include "eventloop.h"
+#include "static.h"
+
+struct static_cache {
+  struct static_file *buckets[static_cache_buckets];
+
+  // Most and least recently used files
+  struct static_file *newest;
+  struct static_file *oldest;
+
+  size_t len;
+};
+
+_Thread_local struct static_cache static_cache;
+
+// Registers the thread for static_cache_drain on its first file
+_Thread_local bool static_cache_registered;
+
+pthread_key_t static_cache_key;
+pthread_once_t static_cache_once = PTHREAD_ONCE_INIT;
+
+struct static_type {
+  char const *extension;
+  char const *content_type;
+};
+
+struct static_type const static_types[] = {
+    {"html", "text/html; charset=utf-8"},
+    {"htm", "text/html; charset=utf-8"},
+    {"css", "text/css; charset=utf-8"},
+    {"js", "text/javascript; charset=utf-8"},
+    {"mjs", "text/javascript; charset=utf-8"},
+    {"json", "application/json"},
+    {"txt", "text/plain; charset=utf-8"},
+    {"csv", "text/csv; charset=utf-8"},
+    {"md", "text/markdown; charset=utf-8"},
+    {"xml", "application/xml"},
+    {"svg", "image/svg+xml"},
+    {"png", "image/png"},
+    {"jpg", "image/jpeg"},
+    {"jpeg", "image/jpeg"},
+    {"gif", "image/gif"},
+    {"webp", "image/webp"},
+    {"avif", "image/avif"},
+    {"ico", "image/x-icon"},
+    {"pdf", "application/pdf"},
+    {"wasm", "application/wasm"},
+    {"woff", "font/woff"},
+    {"woff2", "font/woff2"},
+    {"ttf", "font/ttf"},
+    {"mp3", "audio/mpeg"},
+    {"wav", "audio/wav"},
+    {"mp4", "video/mp4"},
+    {"webm", "video/webm"},
+    {"zip", "application/zip"},
+    {"gz", "application/gzip"},
+};
+
+int static_dir_open(struct static_dir *const dir, char const *const path) {
+  dir->fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  return dir->fd < 0 ? -1 : 0;
+}
+
+void static_dir_close(struct static_dir *const dir) {
+  close(dir->fd);
+  dir->fd = -1;
+}
+
+char const *static_content_type(char const *const path) {
+  char const *const slash = strrchr(path, '/');
+  char const *const dot = strrchr(path, '.');
+  if (dot != NULL && (slash == NULL || dot > slash)) {
+    size_t const n = sizeof(static_types) / sizeof(static_types[0]);
+    for (size_t i = 0; i < n; ++i) {
+      if (strcasecmp(dot + 1, static_types[i].extension) == 0) {
+        return static_types[i].content_type;
+      }
+    }
+  }
+  return "application/octet-stream";
+}
+
+int static_hex(char const c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+int static_decode_path(char const *const raw, size_t const len,
+                       char *const out) {
+  size_t n = 0;
+  for (size_t i = 0; i < len; ++i) {
+    char c = raw[i];
+    if (c == '%') {
+      int const hi = i + 2 < len ? static_hex(raw[i + 1]) : -1;
+      int const lo = i + 2 < len ? static_hex(raw[i + 2]) : -1;
+      if (hi < 0 || lo < 0) {
+        return -1;
+      }
+      c = (char)(hi << 4 | lo);
+      i += 2;
+    }
+
+    // Room is left for the index of a directory and its compressed sibling
+    if (c == '\0' || n + sizeof("/index.html.gz") >= static_max_path) {
+      return -1;
+    }
+
+    // Hidden files are never served, which also rules out "." and ".."
+    bool const segment_start = n == 0 || out[n - 1] == '/';
+    if (segment_start && (c == '.' || c == '/')) {
+      return -1;
+    }
+    out[n++] = c;
+  }
+
+  out[n] = '\0';
+  return 0;
+}
+
+// Open the path beneath the directory, without following symlinks out of it
+int static_open_beneath(int const dirfd, char const *const path) {
+  struct open_how how = {
+      .flags = O_RDONLY | O_CLOEXEC,
+      .resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS,
+  };
+  int const fd = syscall(SYS_openat2, dirfd, path, &how, sizeof(how));
+  if (fd >= 0 || errno != ENOSYS) {
+    return fd;
+  }
+
+  // Older kernels: the path itself was checked not to climb out, and the
+  // file must not be a symlink
+  return openat(dirfd, path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+}
+
+size_t static_hash(struct static_dir const *const dir,
+                   char const *const path) {
+  // FNV-1a
+  size_t hash = 14695981039346656037ULL ^ (uintptr_t)dir;
+  for (char const *c = path; *c != '\0'; ++c) {
+    hash = (hash ^ (unsigned char)*c) * 1099511628211ULL;
+  }
+  return hash % static_cache_buckets;
+}
+
+void static_file_free(struct static_file *const file) {
+  close(file->fd);
+  if (file->gz_fd >= 0) {
+    close(file->gz_fd);
+  }
+  free(file->path);
+  free(file);
+}
+
+// Take the file out of the cache, closing it unless a response still sends it
+void static_cache_remove(struct static_file *const file) {
+  struct static_cache *const cache = &static_cache;
+
+  struct static_file **link =
+      &cache->buckets[static_hash(file->dir, file->path)];
+  while (*link != file) {
+    link = &(*link)->chain;
+  }
+  *link = file->chain;
+
+  if (file->newer != NULL) {
+    file->newer->older = file->older;
+  } else {
+    cache->newest = file->older;
+  }
+  if (file->older != NULL) {
+    file->older->newer = file->newer;
+  } else {
+    cache->oldest = file->newer;
+  }
+
+  --cache->len;
+  file->cached = false;
+  if (file->refs == 0) {
+    static_file_free(file);
+  }
+}
+
+// Make the file the most recently used
+void static_cache_touch(struct static_file *const file) {
+  struct static_cache *const cache = &static_cache;
+  if (cache->newest == file) {
+    return;
+  }
+
+  file->newer->older = file->older;
+  if (file->older != NULL) {
+    file->older->newer = file->newer;
+  } else {
+    cache->oldest = file->newer;
+  }
+
+  file->newer = NULL;
+  file->older = cache->newest;
+  cache->newest->newer = file;
+  cache->newest = file;
+}
+
+// Close every file the exiting thread holds that no response sends
+void static_cache_drain(void *unused) {
+  (void)unused;
+  while (static_cache.oldest != NULL) {
+    static_cache_remove(static_cache.oldest);
+  }
+}
+
+void static_cache_create_key() {
+  pthread_key_create(&static_cache_key, static_cache_drain);
+}
+
+void static_cache_insert(struct static_file *const file) {
+  struct static_cache *const cache = &static_cache;
+
+  if (!static_cache_registered) {
+    // Only threads with a non-NULL value get their destructor called
+    pthread_once(&static_cache_once, static_cache_create_key);
+    pthread_setspecific(static_cache_key, &static_cache_registered);
+    static_cache_registered = true;
+  }
+
+  if (cache->len == static_cache_max) {
+    static_cache_remove(cache->oldest);
+  }
+
+  size_t const bucket = static_hash(file->dir, file->path);
+  file->chain = cache->buckets[bucket];
+  cache->buckets[bucket] = file;
+
+  file->newer = NULL;
+  file->older = cache->newest;
+  if (cache->newest != NULL) {
+    cache->newest->newer = file;
+  } else {
+    cache->oldest = file;
+  }
+  cache->newest = file;
+
+  file->cached = true;
+  ++cache->len;
+}
+
+// Open a regular file, or the index of a directory. Returns -1 if there is
+// none, or it is not a regular file.
+int static_open(struct static_dir const *const dir, char *const path,
+                struct stat *const st) {
+  int fd = static_open_beneath(dir->fd, path[0] == '\0' ? "." : path);
+  if (fd < 0 || fstat(fd, st) != 0) {
+    goto fail;
+  }
+
+  if (S_ISDIR(st->st_mode)) {
+    size_t const len = strlen(path);
+    strcpy(path + len,
+           len == 0 || path[len - 1] == '/' ? "index.html" : "/index.html");
+
+    close(fd);
+    fd = static_open_beneath(dir->fd, path);
+    if (fd < 0 || fstat(fd, st) != 0) {
+      goto fail;
+    }
+  }
+
+  if (!S_ISREG(st->st_mode)) {
+    goto fail;
+  }
+  return fd;
+
+fail:
+  if (fd >= 0) {
+    close(fd);
+  }
+  return -1;
+}
+
+// Find the file in the thread's cache, or open it. Returns NULL if there is no
+// such file.
+struct static_file *static_cache_get(struct static_dir const *const dir,
+                                     char *const path) {
+  time_t const now = monotonic_seconds();
+
+  struct static_file *file = static_cache.buckets[static_hash(dir, path)];
+  while (file != NULL && (file->dir != dir || strcmp(file->path, path) != 0)) {
+    file = file->chain;
+  }
+
+  if (file != NULL && now - file->opened < static_revalidate_seconds) {
+    static_cache_touch(file);
+    return file;
+  }
+
+  if (file != NULL) {
+    // It may have changed on disk
+    static_cache_remove(file);
+  }
+
+  struct stat st;
+  char key[static_max_path];
+  strcpy(key, path);
+  int const fd = static_open(dir, path, &st);
+  if (fd < 0) {
+    return NULL;
+  }
+
+  // Look for the precompressed sibling now, so that hits need not
+  struct stat gz_st = {0};
+  int gz_fd = -1;
+  size_t const len = strlen(path);
+  if (len < 3 || strcmp(path + len - 3, ".gz") != 0) {
+    strcpy(path + len, ".gz");
+    gz_fd = static_open_beneath(dir->fd, path);
+    path[len] = '\0';
+  }
+  if (gz_fd >= 0 && (fstat(gz_fd, &gz_st) != 0 || !S_ISREG(gz_st.st_mode))) {
+    close(gz_fd);
+    gz_fd = -1;
+  }
+
+  file = malloc(sizeof(*file));
+  char *const copy = strdup(key);
+  if (file == NULL || copy == NULL) {
+    free(file);
+    free(copy);
+    close(fd);
+    if (gz_fd >= 0) {
+      close(gz_fd);
+    }
+    return NULL;
+  }
+
+  *file = (struct static_file){
+      .dir = dir,
+      .path = copy,
+      .fd = fd,
+      .st = st,
+      .content_type = static_content_type(path),
+      .gz_fd = gz_fd,
+      .gz_st = gz_st,
+      .opened = now,
+      .refs = 0,
+  };
+  static_cache_insert(file);
+  return file;
+}
+
+// Release the reference of a response once its body is sent
+void static_file_release(void *const context) {
+  struct static_file *const file = context;
+  --file->refs;
+  if (file->refs == 0 && !file->cached) {
+    static_file_free(file);
+  }
+}
+
+void callback_static(struct response_t *res, struct request_t *req) {
+  struct static_dir const *const dir = req->handler.context;
+
+  size_t len = 0;
+  char const *const raw = request_param(req, "path", &len);
+
+  char path[static_max_path];
+  struct static_file *const file =
+      raw != NULL && static_decode_path(raw, len, path) == 0
+          ? static_cache_get(dir, path)
+          : NULL;
+  if (file == NULL) {
+    callback404(res, req);
+    return;
+  }
+
+  res->status = HTTP_STATUS_OK;
+  response_headers_append(res, "Content-Type", file->content_type);
+
+  int fd = file->fd;
+  struct stat const *st = &file->st;
+  if (file->gz_fd >= 0) {
+    response_headers_append(res, "Vary", "Accept-Encoding");
+
+    char const *const accept =
+        request_header(req, HTTP_HEADER_ACCEPT_ENCODING, NULL);
+    if (compress_accepts(accept, CONTENT_CODING_GZIP)) {
+      response_headers_append(res, "Content-Encoding", "gzip");
+      fd = file->gz_fd;
+      st = &file->gz_st;
+    }
+  }
+
+  // Files are tagged by their metadata, so revalidating costs no read
+  char etag[etag_size];
+  etag_from_stat(etag, st);
+  if (response_validate(res, req, etag, st->st_mtime)) {
+    return;
+  }
+
+  // The response keeps the file open until its body is sent, even if the
+  // cache lets go of it meanwhile
+  ++file->refs;
+  response_file(res, fd, 0, st->st_size, static_file_release, file);
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include <sys/stat.h>
+#include <time.h>
+
+#include "http.h"
+
+// Serves the files of a directory.
+//
+// Bodies are sent with sendfile, straight from the page cache to the socket.
+// Every thread keeps a bounded LRU cache of the files it opened, with their
+// metadata, so that hot files are served without open or stat. Cached files
+// are checked again once they are older than static_revalidate_seconds, so
+// changes on disk show up soon after.
+//
+// Files with a precompressed ".gz" sibling are sent as that to clients that
+// accept gzip.
+//
+// Files are tagged for conditional requests by their metadata, and byte
+// ranges of them are sent with sendfile as well.
+//
+// Paths are resolved beneath the directory only: requests for hidden files,
+// parent directories or symlinks leading out of it are answered with 404.
+
+// Files each thread keeps open at most
+#define static_cache_max 128
+
+// Buckets of the hash table of each thread's cache
+#define static_cache_buckets 256
+
+// Seconds a cached file is served before being opened again
+#define static_revalidate_seconds 1
+
+// Bytes of a decoded path at most
+#define static_max_path 1024
+
+struct static_dir {
+  // Directory files are opened beneath
+  int fd;
+};
+
+// A file opened by a thread. Referenced by its cache and by every response
+// sending it, and closed once none is left.
+struct static_file {
+  struct static_dir const *dir;
+  char *path;
+
+  int fd;
+  struct stat st;
+  char const *content_type;
+
+  // Precompressed sibling, with ".gz" appended to the name, or -1. Sent to
+  // clients that accept gzip instead of the file.
+  int gz_fd;
+  struct stat gz_st;
+
+  // When it was opened, from monotonic_seconds
+  time_t opened;
+
+  unsigned refs;
+  bool cached;
+
+  // Neighbours in the LRU list, most recently used first
+  struct static_file *newer;
+  struct static_file *older;
+
+  // Next file in the same hash bucket
+  struct static_file *chain;
+};
+
+// Open the directory to serve. Returns -1 if it cannot be opened.
+int static_dir_open(struct static_dir *dir, char const *path);
+
+void static_dir_close(struct static_dir *dir);
+
+// Media type of a file, from its extension
+char const *static_content_type(char const *path);
+
+// Percent-decode the request path into out, a buffer of static_max_path bytes.
+// Returns -1 if the path is too long, or names a hidden file or directory,
+// which rules out "." and "..", or an absolute path.
+int static_decode_path(char const *raw, size_t len, char *out);
+
+// Handler serving the file named by the "path" parameter from the
+// struct static_dir registered as its context, as in:
+//
+//   httpserver_register_context(server, "GET", "/static/*path",
+//                               callback_static, &dir);
+//
+// Directories are served their index.html.
+void callback_static(struct response_t *res, struct request_t *req);
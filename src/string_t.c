@@ -7,9 +7,16 @@ struct string_t null_string() {
       .data = NULL,
       .len = 0,
       .cap = 0,
+      .arena = NULL,
   };
 }
 
+struct string_t arena_string(struct arena *const arena) {
+  struct string_t str = null_string();
+  str.arena = arena;
+  return str;
+}
+
 struct string_t new_string(const char *cstr, size_t len) {
   struct string_t str = null_string();
   if (len == 0) {
@@ -32,6 +39,16 @@ int string_reserve(struct string_t *str, size_t newcap) {
 
   newcap = (newcap > 2*str->cap) ? newcap : 2*str->cap;
 
+  if (str->arena != NULL) {
+    char *const data = arena_realloc(str->arena, str->data, str->cap, newcap);
+    if (data == NULL) {
+      return 1;
+    }
+    str->data = data;
+    str->cap = newcap;
+    return 0;
+  }
+
   if (str->data == NULL) {
     str->data = malloc(newcap * sizeof(*str->data));
     if (str->data == NULL) {
@@ -64,6 +81,18 @@ int string_append(struct string_t *str, const char *cstr, size_t len) {
   return 0;
 }
 
+int string_append_decimal(struct string_t *str, size_t n) {
+  // Digits are produced from the last one
+  char digits[20];
+  size_t i = sizeof(digits);
+  do {
+    digits[--i] = '0' + n % 10;
+    n /= 10;
+  } while(n > 0);
+
+  return string_append(str, digits + i, sizeof(digits) - i);
+}
+
 int string_push(struct string_t *str, char c) {
   if(string_reserve(str, str->len + 1) != 0) {
     return 1;
@@ -81,7 +110,9 @@ void string_pop(struct string_t *str) {
 }
 
 void string_free(struct string_t *str) {
-  free(str->data);
+  if (str->arena == NULL) {
+    free(str->data);
+  }
 }
 
 char *to_cstr(struct string_t *str) {
@@ -2,20 +2,34 @@
 
 #include <stdlib.h>
 
+#include "arena.h"
+
 struct string_t {
   char *data;
   size_t len;
   size_t cap;
+
+  // Arena the data is allocated from, or NULL for the heap. Arena strings are
+  // released with their arena: string_free does nothing for them.
+  struct arena *arena;
 };
 
 struct string_t null_string();
 struct string_t new_string(const char *cstr, size_t len);
 #define new_string_literal(cstr) new_string(cstr, sizeof(cstr) - 1);
 
+// Empty string that grows inside the arena
+struct string_t arena_string(struct arena *arena);
+
 int string_reserve(struct string_t *str, size_t newcap);
 int string_append(struct string_t *str, const char *cstr, size_t len);
+#define string_append_literal(str, cstr)                                       \
+  string_append(str, cstr, sizeof(cstr) - 1)
 int s_printf(struct string_t *str, const char *fmt, ...);
 
+// Append the number in decimal, without going through printf
+int string_append_decimal(struct string_t *str, size_t n);
+
 int string_push(struct string_t *str, char c);
 void string_pop(struct string_t *str);
 
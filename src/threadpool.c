@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "threadpool.h"
+
+struct worker_args {
+  struct threadpool *pool;
+  size_t id;
+};
+
+uint64_t threadpool_elapsed_ns(struct timespec const *from,
+                               struct timespec const *to) {
+  return (to->tv_sec - from->tv_sec) * 1000000000ull + to->tv_nsec -
+         from->tv_nsec;
+}
+
+void *threadpool_worker(void *ptr) {
+  struct worker_args args = *(struct worker_args *)ptr;
+  free(ptr);
+
+  struct threadpool *const pool = args.pool;
+
+  pthread_mutex_lock(&pool->mutex);
+  while (true) {
+    while (pool->queue_len == 0 && !pool->stopping) {
+      pthread_cond_wait(&pool->not_empty, &pool->mutex);
+    }
+
+    if (pool->queue_len == 0) {
+      // Stopping and nothing left to do
+      break;
+    }
+
+    struct threadpool_job const job = pool->queue[pool->queue_head];
+    pool->queue_head = (pool->queue_head + 1) % pool->queue_cap;
+    --pool->queue_len;
+    ++pool->busy;
+    pthread_cond_signal(&pool->not_full);
+    pthread_mutex_unlock(&pool->mutex);
+
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    job.run(job.arg, args.id);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    pthread_mutex_lock(&pool->mutex);
+    --pool->busy;
+    ++pool->completed;
+    pool->busy_ns += threadpool_elapsed_ns(&begin, &end);
+  }
+  pthread_mutex_unlock(&pool->mutex);
+
+  return NULL;
+}
+
+struct threadpool *new_threadpool(size_t const nworkers,
+                                  size_t const queue_cap) {
+  if (nworkers == 0 || queue_cap == 0) {
+    return NULL;
+  }
+
+  struct threadpool *pool = malloc(sizeof(*pool));
+  if (pool == NULL) {
+    return NULL;
+  }
+
+  *pool = (struct threadpool){
+      .workers = calloc(nworkers, sizeof(pthread_t)),
+      .nworkers = 0,
+      .queue = calloc(queue_cap, sizeof(struct threadpool_job)),
+      .queue_cap = queue_cap,
+  };
+
+  if (pool->workers == NULL || pool->queue == NULL) {
+    free(pool->workers);
+    free(pool->queue);
+    free(pool);
+    return NULL;
+  }
+
+  pthread_mutex_init(&pool->mutex, NULL);
+  pthread_cond_init(&pool->not_empty, NULL);
+  pthread_cond_init(&pool->not_full, NULL);
+  clock_gettime(CLOCK_MONOTONIC, &pool->started);
+
+  for (size_t i = 0; i < nworkers; ++i) {
+    struct worker_args *args = malloc(sizeof(*args));
+    if (args == NULL) {
+      break;
+    }
+    *args = (struct worker_args){.pool = pool, .id = i};
+
+    if (pthread_create(&pool->workers[i], NULL, threadpool_worker, args) !=
+        0) {
+      free(args);
+      break;
+    }
+    ++pool->nworkers;
+  }
+
+  if (pool->nworkers == 0) {
+    threadpool_close(pool);
+    return NULL;
+  }
+
+  return pool;
+}
+
+int threadpool_submit(struct threadpool *const pool,
+                      struct threadpool_job const job,
+                      volatile bool *const interrupt) {
+  pthread_mutex_lock(&pool->mutex);
+
+  while (pool->queue_len == pool->queue_cap && !pool->stopping) {
+    if (interrupt != NULL && *interrupt) {
+      pthread_mutex_unlock(&pool->mutex);
+      return -1;
+    }
+
+    // Wake up periodically to check the interrupt
+    struct timespec abstime;
+    clock_gettime(CLOCK_REALTIME, &abstime);
+    abstime.tv_nsec += 10 * 1000 * 1000;
+    if (abstime.tv_nsec >= 1000 * 1000 * 1000) {
+      abstime.tv_nsec -= 1000 * 1000 * 1000;
+      ++abstime.tv_sec;
+    }
+    pthread_cond_timedwait(&pool->not_full, &pool->mutex, &abstime);
+  }
+
+  if (pool->stopping) {
+    pthread_mutex_unlock(&pool->mutex);
+    return -1;
+  }
+
+  size_t const tail = (pool->queue_head + pool->queue_len) % pool->queue_cap;
+  pool->queue[tail] = job;
+  ++pool->queue_len;
+  if (pool->queue_len > pool->max_queued) {
+    pool->max_queued = pool->queue_len;
+  }
+
+  pthread_cond_signal(&pool->not_empty);
+  pthread_mutex_unlock(&pool->mutex);
+  return 0;
+}
+
+void threadpool_stats(struct threadpool *const pool,
+                      struct threadpool_stats *const stats) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  pthread_mutex_lock(&pool->mutex);
+  *stats = (struct threadpool_stats){
+      .workers = pool->nworkers,
+      .busy = pool->busy,
+      .queued = pool->queue_len,
+      .queue_capacity = pool->queue_cap,
+      .max_queued = pool->max_queued,
+      .completed = pool->completed,
+  };
+  uint64_t const busy_ns = pool->busy_ns;
+  pthread_mutex_unlock(&pool->mutex);
+
+  uint64_t const total_ns =
+      threadpool_elapsed_ns(&pool->started, &now) * stats->workers;
+  stats->utilization = total_ns == 0 ? 0.0 : (double)busy_ns / total_ns;
+}
+
+size_t threadpool_queued(struct threadpool *const pool) {
+  pthread_mutex_lock(&pool->mutex);
+  size_t const queued = pool->queue_len;
+  pthread_mutex_unlock(&pool->mutex);
+  return queued;
+}
+
+void threadpool_print_stats(struct threadpool *const pool) {
+  struct threadpool_stats stats;
+  threadpool_stats(pool, &stats);
+
+  printf("threadpool {\n");
+  printf("  workers: %zu (%zu busy)\n", stats.workers, stats.busy);
+  printf("  queue: %zu/%zu (max %zu)\n", stats.queued, stats.queue_capacity,
+         stats.max_queued);
+  printf("  completed: %zu\n", stats.completed);
+  printf("  utilization: %.2f%%\n", 100.0 * stats.utilization);
+  printf("}\n");
+}
+
+void threadpool_close(struct threadpool *const pool) {
+  pthread_mutex_lock(&pool->mutex);
+  pool->stopping = true;
+  pthread_cond_broadcast(&pool->not_empty);
+  pthread_cond_broadcast(&pool->not_full);
+  pthread_mutex_unlock(&pool->mutex);
+
+  for (size_t i = 0; i < pool->nworkers; ++i) {
+    pthread_join(pool->workers[i], NULL);
+  }
+
+  pthread_cond_destroy(&pool->not_full);
+  pthread_cond_destroy(&pool->not_empty);
+  pthread_mutex_destroy(&pool->mutex);
+
+  free(pool->workers);
+  free(pool->queue);
+  free(pool);
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+// A job to be run by one of the workers in the pool.
+// The worker id is an index in [0, nworkers)
+struct threadpool_job {
+  void (*run)(void *arg, size_t worker_id);
+  void *arg;
+};
+
+struct threadpool_stats {
+  size_t workers;
+  size_t busy;           // Workers currently running a job
+  size_t queued;         // Jobs waiting for a worker
+  size_t queue_capacity; // Maximum number of jobs waiting
+  size_t max_queued;     // Highest number of jobs that were waiting at once
+  size_t completed;      // Jobs that finished running
+
+  // Fraction of the worker time spent running jobs since the pool started
+  double utilization;
+};
+
+// Fixed pool of long-lived workers pulling jobs from a shared bounded queue
+struct threadpool {
+  pthread_t *workers;
+  size_t nworkers;
+
+  pthread_mutex_t mutex;
+  pthread_cond_t not_empty;
+  pthread_cond_t not_full;
+
+  // Ring buffer of pending jobs
+  struct threadpool_job *queue;
+  size_t queue_cap;
+  size_t queue_head;
+  size_t queue_len;
+
+  bool stopping;
+
+  // Statistics, guarded by the mutex
+  size_t busy;
+  size_t max_queued;
+  size_t completed;
+  uint64_t busy_ns;
+  struct timespec started;
+};
+
+// Create a pool with nworkers threads and room for queue_cap pending jobs
+struct threadpool *new_threadpool(size_t nworkers, size_t queue_cap);
+
+// Enqueue a job. Blocks while the queue is full.
+// Returns -1 without enqueuing if the interrupt is raised or the pool is
+// stopping.
+int threadpool_submit(struct threadpool *pool, struct threadpool_job job,
+                      volatile bool *interrupt);
+
+// Take a snapshot of the pool's statistics
+void threadpool_stats(struct threadpool *pool, struct threadpool_stats *stats);
+
+// Number of jobs waiting for a worker
+size_t threadpool_queued(struct threadpool *pool);
+
+// Print the pool's statistics to stdout
+void threadpool_print_stats(struct threadpool *pool);
+
+// Run the remaining queued jobs, join the workers and free the pool
+void threadpool_close(struct threadpool *pool);
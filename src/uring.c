@@ -0,0 +1,270 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+#define load_acquire(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+int uring_setup(unsigned entries, struct io_uring_params *p) {
+  return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+int uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                unsigned flags, void *arg, size_t argsz) {
+  return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                      arg, argsz);
+}
+
+int uring_register(int fd, unsigned opcode, void *arg, unsigned nargs) {
+  return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nargs);
+}
+
+int uring_init(struct uring *const ring, unsigned const entries) {
+  *ring = (struct uring){.fd = -1};
+
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+
+  ring->fd = uring_setup(entries, &p);
+  if (ring->fd < 0) {
+    return -1;
+  }
+  ring->features = p.features;
+
+  ring->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  ring->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  bool const single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap) {
+    if (ring->cq_size > ring->sq_size) {
+      ring->sq_size = ring->cq_size;
+    }
+    ring->cq_size = ring->sq_size;
+  }
+
+  ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if (ring->sq_ptr == MAP_FAILED) {
+    ring->sq_ptr = NULL;
+    uring_close(ring);
+    return -1;
+  }
+
+  if (single_mmap) {
+    ring->cq_ptr = ring->sq_ptr;
+  } else {
+    ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    if (ring->cq_ptr == MAP_FAILED) {
+      ring->cq_ptr = NULL;
+      uring_close(ring);
+      return -1;
+    }
+  }
+
+  ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED) {
+    ring->sqes = NULL;
+    uring_close(ring);
+    return -1;
+  }
+
+  char *const sq = ring->sq_ptr;
+  ring->sq_head = (unsigned *)(sq + p.sq_off.head);
+  ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+  ring->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+  ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+
+  char *const cq = ring->cq_ptr;
+  ring->cq_head = (unsigned *)(cq + p.cq_off.head);
+  ring->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+  ring->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+  return 0;
+}
+
+void uring_close(struct uring *const ring) {
+  if (ring->sqes != NULL) {
+    munmap(ring->sqes, ring->sqes_size);
+  }
+  if (ring->cq_ptr != NULL && ring->cq_ptr != ring->sq_ptr) {
+    munmap(ring->cq_ptr, ring->cq_size);
+  }
+  if (ring->sq_ptr != NULL) {
+    munmap(ring->sq_ptr, ring->sq_size);
+  }
+  if (ring->fd >= 0) {
+    close(ring->fd);
+  }
+  *ring = (struct uring){.fd = -1};
+}
+
+bool uring_probe(struct uring *const ring, uint8_t const *const ops,
+                 size_t const nops) {
+  size_t const size = sizeof(struct io_uring_probe) +
+                      256 * sizeof(struct io_uring_probe_op);
+  struct io_uring_probe *probe = calloc(1, size);
+  if (probe == NULL) {
+    return false;
+  }
+
+  bool supported =
+      uring_register(ring->fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+  for (size_t i = 0; supported && i < nops; ++i) {
+    supported = ops[i] <= probe->last_op &&
+                (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED);
+  }
+
+  free(probe);
+  return supported;
+}
+
+// Publish the pending entries to the kernel.
+// Returns the number of entries the kernel has yet to consume.
+unsigned uring_flush(struct uring *const ring) {
+  unsigned const tail = *ring->sq_tail + ring->sq_pending;
+  store_release(ring->sq_tail, tail);
+  ring->sq_pending = 0;
+  return tail - load_acquire(ring->sq_head);
+}
+
+struct io_uring_sqe *uring_get_sqe(struct uring *const ring) {
+  unsigned const entries = *ring->sq_mask + 1;
+
+  unsigned tail = *ring->sq_tail + ring->sq_pending;
+  if (tail - load_acquire(ring->sq_head) >= entries) {
+    // Queue full: make room by submitting what is there
+    if (uring_enter(ring->fd, uring_flush(ring), 0, 0, NULL, 0) < 0) {
+      return NULL;
+    }
+
+    tail = *ring->sq_tail;
+    if (tail - load_acquire(ring->sq_head) >= entries) {
+      return NULL;
+    }
+  }
+
+  unsigned const idx = tail & *ring->sq_mask;
+  ring->sq_array[idx] = idx;
+  ++ring->sq_pending;
+
+  struct io_uring_sqe *const sqe = &ring->sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+int uring_submit_and_wait(struct uring *const ring,
+                          struct timespec const *const timeout) {
+  unsigned const to_submit = uring_flush(ring);
+
+  struct __kernel_timespec ts = {
+      .tv_sec = timeout->tv_sec,
+      .tv_nsec = timeout->tv_nsec,
+  };
+
+  struct io_uring_getevents_arg arg = {
+      .sigmask = 0,
+      .sigmask_sz = _NSIG / 8,
+      .ts = (uint64_t)(uintptr_t)&ts,
+  };
+
+  return uring_enter(ring->fd, to_submit, 1,
+                     IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg,
+                     sizeof(arg));
+}
+
+struct io_uring_cqe *uring_peek_cqe(struct uring *const ring) {
+  unsigned const head = *ring->cq_head;
+  if (head == load_acquire(ring->cq_tail)) {
+    return NULL;
+  }
+  return &ring->cqes[head & *ring->cq_mask];
+}
+
+void uring_cqe_seen(struct uring *const ring) {
+  store_release(ring->cq_head, *ring->cq_head + 1);
+}
+
+// Fill in a slot of the buffer ring. Fields are set one by one because the
+// ring's tail overlays the reserved field of the first slot.
+void uring_buffer_put(struct uring_buffers *const bufs, unsigned const slot,
+                      uint16_t const id) {
+  struct io_uring_buf *const buf = &bufs->ring->bufs[slot & (bufs->count - 1)];
+  buf->addr = (uint64_t)(uintptr_t)(bufs->data + (size_t)id * bufs->size);
+  buf->len = bufs->size;
+  buf->bid = id;
+}
+
+int uring_buffers_init(struct uring_buffers *const bufs,
+                       struct uring *const ring, uint16_t const group,
+                       unsigned const count, unsigned const size) {
+  if (count == 0 || (count & (count - 1)) != 0) {
+    return -1;
+  }
+
+  *bufs = (struct uring_buffers){
+      .ring_size = count * sizeof(struct io_uring_buf),
+      .count = count,
+      .size = size,
+      .group = group,
+  };
+
+  bufs->ring = mmap(NULL, bufs->ring_size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (bufs->ring == MAP_FAILED) {
+    return -1;
+  }
+
+  bufs->data = malloc((size_t)count * size);
+  if (bufs->data == NULL) {
+    munmap(bufs->ring, bufs->ring_size);
+    return -1;
+  }
+
+  struct io_uring_buf_reg reg = {
+      .ring_addr = (uint64_t)(uintptr_t)bufs->ring,
+      .ring_entries = count,
+      .bgid = group,
+  };
+
+  if (uring_register(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+    free(bufs->data);
+    munmap(bufs->ring, bufs->ring_size);
+    return -1;
+  }
+
+  for (unsigned i = 0; i < count; ++i) {
+    uring_buffer_put(bufs, i, i);
+  }
+  store_release(&bufs->ring->tail, (uint16_t)count);
+
+  return 0;
+}
+
+void uring_buffers_free(struct uring_buffers *const bufs,
+                        struct uring *const ring) {
+  struct io_uring_buf_reg reg = {.bgid = bufs->group};
+  uring_register(ring->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+
+  free(bufs->data);
+  munmap(bufs->ring, bufs->ring_size);
+}
+
+char *uring_buffer(struct uring_buffers *const bufs, uint16_t const id) {
+  return bufs->data + (size_t)id * bufs->size;
+}
+
+void uring_buffer_recycle(struct uring_buffers *const bufs, uint16_t const id) {
+  uint16_t const tail = bufs->ring->tail;
+  uring_buffer_put(bufs, tail, id);
+  store_release(&bufs->ring->tail, (uint16_t)(tail + 1));
+}
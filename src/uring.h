@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <linux/io_uring.h>
+
+// Minimal io_uring wrapper over the raw system calls
+struct uring {
+  int fd;
+  unsigned features;
+
+  // Submission queue, shared with the kernel
+  void *sq_ptr;
+  size_t sq_size;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  struct io_uring_sqe *sqes;
+  size_t sqes_size;
+
+  // Submission queue entries handed out but not yet submitted
+  unsigned sq_pending;
+
+  // Completion queue, shared with the kernel
+  void *cq_ptr;
+  size_t cq_size;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_cqe *cqes;
+};
+
+// Set up a ring with room for at least entries submissions
+int uring_init(struct uring *ring, unsigned entries);
+
+// Tear down the ring. Pending requests are cancelled.
+void uring_close(struct uring *ring);
+
+// Whether the kernel supports every opcode in ops
+bool uring_probe(struct uring *ring, uint8_t const *ops, size_t nops);
+
+// Get a zeroed submission queue entry, submitting the pending ones first if
+// the queue is full. Returns NULL if the queue could not be drained.
+struct io_uring_sqe *uring_get_sqe(struct uring *ring);
+
+// Submit the pending entries and wait for at least one completion, or until
+// the timeout expires. Returns -1 with errno set on error (ETIME and EINTR
+// included).
+int uring_submit_and_wait(struct uring *ring, struct timespec const *timeout);
+
+// Next completion, or NULL if there is none
+struct io_uring_cqe *uring_peek_cqe(struct uring *ring);
+
+// Mark the completion returned by uring_peek_cqe as consumed
+void uring_cqe_seen(struct uring *ring);
+
+// A ring of provided buffers that the kernel picks from when receiving
+struct uring_buffers {
+  struct io_uring_buf_ring *ring;
+  size_t ring_size;
+  char *data;
+  unsigned count;
+  unsigned size;
+  uint16_t group;
+};
+
+// Register count buffers of the given size under the buffer group id.
+// Count must be a power of two.
+int uring_buffers_init(struct uring_buffers *bufs, struct uring *ring,
+                       uint16_t group, unsigned count, unsigned size);
+
+void uring_buffers_free(struct uring_buffers *bufs, struct uring *ring);
+
+// Pointer to the data of the buffer with the given id
+char *uring_buffer(struct uring_buffers *bufs, uint16_t id);
+
+// Hand the buffer back to the kernel once its data has been consumed
+void uring_buffer_recycle(struct uring_buffers *bufs, uint16_t id);
@@ -0,0 +1,626 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <sys/poll.h>
+#include <sys/socket.h>
+
+#include "eventloop.h"
+#include "http.h"
+#include "uringloop.h"
+
+#define uring_loop_entries 256
+#define uring_loop_buffer_group 0
+#define uring_loop_buffer_count 256
+#define uring_loop_buffer_size 4096
+
+// Completions carry the connection pointer with the operation in its low bits
+enum uring_op {
+  URING_OP_ACCEPT = 0,
+  URING_OP_RECV = 1,
+  URING_OP_SEND = 2,
+  URING_OP_SHUTDOWN = 3,
+  URING_OP_CLOSE = 4,
+  URING_OP_CANCEL = 5,
+  URING_OP_ASYNC = 6,
+};
+
+#define uring_op_mask 7ull
+
+uint64_t uring_user_data(struct uring_connection *const c,
+                         enum uring_op const op) {
+  return (uint64_t)(uintptr_t)c | op;
+}
+
+bool uring_loop_supported() {
+  struct uring ring;
+  if (uring_init(&ring, 8) != 0) {
+    return false;
+  }
+
+  static uint8_t const ops[] = {
+      IORING_OP_ACCEPT,   IORING_OP_RECV,  IORING_OP_SEND,
+      IORING_OP_SHUTDOWN, IORING_OP_CLOSE, IORING_OP_ASYNC_CANCEL,
+      IORING_OP_POLL_ADD,
+  };
+
+  bool supported = (ring.features & IORING_FEAT_EXT_ARG) &&
+                   uring_probe(&ring, ops, sizeof(ops) / sizeof(*ops));
+
+  if (supported) {
+    // Provided buffer rings
+    struct uring_buffers bufs;
+    supported = uring_buffers_init(&bufs, &ring, 0, 1, 16) == 0;
+    if (supported) {
+      uring_buffers_free(&bufs, &ring);
+    }
+  }
+
+  uring_close(&ring);
+  return supported;
+}
+
+int uring_loop_init(struct uring_loop *const loop,
+                    struct httpserver_shard *const shard, size_t const id,
+                    volatile bool *const interrupt) {
+  *loop = (struct uring_loop){
+      .shard = shard,
+      .id = id,
+      .interrupt = interrupt,
+      .connections = NULL,
+  };
+
+  if (uring_init(&loop->ring, uring_loop_entries) != 0) {
+    return -1;
+  }
+
+  if (uring_buffers_init(&loop->buffers, &loop->ring, uring_loop_buffer_group,
+                         uring_loop_buffer_count,
+                         uring_loop_buffer_size) != 0) {
+    uring_close(&loop->ring);
+    return -1;
+  }
+
+  return 0;
+}
+
+struct io_uring_sqe *uring_loop_sqe(struct uring_loop *const loop) {
+  struct io_uring_sqe *const sqe = uring_get_sqe(&loop->ring);
+  if (sqe == NULL) {
+    loop->failed = true;
+  }
+  return sqe;
+}
+
+void uring_loop_arm_accept(struct uring_loop *const loop) {
+  struct io_uring_sqe *const sqe = uring_loop_sqe(loop);
+  if (sqe == NULL) {
+    return;
+  }
+
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = loop->shard->sockfd;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->accept_flags = SOCK_CLOEXEC;
+  sqe->user_data = uring_user_data(NULL, URING_OP_ACCEPT);
+  loop->accepting = true;
+}
+
+void uring_loop_arm_recv(struct uring_loop *const loop,
+                         struct uring_connection *const c) {
+  struct io_uring_sqe *const sqe = uring_loop_sqe(loop);
+  if (sqe == NULL) {
+    return;
+  }
+
+  // The kernel picks a buffer from the provided ring for every receive
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = c->conn.fd;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = loop->buffers.group;
+  sqe->user_data = uring_user_data(c, URING_OP_RECV);
+
+  c->receiving = true;
+  ++c->inflight;
+}
+
+void uring_loop_submit_shutdown(struct uring_loop *const loop,
+                                struct uring_connection *const c) {
+  struct io_uring_sqe *const sqe = uring_loop_sqe(loop);
+  if (sqe == NULL) {
+    return;
+  }
+
+  // Wakes up the pending receive, once the queued output is sent. A rejected
+  // connection shuts down its write side only, and lingers: the receive
+  // discards the input until the peer closes its end.
+  bool const linger = c->conn.linger && !c->conn.peer_closed;
+  sqe->opcode = IORING_OP_SHUTDOWN;
+  sqe->fd = c->conn.fd;
+  sqe->len = linger ? SHUT_WR : SHUT_RDWR;
+  sqe->user_data = uring_user_data(c, URING_OP_SHUTDOWN);
+
+  c->shutdown = true;
+  ++c->inflight;
+  if (linger) {
+    c->conn.linger_until = monotonic_seconds() + connection_linger_seconds;
+  }
+}
+
+// Stop lingering: cancelling the receive lets the connection close
+void uring_loop_drained(struct uring_loop *const loop,
+                        struct uring_connection *const c) {
+  if (!c->receiving || c->drained) {
+    return;
+  }
+
+  struct io_uring_sqe *const sqe = uring_loop_sqe(loop);
+  if (sqe == NULL) {
+    return;
+  }
+
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->addr = uring_user_data(c, URING_OP_RECV);
+  sqe->user_data = uring_user_data(NULL, URING_OP_CANCEL);
+  c->drained = true;
+}
+
+// Wait for the suspended response of the connection to be resumable
+void uring_loop_arm_async(struct uring_loop *const loop,
+                          struct uring_connection *const c) {
+  struct io_uring_sqe *const sqe = uring_loop_sqe(loop);
+  if (sqe == NULL) {
+    return;
+  }
+
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = connection_async_fd(&c->conn);
+  sqe->poll32_events = POLLIN;
+  sqe->user_data = uring_user_data(c, URING_OP_ASYNC);
+
+  c->waiting = true;
+  ++c->inflight;
+}
+
+// Hand the pending output to the kernel. When the connection is closing, the
+// shutdown is linked to the send so that both go out with one submission.
+void uring_loop_send(struct uring_loop *const loop,
+                     struct uring_connection *const c) {
+  if (c->send_inflight || c->failed) {
+    return;
+  }
+
+  // Streamed bodies are produced only as fast as the socket takes them. There
+  // is no sendfile for rings, so file bodies are read into the output.
+  connection_fill(&c->conn, true);
+  if (c->conn.out.len == 0) {
+    return;
+  }
+
+  // The kernel reads from the sending buffer while the handlers may keep
+  // appending to the output buffer
+  struct string_t const tmp = c->sending;
+  c->sending = c->conn.out;
+  c->conn.out = tmp;
+  c->conn.out.len = 0;
+
+  struct io_uring_sqe *const sqe = uring_loop_sqe(loop);
+  if (sqe == NULL) {
+    return;
+  }
+
+  // MSG_WAITALL makes the kernel retry short sends, so that only errors break
+  // the link
+  sqe->opcode = IORING_OP_SEND;
+  sqe->fd = c->conn.fd;
+  sqe->addr = (uint64_t)(uintptr_t)c->sending.data;
+  sqe->len = c->sending.len;
+  sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+  sqe->user_data = uring_user_data(c, URING_OP_SEND);
+
+  c->send_inflight = true;
+  atomic_fetch_add(&loop->shard->writes, 1);
+  ++c->inflight;
+
+  if (c->conn.closing && !connection_streaming(&c->conn) && c->receiving &&
+      !c->shutdown) {
+    sqe->flags |= IOSQE_IO_LINK;
+    uring_loop_submit_shutdown(loop, c);
+  }
+}
+
+// Move a closing connection towards its close, one step at a time
+void uring_loop_finish(struct uring_loop *const loop,
+                       struct uring_connection *const c) {
+  if (!c->conn.closing || c->close) {
+    return;
+  }
+
+  uring_loop_send(loop, c);
+  if (c->send_inflight) {
+    return;
+  }
+
+  if (c->receiving && !c->shutdown) {
+    uring_loop_submit_shutdown(loop, c);
+  }
+
+  if (c->waiting && !c->cancelling) {
+    // The response is dropped along with the connection
+    struct io_uring_sqe *const sqe = uring_loop_sqe(loop);
+    if (sqe != NULL) {
+      sqe->opcode = IORING_OP_ASYNC_CANCEL;
+      sqe->addr = uring_user_data(c, URING_OP_ASYNC);
+      sqe->user_data = uring_user_data(NULL, URING_OP_CANCEL);
+      c->cancelling = true;
+    }
+  }
+
+  if (c->inflight > 0) {
+    return;
+  }
+
+  struct io_uring_sqe *const sqe = uring_loop_sqe(loop);
+  if (sqe == NULL) {
+    return;
+  }
+
+  sqe->opcode = IORING_OP_CLOSE;
+  sqe->fd = c->conn.fd;
+  sqe->user_data = uring_user_data(c, URING_OP_CLOSE);
+
+  c->close = true;
+  ++c->inflight;
+}
+
+void uring_loop_free_connection(struct uring_loop *const loop,
+                                struct uring_connection *const c) {
+  if (c->prev != NULL) {
+    c->prev->next = c->next;
+  } else {
+    loop->connections = c->next;
+  }
+  if (c->next != NULL) {
+    c->next->prev = c->prev;
+  }
+
+  connection_free(&c->conn);
+  string_free(&c->sending);
+  free(c);
+
+  atomic_fetch_sub(&loop->shard->active, 1);
+}
+
+void uring_loop_on_accept(struct uring_loop *const loop,
+                          struct io_uring_cqe const *const cqe) {
+  if (!(cqe->flags & IORING_CQE_F_MORE)) {
+    // Re-armed on the next iteration
+    loop->accepting = false;
+  }
+
+  if (cqe->res < 0) {
+    if (cqe->res == -EINVAL) {
+      // Multishot accept is not supported by this kernel
+      loop->failed = true;
+    }
+    return;
+  }
+
+  int const fd = cqe->res;
+  if (loop->stopping) {
+    close(fd);
+    return;
+  }
+
+  struct uring_connection *c = calloc(1, sizeof(*c));
+  if (c == NULL) {
+    close(fd);
+    return;
+  }
+
+  struct sockaddr_in addr = {.sin_family = AF_UNSPEC};
+  socklen_t addrlen = sizeof(addr);
+  getpeername(fd, (struct sockaddr *)&addr, &addrlen);
+
+  connection_init(&c->conn, fd, &addr, loop->shard);
+  c->sending = null_string();
+  c->last_active = monotonic_seconds();
+
+  c->next = loop->connections;
+  if (loop->connections != NULL) {
+    loop->connections->prev = c;
+  }
+  loop->connections = c;
+
+  atomic_fetch_add(&loop->shard->accepted, 1);
+  atomic_fetch_add(&loop->shard->active, 1);
+
+  uring_loop_arm_recv(loop, c);
+}
+
+// Serve the requests that waited for a streamed or suspended response, once
+// it ended or was completed
+void uring_loop_resume(struct uring_loop *const loop,
+                       struct uring_connection *const c) {
+  while (!connection_blocked(&c->conn) && !c->conn.closing &&
+         (c->conn.in.len > 0 || c->conn.peer_closed)) {
+    connection_process(&c->conn, loop->id);
+    uring_loop_send(loop, c);
+  }
+}
+
+void uring_loop_on_recv(struct uring_loop *const loop,
+                        struct uring_connection *const c,
+                        struct io_uring_cqe const *const cqe) {
+  bool const more = cqe->flags & IORING_CQE_F_MORE;
+
+  if (cqe->res == 0) {
+    c->conn.peer_closed = true;
+  } else if (cqe->res < 0 && cqe->res != -ENOBUFS) {
+    c->conn.closing = true;
+  }
+
+  if (!more) {
+    c->receiving = false;
+    --c->inflight;
+  }
+
+  if (connection_lingering(&c->conn) && cqe->res > 0) {
+    c->conn.lingered += cqe->res;
+    if (c->conn.lingered >= connection_linger_bytes) {
+      uring_loop_drained(loop, c);
+    }
+  }
+
+  if (cqe->flags & IORING_CQE_F_BUFFER) {
+    // Parse straight out of the provided buffer, then hand it back. Every
+    // response to the requests received so far goes out in one batch.
+    uint16_t const id = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    if (cqe->res > 0) {
+      connection_feed(&c->conn, uring_buffer(&loop->buffers, id), cqe->res,
+                      loop->id);
+    }
+    uring_buffer_recycle(&loop->buffers, id);
+  } else if (c->conn.peer_closed) {
+    connection_feed(&c->conn, NULL, 0, loop->id);
+  }
+
+  if (!c->receiving && !c->conn.closing && !c->conn.peer_closed &&
+      !loop->stopping) {
+    // Out of buffers, or the kernel ended the multishot receive
+    uring_loop_arm_recv(loop, c);
+  }
+
+  uring_loop_send(loop, c);
+  uring_loop_resume(loop, c);
+}
+
+void uring_loop_on_send(struct uring_loop *const loop,
+                        struct uring_connection *const c,
+                        struct io_uring_cqe const *const cqe) {
+  --c->inflight;
+  c->send_inflight = false;
+
+  if (cqe->res < 0 || (size_t)cqe->res < c->sending.len) {
+    c->failed = true;
+    c->conn.closing = true;
+  }
+  c->sending.len = 0;
+
+  uring_loop_send(loop, c);
+  uring_loop_resume(loop, c);
+}
+
+void uring_loop_on_async(struct uring_loop *const loop,
+                         struct uring_connection *const c,
+                         struct io_uring_cqe const *const cqe) {
+  --c->inflight;
+  c->waiting = false;
+
+  if (cqe->res < 0 || c->conn.closing) {
+    // Cancelled: freeing the connection cancels the response too
+    return;
+  }
+
+  connection_resume(&c->conn);
+  uring_loop_send(loop, c);
+  uring_loop_resume(loop, c);
+}
+
+void uring_loop_handle(struct uring_loop *const loop,
+                       struct io_uring_cqe const *const cqe) {
+  enum uring_op const op = cqe->user_data & uring_op_mask;
+  struct uring_connection *const c =
+      (struct uring_connection *)(uintptr_t)(cqe->user_data & ~uring_op_mask);
+
+  switch (op) {
+  case URING_OP_ACCEPT:
+    uring_loop_on_accept(loop, cqe);
+    return;
+  case URING_OP_CANCEL:
+    return;
+  case URING_OP_RECV:
+    uring_loop_on_recv(loop, c, cqe);
+    break;
+  case URING_OP_SEND:
+    uring_loop_on_send(loop, c, cqe);
+    break;
+  case URING_OP_SHUTDOWN:
+    --c->inflight;
+    if (cqe->res == -ECANCELED) {
+      // The linked send failed: shut down on its own
+      c->shutdown = false;
+    }
+    break;
+  case URING_OP_ASYNC:
+    uring_loop_on_async(loop, c, cqe);
+    break;
+  case URING_OP_CLOSE:
+    uring_loop_free_connection(loop, c);
+    return;
+  }
+
+  if (connection_suspended(&c->conn) && !c->waiting && !c->conn.closing) {
+    uring_loop_arm_async(loop, c);
+  }
+
+  c->last_active = monotonic_seconds();
+  uring_loop_finish(loop, c);
+}
+
+// Handle every completion available without waiting
+void uring_loop_reap(struct uring_loop *const loop) {
+  struct io_uring_cqe *cqe;
+  while ((cqe = uring_peek_cqe(&loop->ring)) != NULL) {
+    struct io_uring_cqe const copy = *cqe;
+    uring_cqe_seen(&loop->ring);
+    uring_loop_handle(loop, &copy);
+  }
+}
+
+// Close the connections that stayed idle for longer than the keep-alive
+// timeout, and those done lingering. Runs at most once per second.
+void uring_loop_sweep(struct uring_loop *const loop) {
+  time_t const now = monotonic_seconds();
+  if (now == loop->last_sweep) {
+    return;
+  }
+  loop->last_sweep = now;
+
+  time_t const timeout = loop->shard->server->keepalive_timeout;
+
+  struct uring_connection *c = loop->connections;
+  while (c != NULL) {
+    struct uring_connection *const next = c->next;
+    if (!c->conn.closing && !c->send_inflight &&
+        !connection_suspended(&c->conn) && now - c->last_active >= timeout) {
+      c->conn.closing = true;
+      uring_loop_finish(loop, c);
+    } else if (connection_lingering(&c->conn) &&
+               now >= c->conn.linger_until) {
+      uring_loop_drained(loop, c);
+    }
+    c = next;
+  }
+}
+
+void *uring_loop_run(void *ptr) {
+  struct uring_loop *const loop = (struct uring_loop *)ptr;
+  struct timespec const timeout = {.tv_sec = 1, .tv_nsec = 0};
+
+  while (!*loop->interrupt && !loop->failed) {
+    if (!loop->accepting) {
+      uring_loop_arm_accept(loop);
+    }
+
+    // A single system call submits every pending request and waits
+    if (uring_submit_and_wait(&loop->ring, &timeout) < 0 && errno != ETIME &&
+        errno != EINTR && errno != EBUSY) {
+      loop->failed = true;
+      break;
+    }
+
+    uring_loop_reap(loop);
+    uring_loop_sweep(loop);
+  }
+
+  return NULL;
+}
+
+// Wake up every pending request and wait for the kernel to let go of the
+// connections' buffers
+void uring_loop_drain(struct uring_loop *const loop) {
+  loop->stopping = true;
+
+  if (loop->accepting) {
+    struct io_uring_sqe *const sqe = uring_loop_sqe(loop);
+    if (sqe != NULL) {
+      sqe->opcode = IORING_OP_ASYNC_CANCEL;
+      sqe->addr = uring_user_data(NULL, URING_OP_ACCEPT);
+      sqe->user_data = uring_user_data(NULL, URING_OP_CANCEL);
+    }
+  }
+
+  for (struct uring_connection *c = loop->connections; c != NULL;
+       c = c->next) {
+    shutdown(c->conn.fd, SHUT_RDWR);
+    c->conn.closing = true;
+    c->failed = true;
+  }
+
+  struct timespec const timeout = {.tv_sec = 0, .tv_nsec = 100 * 1000 * 1000};
+  for (int i = 0; i < 10 && loop->connections != NULL && !loop->failed; ++i) {
+    if (uring_submit_and_wait(&loop->ring, &timeout) < 0 && errno != ETIME &&
+        errno != EINTR && errno != EBUSY) {
+      break;
+    }
+    uring_loop_reap(loop);
+  }
+}
+
+void uring_loop_close(struct uring_loop *const loop) {
+  uring_loop_drain(loop);
+
+  // Tearing down the ring cancels whatever is left
+  uring_buffers_free(&loop->buffers, &loop->ring);
+  uring_close(&loop->ring);
+
+  while (loop->connections != NULL) {
+    struct uring_connection *const c = loop->connections;
+    if (!c->close) {
+      close(c->conn.fd);
+    }
+    uring_loop_free_connection(loop, c);
+  }
+}
+
+int shard_serve_uring(struct httpserver_shard *const shard,
+                      size_t const nloops, volatile bool *interrupt) {
+  if (nloops == 0) {
+    return -1;
+  }
+
+  if (!uring_loop_supported()) {
+    printf("io_uring is not supported, falling back to event loops\n");
+    return shard_serve_events(shard, nloops, interrupt);
+  }
+
+  struct uring_loop *loops = calloc(nloops, sizeof(*loops));
+  if (loops == NULL) {
+    return -1;
+  }
+
+  int retval = 0;
+  size_t running = 0;
+  for (; running < nloops; ++running) {
+    struct uring_loop *const loop = &loops[running];
+    if (uring_loop_init(loop, shard, running, interrupt) != 0) {
+      retval = -1;
+      break;
+    }
+
+    if (pthread_create(&loop->thread, NULL, uring_loop_run, loop) != 0) {
+      uring_loop_close(loop);
+      retval = -1;
+      break;
+    }
+  }
+
+  if (retval != 0) {
+    // Stop the loops that did start
+    *interrupt = true;
+  }
+
+  for (size_t i = 0; i < running; ++i) {
+    pthread_join(loops[i].thread, NULL);
+    if (loops[i].failed) {
+      retval = -1;
+    }
+    uring_loop_close(&loops[i]);
+  }
+
+  free(loops);
+  return retval;
+}
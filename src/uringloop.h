@@ -0,0 +1,70 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "connection.h"
+#include "shard.h"
+#include "string_t.h"
+#include "uring.h"
+
+// A client connection owned by an io_uring loop
+struct uring_connection {
+  struct connection conn;
+
+  // Output handed to the kernel. New responses accumulate in conn.out
+  // meanwhile, and are sent once this send completes.
+  struct string_t sending;
+
+  // Requests on this connection still held by the kernel
+  unsigned inflight;
+
+  bool receiving;     // The multishot receive is armed
+  bool send_inflight; // A send is in progress
+  bool shutdown;      // A shutdown was submitted
+  bool drained;       // Lingering ended: the receive was cancelled
+  bool close;         // A close was submitted
+  bool failed;        // Sending failed: drop any further output
+  bool waiting;       // The fd of the suspended response is polled
+  bool cancelling;    // The poll was cancelled
+
+  // Monotonic time of the last completion, in seconds
+  time_t last_active;
+
+  // Intrusive list of the connections owned by the loop
+  struct uring_connection *prev;
+  struct uring_connection *next;
+};
+
+// A loop accepting with multishot accept, receiving into provided buffers and
+// sending responses with linked sends, all through a single io_uring
+struct uring_loop {
+  struct httpserver_shard *shard;
+  size_t id;
+  volatile bool *interrupt;
+
+  struct uring ring;
+  struct uring_buffers buffers;
+
+  bool accepting; // The multishot accept is armed
+  bool stopping;  // Do not arm any new request
+  bool failed;    // The ring is unusable
+
+  struct uring_connection *connections;
+  time_t last_sweep;
+  pthread_t thread;
+};
+
+// Whether the kernel supports everything the io_uring loops need
+bool uring_loop_supported();
+
+// Set up the ring and its receive buffers
+int uring_loop_init(struct uring_loop *loop, struct httpserver_shard *shard,
+                    size_t id, volatile bool *interrupt);
+
+// Run the loop until the interrupt is raised. Meant as a pthread entry point.
+void *uring_loop_run(void *loop);
+
+// Close all connections owned by the loop and tear down its ring
+void uring_loop_close(struct uring_loop *loop);
@@ -1,11 +1,20 @@
 package test_test
 
 import (
+	"bufio"
 	"bytes"
+	"compress/gzip"
+	"compress/zlib"
 	"context"
 	"fmt"
 	"io"
+	"mime"
+	"mime/multipart"
+	"net"
 	"net/http"
+	"os"
+	"path/filepath"
+	"strings"
 	"testing"
 	"time"
 
@@ -67,6 +76,57 @@ func TestGet(t *testing.T) {
 	}
 }
 
+func TestRouting(t *testing.T) {
+	t.Parallel()
+	ctx := context.Background()
+
+	testCases := map[string]struct {
+		method   string
+		path     string
+		want     int
+		wantBody string
+	}{
+		"Parameter is captured":              {method: http.MethodGet, path: "/hello/world", want: http.StatusOK, wantBody: "Hello, world!\n"},
+		"Query string is not captured":       {method: http.MethodGet, path: "/hello/there?x=1", want: http.StatusOK, wantBody: "Hello, there!\n"},
+		"Parameter does not span segments":   {method: http.MethodGet, path: "/hello/big/world", want: http.StatusNotFound},
+		"Parameter cannot be empty":          {method: http.MethodGet, path: "/hello/", want: http.StatusNotFound},
+		"Parameter route checks the method":  {method: http.MethodPost, path: "/hello/world", want: http.StatusMethodNotAllowed},
+		"Static prefix of a route not found": {method: http.MethodGet, path: "/hom", want: http.StatusNotFound},
+		"Static route with a longer path":    {method: http.MethodGet, path: "/homepage", want: http.StatusNotFound},
+	}
+
+	for name, tc := range testCases {
+		t.Run(name, func(t *testing.T) {
+			t.Parallel()
+
+			ctx, cancel := context.WithCancel(ctx)
+			defer cancel()
+
+			port := test.ReservePort()
+			addr := fmt.Sprintf("http://localhost:%d", port)
+
+			close, err := test.RunServer(ctx, port)
+			require.NoError(t, err, "Server should start without issues")
+			defer close(t.Logf)
+
+			req, err := http.NewRequestWithContext(ctx, tc.method, addr+tc.path, nil)
+			require.NoError(t, err, "Request should be created without issues")
+
+			resp, err := (&http.Client{Timeout: 5 * time.Second}).Do(req)
+			require.NoError(t, err, "Request should be executed without issues")
+			require.Equal(t, tc.want, resp.StatusCode, "Status code should be as expected")
+
+			bod, err := io.ReadAll(resp.Body)
+			require.NoError(t, err)
+			if tc.wantBody != "" {
+				require.Equal(t, tc.wantBody, string(bod), "Body should be as expected")
+			}
+
+			require.NoError(t, close(t.Logf), "Server should stop without issues")
+		})
+	}
+}
+
 func TestPost(t *testing.T) {
 	t.Parallel()
 	ctx := context.Background()
@@ -217,3 +277,1219 @@ func TestMultithreding(t *testing.T) {
 
 	require.NoError(t, stop(t.Logf), "Server should stop without issues")
 }
+
+func TestEventMode(t *testing.T) {
+	t.Parallel()
+	ctx := context.Background()
+
+	testCases := map[string]struct {
+		method   string
+		path     string
+		body     []byte
+		want     int
+		wantBody []byte
+	}{
+		"GET responds with an OK":      {method: http.MethodGet, path: "/home", want: http.StatusOK},
+		"GET bad address is a 404":     {method: http.MethodGet, path: "/not-found", want: http.StatusNotFound, wantBody: []byte("404 Not Found\n")},
+		"POST with text body":          {method: http.MethodPost, path: "/parrot", body: []byte("this is just some sample text"), want: http.StatusOK},
+		"POST with long body":          {method: http.MethodPost, path: "/parrot", body: bytes.Repeat([]byte("abcdefg"), 8*1024), want: http.StatusOK},
+		"POST where it is not allowed": {method: http.MethodPost, path: "/home", want: http.StatusMethodNotAllowed, wantBody: []byte("405 Method Not Allowed\n")},
+	}
+
+	for name, tc := range testCases {
+		t.Run(name, func(t *testing.T) {
+			t.Parallel()
+
+			if tc.wantBody == nil {
+				tc.wantBody = tc.body
+			}
+
+			ctx, cancel := context.WithCancel(ctx)
+			defer cancel()
+
+			port := test.ReservePort()
+			addr := fmt.Sprintf("http://localhost:%d", port)
+
+			close, err := test.RunServer(ctx, port, "--mode", "events")
+			require.NoError(t, err, "Server should start without issues")
+			defer close(t.Logf)
+
+			req, err := http.NewRequestWithContext(ctx, tc.method, addr+tc.path, bytes.NewReader(tc.body))
+			require.NoError(t, err, "Request should be created without issues")
+
+			resp, err := (&http.Client{Timeout: 5 * time.Second}).Do(req)
+			require.NoError(t, err, "Request should be executed without issues")
+			require.Equal(t, tc.want, resp.StatusCode, "Status code should be as expected")
+
+			bod, err := io.ReadAll(resp.Body)
+			require.NoError(t, err)
+			if tc.wantBody != nil {
+				require.Equal(t, tc.wantBody, bod, "Body should be as expected")
+			}
+
+			require.NoError(t, close(t.Logf), "Server should stop without issues")
+		})
+	}
+}
+
+func TestKeepAlive(t *testing.T) {
+	t.Parallel()
+	ctx := context.Background()
+
+	testCases := map[string]struct {
+		mode       string
+		header     string
+		protocol   string
+		nrequests  int
+		wantClosed bool
+	}{
+		"HTTP/1.1 persists by default":             {mode: "threads", protocol: "HTTP/1.1", nrequests: 3},
+		"HTTP/1.1 persists by default (events)":    {mode: "events", protocol: "HTTP/1.1", nrequests: 3},
+		"HTTP/1.0 persists when asked":             {mode: "threads", protocol: "HTTP/1.0", header: "Connection: keep-alive", nrequests: 3},
+		"HTTP/1.0 persists when asked (events)":    {mode: "events", protocol: "HTTP/1.0", header: "Connection: keep-alive", nrequests: 3},
+		"HTTP/1.0 closes by default":               {mode: "threads", protocol: "HTTP/1.0", nrequests: 1, wantClosed: true},
+		"Connection close is honoured":             {mode: "threads", protocol: "HTTP/1.1", header: "Connection: close", nrequests: 1, wantClosed: true},
+		"Connection close is honoured (events)":    {mode: "events", protocol: "HTTP/1.1", header: "Connection: close", nrequests: 1, wantClosed: true},
+		"Request limit closes the connection":      {mode: "threads", protocol: "HTTP/1.1", nrequests: 2, wantClosed: true},
+		"Request limit closes the connection (ev)": {mode: "events", protocol: "HTTP/1.1", nrequests: 2, wantClosed: true},
+		"HTTP/1.1 persists by default (uring)":     {mode: "uring", protocol: "HTTP/1.1", nrequests: 3},
+		"Connection close is honoured (uring)":     {mode: "uring", protocol: "HTTP/1.1", header: "Connection: close", nrequests: 1, wantClosed: true},
+		"Request limit closes the connection (ur)": {mode: "uring", protocol: "HTTP/1.1", nrequests: 2, wantClosed: true},
+		"Close among other tokens is honoured":     {mode: "threads", protocol: "HTTP/1.1", header: "Connection: Upgrade , CLOSE", nrequests: 1, wantClosed: true},
+		"Tokens containing close are not close":    {mode: "threads", protocol: "HTTP/1.1", header: "Connection: x-close-hint", nrequests: 3},
+		"Tokens containing keep-alive are not it":  {mode: "threads", protocol: "HTTP/1.0", header: "Connection: no-keep-alive", nrequests: 1, wantClosed: true},
+	}
+
+	for name, tc := range testCases {
+		t.Run(name, func(t *testing.T) {
+			t.Parallel()
+
+			ctx, cancel := context.WithCancel(ctx)
+			defer cancel()
+
+			port := test.ReservePort()
+
+			args := []string{"--mode", tc.mode}
+			if tc.nrequests == 2 {
+				args = append(args, "--keepalive-max", "2")
+			}
+
+			close, err := test.RunServer(ctx, port, args...)
+			require.NoError(t, err, "Server should start without issues")
+			defer close(t.Logf)
+
+			conn, err := net.Dial("tcp", fmt.Sprintf("localhost:%d", port))
+			require.NoError(t, err, "Should connect to the server")
+			defer conn.Close()
+			require.NoError(t, conn.SetDeadline(time.Now().Add(5*time.Second)))
+
+			r := bufio.NewReader(conn)
+			for i := 0; i < tc.nrequests; i++ {
+				req := fmt.Sprintf("GET /home %s\r\nHost: localhost\r\n", tc.protocol)
+				if tc.header != "" {
+					req += tc.header + "\r\n"
+				}
+				_, err := conn.Write([]byte(req + "\r\n"))
+				require.NoError(t, err, "Request %d should be sent over the same connection", i)
+
+				resp, err := http.ReadResponse(r, nil)
+				require.NoError(t, err, "Response %d should be received over the same connection", i)
+				_, err = io.ReadAll(resp.Body)
+				require.NoError(t, err)
+				require.Equal(t, http.StatusOK, resp.StatusCode, "Status code should be as expected")
+			}
+
+			require.NoError(t, conn.SetReadDeadline(time.Now().Add(500*time.Millisecond)))
+			_, err = r.ReadByte()
+			if tc.wantClosed {
+				require.Equal(t, io.EOF, err, "Server should have closed the connection")
+			} else {
+				require.True(t, os.IsTimeout(err), "Server should have kept the connection open")
+			}
+
+			require.NoError(t, close(t.Logf), "Server should stop without issues")
+		})
+	}
+}
+
+func TestPipelining(t *testing.T) {
+	t.Parallel()
+	ctx := context.Background()
+
+	for _, mode := range []string{"threads", "events", "uring"} {
+		t.Run(mode, func(t *testing.T) {
+			t.Parallel()
+
+			ctx, cancel := context.WithCancel(ctx)
+			defer cancel()
+
+			port := test.ReservePort()
+
+			close, err := test.RunServer(ctx, port, "--mode", mode)
+			require.NoError(t, err, "Server should start without issues")
+			defer close(t.Logf)
+
+			conn, err := net.Dial("tcp", fmt.Sprintf("localhost:%d", port))
+			require.NoError(t, err, "Should connect to the server")
+			defer conn.Close()
+			require.NoError(t, conn.SetDeadline(time.Now().Add(5*time.Second)))
+
+			// All requests are sent at once, the last one split in two writes
+			reqs := "GET /home HTTP/1.1\r\nHost: localhost\r\n\r\n" +
+				"POST /parrot HTTP/1.1\r\nHost: localhost\r\nContent-Length: 5\r\n\r\nhello" +
+				"GET /not-found HTTP/1.1\r\nHost: localhost\r\n\r\n" +
+				"POST /parrot HTTP/1.1\r\nHost: localhost\r\nContent-Length: 5\r\n\r\nwor"
+
+			_, err = conn.Write([]byte(reqs))
+			require.NoError(t, err, "Requests should be sent without issues")
+
+			r := bufio.NewReader(conn)
+			want := []struct {
+				status int
+				body   string
+			}{
+				{status: http.StatusOK},
+				{status: http.StatusOK, body: "hello"},
+				{status: http.StatusNotFound, body: "404 Not Found\n"},
+				{status: http.StatusOK, body: "world"},
+			}
+
+			for i, w := range want {
+				if i == len(want)-1 {
+					_, err = conn.Write([]byte("ld"))
+					require.NoError(t, err, "Last bytes should be sent without issues")
+				}
+
+				resp, err := http.ReadResponse(r, nil)
+				require.NoError(t, err, "Response %d should be received", i)
+				bod, err := io.ReadAll(resp.Body)
+				require.NoError(t, err)
+
+				require.Equal(t, w.status, resp.StatusCode, "Response %d: status code should be as expected", i)
+				if w.body != "" {
+					require.Equal(t, w.body, string(bod), "Response %d: body should be as expected", i)
+				}
+			}
+
+			require.NoError(t, close(t.Logf), "Server should stop without issues")
+		})
+	}
+}
+
+func TestSplitRequest(t *testing.T) {
+	t.Parallel()
+	ctx := context.Background()
+
+	for _, mode := range []string{"threads", "events", "uring"} {
+		t.Run(mode, func(t *testing.T) {
+			t.Parallel()
+
+			ctx, cancel := context.WithCancel(ctx)
+			defer cancel()
+
+			port := test.ReservePort()
+
+			close, err := test.RunServer(ctx, port, "--mode", mode)
+			require.NoError(t, err, "Server should start without issues")
+			defer close(t.Logf)
+
+			conn, err := net.Dial("tcp", fmt.Sprintf("localhost:%d", port))
+			require.NoError(t, err, "Should connect to the server")
+			defer conn.Close()
+			require.NoError(t, conn.SetDeadline(time.Now().Add(10*time.Second)))
+			require.NoError(t, conn.(*net.TCPConn).SetNoDelay(true))
+
+			// Every byte goes out in its own segment
+			req := "POST /parrot HTTP/1.1\r\nHost: localhost\r\nContent-Length: 11\r\n\r\nhello world"
+			for i := range req {
+				_, err = conn.Write([]byte{req[i]})
+				require.NoError(t, err, "Byte %d should be sent without issues", i)
+				time.Sleep(time.Millisecond)
+			}
+
+			resp, err := http.ReadResponse(bufio.NewReader(conn), nil)
+			require.NoError(t, err, "Response should be received")
+			bod, err := io.ReadAll(resp.Body)
+			require.NoError(t, err)
+
+			require.Equal(t, http.StatusOK, resp.StatusCode, "Status code should be as expected")
+			require.Equal(t, "hello world", string(bod), "Body should be as expected")
+
+			require.NoError(t, close(t.Logf), "Server should stop without issues")
+		})
+	}
+}
+
+func TestBodyFraming(t *testing.T) {
+	t.Parallel()
+
+	ctx, cancel := context.WithCancel(context.Background())
+	defer cancel()
+
+	port := test.ReservePort()
+
+	close, err := test.RunServer(ctx, port)
+	require.NoError(t, err, "Server should start without issues")
+	defer close(t.Logf)
+
+	testCases := map[string]struct {
+		headers  string
+		want     int
+		wantBody string
+	}{
+		"Repeated equal lengths are accepted": {headers: "Content-Length: 5\r\nContent-Length: 5\r\n", want: http.StatusOK, wantBody: "hello"},
+		"Non-numeric length is rejected":      {headers: "Content-Length: abc\r\n", want: http.StatusBadRequest},
+		"Negative length is rejected":         {headers: "Content-Length: -5\r\n", want: http.StatusBadRequest},
+		"Empty length is rejected":            {headers: "Content-Length: \r\n", want: http.StatusBadRequest},
+		"Overflowing length is rejected":      {headers: "Content-Length: 99999999999999999999999\r\n", want: http.StatusBadRequest},
+		"Conflicting lengths are rejected":    {headers: "Content-Length: 5\r\nContent-Length: 50\r\n", want: http.StatusBadRequest},
+		"Lengths differing in case conflict":  {headers: "Content-Length: 5\r\ncontent-length: 0\r\n", want: http.StatusBadRequest},
+		"Length and chunks are rejected":      {headers: "Content-Length: 5\r\nTransfer-Encoding: chunked\r\n", want: http.StatusBadRequest},
+	}
+
+	for name, tc := range testCases {
+		t.Run(name, func(t *testing.T) {
+			conn, err := net.Dial("tcp", fmt.Sprintf("localhost:%d", port))
+			require.NoError(t, err, "Should connect to the server")
+			defer conn.Close()
+			require.NoError(t, conn.SetDeadline(time.Now().Add(5*time.Second)))
+
+			req := "POST /parrot HTTP/1.1\r\nHost: localhost\r\n" + tc.headers + "\r\nhello"
+			_, err = conn.Write([]byte(req))
+			require.NoError(t, err, "Request should be sent without issues")
+
+			resp, err := http.ReadResponse(bufio.NewReader(conn), nil)
+			require.NoError(t, err, "Response should be received")
+			bod, err := io.ReadAll(resp.Body)
+			require.NoError(t, err)
+			resp.Body.Close()
+
+			require.Equal(t, tc.want, resp.StatusCode, "Status code should be as expected")
+			if tc.wantBody != "" {
+				require.Equal(t, tc.wantBody, string(bod), "Body should be as expected")
+			}
+		})
+	}
+}
+
+func TestHeaderNamesIgnoreCase(t *testing.T) {
+	t.Parallel()
+	ctx, cancel := context.WithCancel(context.Background())
+	defer cancel()
+
+	port := test.ReservePort()
+
+	close, err := test.RunServer(ctx, port)
+	require.NoError(t, err, "Server should start without issues")
+	defer close(t.Logf)
+
+	conn, err := net.Dial("tcp", fmt.Sprintf("localhost:%d", port))
+	require.NoError(t, err, "Should connect to the server")
+	defer conn.Close()
+	require.NoError(t, conn.SetDeadline(time.Now().Add(5*time.Second)))
+
+	// Go's client canonicalizes header names, so the request is written by hand
+	req := "POST /parrot HTTP/1.1\r\nhost: localhost\r\ncontent-TYPE: text/plain\r\nCONTENT-length: 5\r\nconnection: CLOSE\r\n\r\nhello"
+	_, err = conn.Write([]byte(req))
+	require.NoError(t, err, "Request should be sent without issues")
+
+	resp, err := http.ReadResponse(bufio.NewReader(conn), nil)
+	require.NoError(t, err, "Response should be received")
+	bod, err := io.ReadAll(resp.Body)
+	require.NoError(t, err)
+
+	require.Equal(t, http.StatusOK, resp.StatusCode, "Status code should be as expected")
+	require.Equal(t, "hello", string(bod), "Body should be as expected")
+	require.Equal(t, "text/plain", resp.Header.Get("Content-Type"), "Content type should be echoed")
+	require.True(t, resp.Close, "Connection should be closed")
+
+	require.NoError(t, close(t.Logf), "Server should stop without issues")
+}
+
+func TestLargeHead(t *testing.T) {
+	t.Parallel()
+	ctx := context.Background()
+
+	testCases := map[string]struct {
+		path     string
+		nheaders int
+		size     int
+		want     int
+	}{
+		"Head larger than the pool is served":  {path: "/hello/world", nheaders: 4, size: 4000, want: http.StatusOK},
+		"Head over the size limit is rejected": {path: "/hello/world", nheaders: 20, size: 4000, want: http.StatusRequestHeaderFieldsTooLarge},
+		"Too many headers are rejected":        {path: "/hello/world", nheaders: 120, size: 1, want: http.StatusRequestHeaderFieldsTooLarge},
+		"Long URI is rejected":                 {path: "/hello/" + strings.Repeat("a", 10000), want: http.StatusRequestURITooLong},
+	}
+
+	for name, tc := range testCases {
+		for _, mode := range []string{"threads", "events", "uring"} {
+			t.Run(fmt.Sprintf("%s/%s", name, mode), func(t *testing.T) {
+				t.Parallel()
+
+				ctx, cancel := context.WithCancel(ctx)
+				defer cancel()
+
+				port := test.ReservePort()
+				addr := fmt.Sprintf("http://localhost:%d", port)
+
+				close, err := test.RunServer(ctx, port, "--mode", mode)
+				require.NoError(t, err, "Server should start without issues")
+				defer close(t.Logf)
+
+				req, err := http.NewRequestWithContext(ctx, http.MethodGet, addr+tc.path, nil)
+				require.NoError(t, err, "Request should be created without issues")
+				for i := 0; i < tc.nheaders; i++ {
+					req.Header.Set(fmt.Sprintf("X-Header-%d", i), strings.Repeat("v", tc.size))
+				}
+
+				resp, err := (&http.Client{Timeout: 5 * time.Second}).Do(req)
+				require.NoError(t, err, "Request should be executed without issues")
+				require.Equal(t, tc.want, resp.StatusCode, "Status code should be as expected")
+				resp.Body.Close()
+
+				require.NoError(t, close(t.Logf), "Server should stop without issues")
+			})
+		}
+	}
+}
+
+func TestStreamingBody(t *testing.T) {
+	t.Parallel()
+	ctx := context.Background()
+
+	for _, mode := range []string{"threads", "events", "uring"} {
+		t.Run(mode, func(t *testing.T) {
+			t.Parallel()
+
+			ctx, cancel := context.WithCancel(ctx)
+			defer cancel()
+
+			port := test.ReservePort()
+			addr := fmt.Sprintf("http://localhost:%d", port)
+
+			close, err := test.RunServer(ctx, port, "--mode", mode)
+			require.NoError(t, err, "Server should start without issues")
+			defer close(t.Logf)
+
+			// Streamed bodies are not limited by --max-body-size
+			const size = 8 * 1024 * 1024
+			body := bytes.NewReader(make([]byte, size))
+			resp, err := (&http.Client{Timeout: 10 * time.Second}).Post(addr+"/upload", "application/octet-stream", body)
+			require.NoError(t, err, "Request should be executed without issues")
+			bod, err := io.ReadAll(resp.Body)
+			require.NoError(t, err)
+			resp.Body.Close()
+
+			require.Equal(t, http.StatusOK, resp.StatusCode, "Status code should be as expected")
+			require.Equal(t, fmt.Sprintf("Received %d bytes\n", size), string(bod), "Every byte should be received")
+
+			// Buffered bodies are rejected as soon as the head announces them
+			conn, err := net.Dial("tcp", fmt.Sprintf("localhost:%d", port))
+			require.NoError(t, err, "Should connect to the server")
+			defer conn.Close()
+			require.NoError(t, conn.SetDeadline(time.Now().Add(5*time.Second)))
+
+			req := fmt.Sprintf("POST /parrot HTTP/1.1\r\nHost: localhost\r\nContent-Length: %d\r\n\r\n", size)
+			_, err = conn.Write([]byte(req))
+			require.NoError(t, err, "Request should be sent without issues")
+
+			resp, err = http.ReadResponse(bufio.NewReader(conn), nil)
+			require.NoError(t, err, "Response should be received before the body is sent")
+			require.Equal(t, http.StatusRequestEntityTooLarge, resp.StatusCode, "Status code should be as expected")
+
+			require.NoError(t, close(t.Logf), "Server should stop without issues")
+		})
+	}
+}
+
+func TestChunkedBody(t *testing.T) {
+	t.Parallel()
+	ctx := context.Background()
+
+	for _, mode := range []string{"threads", "events", "uring"} {
+		t.Run(mode, func(t *testing.T) {
+			t.Parallel()
+
+			ctx, cancel := context.WithCancel(ctx)
+			defer cancel()
+
+			port := test.ReservePort()
+			addr := fmt.Sprintf("http://localhost:%d", port)
+
+			close, err := test.RunServer(ctx, port, "--mode", mode)
+			require.NoError(t, err, "Server should start without issues")
+			defer close(t.Logf)
+
+			// Readers of unknown length are sent chunked
+			want := strings.Repeat("chunked body ", 10000)
+			body := io.MultiReader(strings.NewReader(want[:5000]), strings.NewReader(want[5000:]))
+			req, err := http.NewRequestWithContext(ctx, http.MethodPost, addr+"/parrot", body)
+			require.NoError(t, err, "Request should be created without issues")
+			require.Equal(t, int64(0), req.ContentLength, "Request should have an unknown length")
+
+			resp, err := (&http.Client{Timeout: 5 * time.Second}).Do(req)
+			require.NoError(t, err, "Request should be executed without issues")
+			bod, err := io.ReadAll(resp.Body)
+			require.NoError(t, err)
+			resp.Body.Close()
+
+			require.Equal(t, http.StatusOK, resp.StatusCode, "Status code should be as expected")
+			require.Equal(t, want, string(bod), "Body should be decoded")
+
+			// Extensions and trailers are accepted, and the next request is read
+			conn, err := net.Dial("tcp", fmt.Sprintf("localhost:%d", port))
+			require.NoError(t, err, "Should connect to the server")
+			defer conn.Close()
+			require.NoError(t, conn.SetDeadline(time.Now().Add(5*time.Second)))
+
+			raw := "POST /parrot HTTP/1.1\r\nHost: localhost\r\nTransfer-Encoding: chunked\r\n\r\n" +
+				"5;name=value\r\nhello\r\nA\r\n, world!!!\r\n0\r\nX-Checksum: 1234\r\n\r\n" +
+				"GET /hello/again HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n"
+			_, err = conn.Write([]byte(raw))
+			require.NoError(t, err, "Request should be sent without issues")
+
+			r := bufio.NewReader(conn)
+			for _, want := range []string{"hello, world!!!", "Hello, again!\n"} {
+				resp, err := http.ReadResponse(r, nil)
+				require.NoError(t, err, "Response should be received")
+				bod, err := io.ReadAll(resp.Body)
+				require.NoError(t, err)
+				require.Equal(t, http.StatusOK, resp.StatusCode, "Status code should be as expected")
+				require.Equal(t, want, string(bod), "Body should be as expected")
+			}
+
+			// A chunk size that would wrap around is too large, not small
+			huge, err := net.Dial("tcp", fmt.Sprintf("localhost:%d", port))
+			require.NoError(t, err, "Should connect to the server")
+			defer huge.Close()
+			require.NoError(t, huge.SetDeadline(time.Now().Add(5*time.Second)))
+
+			raw = "POST /parrot HTTP/1.1\r\nHost: localhost\r\nTransfer-Encoding: chunked\r\n\r\n" +
+				"5\r\nhello\r\nffffffffffffffff\r\n"
+			_, err = huge.Write([]byte(raw))
+			require.NoError(t, err, "Request should be sent without issues")
+			// The server may stop reading at any point
+			_, _ = huge.Write([]byte(strings.Repeat("x", 300*1024)))
+
+			resp, err = http.ReadResponse(bufio.NewReader(huge), nil)
+			require.NoError(t, err, "Response should be received")
+			resp.Body.Close()
+			require.Equal(t, http.StatusRequestEntityTooLarge, resp.StatusCode, "Status code should be as expected")
+
+			require.NoError(t, close(t.Logf), "Server should stop without issues")
+		})
+	}
+}
+
+func TestStreamingResponse(t *testing.T) {
+	t.Parallel()
+	ctx := context.Background()
+
+	for _, mode := range []string{"threads", "events", "uring"} {
+		t.Run(mode, func(t *testing.T) {
+			t.Parallel()
+
+			ctx, cancel := context.WithCancel(ctx)
+			defer cancel()
+
+			port := test.ReservePort()
+
+			close, err := test.RunServer(ctx, port, "--mode", mode)
+			require.NoError(t, err, "Server should start without issues")
+			defer close(t.Logf)
+
+			var want strings.Builder
+			for i := 1; i <= 100000; i++ {
+				fmt.Fprintf(&want, "%d\n", i)
+			}
+
+			conn, err := net.Dial("tcp", fmt.Sprintf("localhost:%d", port))
+			require.NoError(t, err, "Should connect to the server")
+			defer conn.Close()
+			require.NoError(t, conn.SetDeadline(time.Now().Add(10*time.Second)))
+
+			// The request after the streamed response waits for it to end
+			req := "GET /numbers/100000 HTTP/1.1\r\nHost: localhost\r\n\r\n" +
+				"GET /hello/after HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n"
+			_, err = conn.Write([]byte(req))
+			require.NoError(t, err, "Request should be sent without issues")
+
+			r := bufio.NewReader(conn)
+			resp, err := http.ReadResponse(r, nil)
+			require.NoError(t, err, "Response should be received")
+			bod, err := io.ReadAll(resp.Body)
+			require.NoError(t, err)
+
+			require.Equal(t, http.StatusOK, resp.StatusCode, "Status code should be as expected")
+			require.Equal(t, []string{"chunked"}, resp.TransferEncoding, "Body should be chunked")
+			require.Equal(t, want.String(), string(bod), "Body should be as expected")
+
+			resp, err = http.ReadResponse(r, nil)
+			require.NoError(t, err, "Response should be received")
+			bod, err = io.ReadAll(resp.Body)
+			require.NoError(t, err)
+			require.Equal(t, "Hello, after!\n", string(bod), "Body should be as expected")
+
+			require.NoError(t, close(t.Logf), "Server should stop without issues")
+		})
+	}
+}
+
+func TestStaticFiles(t *testing.T) {
+	t.Parallel()
+	ctx := context.Background()
+
+	dir := t.TempDir()
+	big := bytes.Repeat([]byte("0123456789abcdef"), 256*1024)
+	require.NoError(t, os.WriteFile(filepath.Join(dir, "index.html"), []byte("<h1>Index</h1>"), 0600))
+	require.NoError(t, os.WriteFile(filepath.Join(dir, "style.css"), []byte("body {}"), 0600))
+	require.NoError(t, os.WriteFile(filepath.Join(dir, "big.bin"), big, 0600))
+	require.NoError(t, os.WriteFile(filepath.Join(dir, ".secret"), []byte("secret"), 0600))
+	require.NoError(t, os.Symlink("/etc/passwd", filepath.Join(dir, "passwd")))
+
+	var compressed bytes.Buffer
+	w := gzip.NewWriter(&compressed)
+	_, err := w.Write([]byte("body {}"))
+	require.NoError(t, err)
+	require.NoError(t, w.Close())
+	require.NoError(t, os.WriteFile(filepath.Join(dir, "style.css.gz"), compressed.Bytes(), 0600))
+
+	for _, mode := range []string{"threads", "events", "uring"} {
+		t.Run(mode, func(t *testing.T) {
+			t.Parallel()
+
+			ctx, cancel := context.WithCancel(ctx)
+			defer cancel()
+
+			port := test.ReservePort()
+			addr := fmt.Sprintf("http://localhost:%d", port)
+
+			close, err := test.RunServer(ctx, port, "--mode", mode, "--static-dir", dir)
+			require.NoError(t, err, "Server should start without issues")
+			defer close(t.Logf)
+
+			testCases := map[string]struct {
+				path        string
+				contentType string
+				body        []byte
+			}{
+				"Index":  {path: "/static/", contentType: "text/html; charset=utf-8", body: []byte("<h1>Index</h1>")},
+				"Css":    {path: "/static/style.css", contentType: "text/css; charset=utf-8", body: []byte("body {}")},
+				"Binary": {path: "/static/big.bin", contentType: "application/octet-stream", body: big},
+			}
+
+			for name, tc := range testCases {
+				// Twice, the second time from the cache
+				for i := 0; i < 2; i++ {
+					resp, err := http.Get(addr + tc.path)
+					require.NoError(t, err, "%s: GET should not fail", name)
+					bod, err := io.ReadAll(resp.Body)
+					resp.Body.Close()
+					require.NoError(t, err)
+
+					require.Equal(t, http.StatusOK, resp.StatusCode, "%s: Status code should be as expected", name)
+					require.Equal(t, tc.contentType, resp.Header.Get("Content-Type"), "%s: Content type should be as expected", name)
+					require.Equal(t, tc.body, bod, "%s: Body should be as expected", name)
+				}
+			}
+
+			// Precompressed siblings are sent as they are
+			req, err := http.NewRequest(http.MethodGet, addr+"/static/style.css", nil)
+			require.NoError(t, err)
+			req.Header.Set("Accept-Encoding", "gzip")
+			resp, err := http.DefaultClient.Do(req)
+			require.NoError(t, err, "GET should not fail")
+			bod, err := io.ReadAll(resp.Body)
+			resp.Body.Close()
+			require.NoError(t, err)
+			require.Equal(t, "gzip", resp.Header.Get("Content-Encoding"), "Precompressed file should be sent")
+			require.Equal(t, compressed.Bytes(), bod, "Body should be the precompressed file")
+
+			// Raw requests, so that the client does not clean the paths up
+			for _, path := range []string{"/static/../Makefile", "/static/%2e%2e/Makefile",
+				"/static/%2Fetc%2Fpasswd", "/static/.secret", "/static/passwd", "/static/missing"} {
+				conn, err := net.Dial("tcp", fmt.Sprintf("localhost:%d", port))
+				require.NoError(t, err, "Should connect to the server")
+				req := fmt.Sprintf("GET %s HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n", path)
+				_, err = conn.Write([]byte(req))
+				require.NoError(t, err, "Request should be sent without issues")
+
+				resp, err := http.ReadResponse(bufio.NewReader(conn), nil)
+				require.NoError(t, err, "Response should be received")
+				conn.Close()
+				require.Equal(t, http.StatusNotFound, resp.StatusCode, "%s should not be served", path)
+			}
+
+			require.NoError(t, close(t.Logf), "Server should stop without issues")
+		})
+	}
+}
+
+func TestCompression(t *testing.T) {
+	t.Parallel()
+	ctx := context.Background()
+
+	var text strings.Builder
+	for i := 0; i < 10000; i++ {
+		fmt.Fprintf(&text, "line %d of a body that compresses well\n", i)
+	}
+
+	var numbers strings.Builder
+	for i := 1; i <= 100000; i++ {
+		fmt.Fprintf(&numbers, "%d\n", i)
+	}
+
+	for _, mode := range []string{"threads", "events", "uring"} {
+		t.Run(mode, func(t *testing.T) {
+			t.Parallel()
+
+			ctx, cancel := context.WithCancel(ctx)
+			defer cancel()
+
+			port := test.ReservePort()
+			addr := fmt.Sprintf("http://localhost:%d", port)
+
+			close, err := test.RunServer(ctx, port, "--mode", mode)
+			require.NoError(t, err, "Server should start without issues")
+			defer close(t.Logf)
+
+			testCases := map[string]struct {
+				path           string
+				body           string
+				acceptEncoding string
+				wantEncoding   string
+			}{
+				"Gzip":                  {body: text.String(), acceptEncoding: "gzip", wantEncoding: "gzip"},
+				"Deflate":               {body: text.String(), acceptEncoding: "deflate", wantEncoding: "deflate"},
+				"Preferred by quality":  {body: text.String(), acceptEncoding: "gzip;q=0.5, deflate", wantEncoding: "deflate"},
+				"Unsupported encodings": {body: text.String(), acceptEncoding: "br", wantEncoding: ""},
+				"No encodings":          {body: text.String(), acceptEncoding: "", wantEncoding: ""},
+				"Small body":            {body: "Hello!", acceptEncoding: "gzip", wantEncoding: ""},
+				"Streamed gzip":         {path: "/numbers/100000", body: numbers.String(), acceptEncoding: "gzip", wantEncoding: "gzip"},
+				"Streamed deflate":      {path: "/numbers/100000", body: numbers.String(), acceptEncoding: "deflate", wantEncoding: "deflate"},
+			}
+
+			for name, tc := range testCases {
+				// Streamed bodies are produced by the route, the others echoed
+				var req *http.Request
+				if tc.path != "" {
+					req, err = http.NewRequest(http.MethodGet, addr+tc.path, nil)
+				} else {
+					req, err = http.NewRequest(http.MethodPost, addr+"/parrot", strings.NewReader(tc.body))
+				}
+				require.NoError(t, err)
+				req.Header.Set("Content-Type", "text/plain")
+				if tc.acceptEncoding != "" {
+					// Setting it keeps the client from decompressing the body
+					req.Header.Set("Accept-Encoding", tc.acceptEncoding)
+				} else {
+					req.Header.Set("Accept-Encoding", "identity")
+				}
+
+				resp, err := http.DefaultClient.Do(req)
+				require.NoError(t, err, "%s: POST should not fail", name)
+				defer resp.Body.Close()
+				require.Equal(t, http.StatusOK, resp.StatusCode, "%s: Status code should be as expected", name)
+				require.Equal(t, tc.wantEncoding, resp.Header.Get("Content-Encoding"), "%s: Encoding should be as expected", name)
+
+				var r io.Reader = resp.Body
+				switch tc.wantEncoding {
+				case "gzip":
+					r, err = gzip.NewReader(resp.Body)
+					require.NoError(t, err, "%s: Body should be gzip", name)
+				case "deflate":
+					r, err = zlib.NewReader(resp.Body)
+					require.NoError(t, err, "%s: Body should be deflate", name)
+				}
+
+				bod, err := io.ReadAll(r)
+				require.NoError(t, err, "%s: Body should decompress", name)
+				require.Equal(t, tc.body, string(bod), "%s: Body should be as expected", name)
+			}
+
+			require.NoError(t, close(t.Logf), "Server should stop without issues")
+		})
+	}
+}
+
+func TestFrozenResponses(t *testing.T) {
+	t.Parallel()
+	ctx := context.Background()
+
+	for _, mode := range []string{"threads", "events", "uring"} {
+		t.Run(mode, func(t *testing.T) {
+			t.Parallel()
+
+			ctx, cancel := context.WithCancel(ctx)
+			defer cancel()
+
+			port := test.ReservePort()
+
+			close, err := test.RunServer(ctx, port, "--mode", mode)
+			require.NoError(t, err, "Server should start without issues")
+			defer close(t.Logf)
+
+			conn, err := net.Dial("tcp", fmt.Sprintf("localhost:%d", port))
+			require.NoError(t, err, "Should connect to the server")
+			defer conn.Close()
+			require.NoError(t, conn.SetDeadline(time.Now().Add(5*time.Second)))
+
+			// The same prebuilt responses answer every request, with the
+			// Connection header of each spliced in
+			req := "GET /home HTTP/1.1\r\nHost: localhost\r\n\r\n" +
+				"HEAD /missing HTTP/1.1\r\nHost: localhost\r\n\r\n" +
+				"GET /missing HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n"
+			_, err = conn.Write([]byte(req))
+			require.NoError(t, err, "Request should be sent without issues")
+
+			testCases := []struct {
+				method string
+				status int
+				body   string
+				close  bool
+			}{
+				{method: http.MethodGet, status: http.StatusOK, body: "<html><title>Home</title>"},
+				{method: http.MethodHead, status: http.StatusNotFound, body: ""},
+				{method: http.MethodGet, status: http.StatusNotFound, body: "404 Not Found\n", close: true},
+			}
+
+			r := bufio.NewReader(conn)
+			for i, tc := range testCases {
+				resp, err := http.ReadResponse(r, &http.Request{Method: tc.method})
+				require.NoError(t, err, "Response %d should be received", i)
+				bod, err := io.ReadAll(resp.Body)
+				require.NoError(t, err)
+
+				require.Equal(t, tc.status, resp.StatusCode, "Response %d: Status code should be as expected", i)
+				require.True(t, strings.HasPrefix(string(bod), tc.body), "Response %d: Body should be as expected", i)
+				require.Equal(t, tc.close, resp.Close, "Response %d: Connection should be as expected", i)
+			}
+
+			require.NoError(t, close(t.Logf), "Server should stop without issues")
+		})
+	}
+}
+
+func TestDateHeader(t *testing.T) {
+	t.Parallel()
+	ctx := context.Background()
+
+	for _, mode := range []string{"threads", "events", "uring"} {
+		t.Run(mode, func(t *testing.T) {
+			t.Parallel()
+
+			ctx, cancel := context.WithCancel(ctx)
+			defer cancel()
+
+			port := test.ReservePort()
+			addr := fmt.Sprintf("http://localhost:%d", port)
+
+			close, err := test.RunServer(ctx, port, "--mode", mode)
+			require.NoError(t, err, "Server should start without issues")
+			defer close(t.Logf)
+
+			// Built by handlers, frozen ahead of time, and rejected
+			for _, path := range []string{"/hello/date", "/home", "/missing"} {
+				before := time.Now().Add(-time.Second)
+				resp, err := http.Get(addr + path)
+				require.NoError(t, err, "GET %s should not fail", path)
+				resp.Body.Close()
+				after := time.Now().Add(time.Second)
+
+				date, err := http.ParseTime(resp.Header.Get("Date"))
+				require.NoError(t, err, "%s: Date should be an HTTP-date", path)
+				require.True(t, date.After(before) && date.Before(after), "%s: Date should be the current time", path)
+			}
+
+			require.NoError(t, close(t.Logf), "Server should stop without issues")
+		})
+	}
+}
+
+func TestConditionalGet(t *testing.T) {
+	t.Parallel()
+	ctx := context.Background()
+
+	dir := t.TempDir()
+	require.NoError(t, os.WriteFile(filepath.Join(dir, "file.txt"), []byte("Some file"), 0600))
+
+	for _, mode := range []string{"threads", "events", "uring"} {
+		t.Run(mode, func(t *testing.T) {
+			t.Parallel()
+
+			ctx, cancel := context.WithCancel(ctx)
+			defer cancel()
+
+			port := test.ReservePort()
+			addr := fmt.Sprintf("http://localhost:%d", port)
+
+			close, err := test.RunServer(ctx, port, "--mode", mode, "--static-dir", dir)
+			require.NoError(t, err, "Server should start without issues")
+			defer close(t.Logf)
+
+			get := func(path string, header map[string]string) (*http.Response, []byte) {
+				req, err := http.NewRequest(http.MethodGet, addr+path, nil)
+				require.NoError(t, err)
+				for k, v := range header {
+					req.Header.Set(k, v)
+				}
+				resp, err := http.DefaultClient.Do(req)
+				require.NoError(t, err, "GET %s should not fail", path)
+				bod, err := io.ReadAll(resp.Body)
+				resp.Body.Close()
+				require.NoError(t, err)
+				return resp, bod
+			}
+
+			// Hashed bodies, frozen responses and files
+			for _, path := range []string{"/hello/tag", "/home", "/static/file.txt"} {
+				resp, bod := get(path, nil)
+				require.Equal(t, http.StatusOK, resp.StatusCode, "%s: Status code should be as expected", path)
+				etag := resp.Header.Get("ETag")
+				require.NotEmpty(t, etag, "%s: Response should be tagged", path)
+
+				resp, bod2 := get(path, map[string]string{"If-None-Match": `"other", ` + etag})
+				require.Equal(t, http.StatusNotModified, resp.StatusCode, "%s: Matching tag should not be sent again", path)
+				require.Empty(t, bod2, "%s: Not modified response should have no body", path)
+				require.Equal(t, etag, resp.Header.Get("ETag"), "%s: Tag should be sent with 304", path)
+
+				resp, bod2 = get(path, map[string]string{"If-None-Match": `"other"`})
+				require.Equal(t, http.StatusOK, resp.StatusCode, "%s: Other tag should get the body", path)
+				require.Equal(t, bod, bod2, "%s: Body should be as expected", path)
+			}
+
+			// Files also carry their modification time
+			resp, _ := get("/static/file.txt", nil)
+			lastModified := resp.Header.Get("Last-Modified")
+			require.NotEmpty(t, lastModified, "File should have a modification time")
+
+			resp, _ = get("/static/file.txt", map[string]string{"If-Modified-Since": lastModified})
+			require.Equal(t, http.StatusNotModified, resp.StatusCode, "Unmodified file should not be sent again")
+
+			resp, _ = get("/static/file.txt", map[string]string{"If-Modified-Since": "Thu, 01 Jan 1970 00:00:00 GMT"})
+			require.Equal(t, http.StatusOK, resp.StatusCode, "Modified file should be sent")
+
+			require.NoError(t, close(t.Logf), "Server should stop without issues")
+		})
+	}
+}
+
+func TestRangeRequests(t *testing.T) {
+	t.Parallel()
+	ctx := context.Background()
+
+	dir := t.TempDir()
+	big := bytes.Repeat([]byte("0123456789abcdef"), 64*1024)
+	require.NoError(t, os.WriteFile(filepath.Join(dir, "big.bin"), big, 0600))
+
+	for _, mode := range []string{"threads", "events", "uring"} {
+		t.Run(mode, func(t *testing.T) {
+			t.Parallel()
+
+			ctx, cancel := context.WithCancel(ctx)
+			defer cancel()
+
+			port := test.ReservePort()
+			addr := fmt.Sprintf("http://localhost:%d", port)
+
+			close, err := test.RunServer(ctx, port, "--mode", mode, "--static-dir", dir)
+			require.NoError(t, err, "Server should start without issues")
+			defer close(t.Logf)
+
+			get := func(path string, header map[string]string) (*http.Response, []byte) {
+				req, err := http.NewRequest(http.MethodGet, addr+path, nil)
+				require.NoError(t, err)
+				for k, v := range header {
+					req.Header.Set(k, v)
+				}
+				resp, err := http.DefaultClient.Do(req)
+				require.NoError(t, err, "GET %s should not fail", path)
+				bod, err := io.ReadAll(resp.Body)
+				resp.Body.Close()
+				require.NoError(t, err)
+				return resp, bod
+			}
+
+			hello := []byte("Hello, world!\n")
+			testCases := map[string]struct {
+				path         string
+				rangeHeader  string
+				status       int
+				contentRange string
+				body         []byte
+			}{
+				"File":          {path: "/static/big.bin", rangeHeader: "bytes=100-199", status: http.StatusPartialContent, contentRange: "bytes 100-199/1048576", body: big[100:200]},
+				"FileOpenEnded": {path: "/static/big.bin", rangeHeader: "bytes=1048000-", status: http.StatusPartialContent, contentRange: "bytes 1048000-1048575/1048576", body: big[1048000:]},
+				"FileSuffix":    {path: "/static/big.bin", rangeHeader: "bytes=-10", status: http.StatusPartialContent, contentRange: "bytes 1048566-1048575/1048576", body: big[1048566:]},
+				"Buffered":      {path: "/hello/world", rangeHeader: "bytes=7-11", status: http.StatusPartialContent, contentRange: "bytes 7-11/14", body: hello[7:12]},
+				"Unsatisfiable": {path: "/static/big.bin", rangeHeader: "bytes=2000000-", status: http.StatusRequestedRangeNotSatisfiable, contentRange: "bytes */1048576", body: []byte{}},
+				"Malformed":     {path: "/hello/world", rangeHeader: "bytes=abc", status: http.StatusOK, body: hello},
+				"NotBytes":      {path: "/hello/world", rangeHeader: "lines=1-2", status: http.StatusOK, body: hello},
+				"Adjacent":      {path: "/static/big.bin", rangeHeader: "bytes=100-149,150-199", status: http.StatusPartialContent, contentRange: "bytes 100-199/1048576", body: big[100:200]},
+				"Overlapping":   {path: "/static/big.bin", rangeHeader: "bytes=120-199,100-150", status: http.StatusPartialContent, contentRange: "bytes 100-199/1048576", body: big[100:200]},
+				"MoreThanWhole": {path: "/hello/world", rangeHeader: "bytes=0-9,5-13", status: http.StatusOK, body: hello},
+			}
+
+			for name, tc := range testCases {
+				resp, bod := get(tc.path, map[string]string{"Range": tc.rangeHeader})
+				require.Equal(t, tc.status, resp.StatusCode, "%s: Status code should be as expected", name)
+				require.Equal(t, tc.contentRange, resp.Header.Get("Content-Range"), "%s: Content range should be as expected", name)
+				require.Equal(t, tc.body, bod, "%s: Body should be as expected", name)
+			}
+
+			// Several ranges come as parts of a multipart body, in order and merged
+			for _, path := range []string{"/static/big.bin", "/hello/world"} {
+				resp, bod := get(path, map[string]string{"Range": "bytes=7-9,0-4,1-2"})
+				require.Equal(t, http.StatusPartialContent, resp.StatusCode, "%s: Status code should be as expected", path)
+				mediaType, params, err := mime.ParseMediaType(resp.Header.Get("Content-Type"))
+				require.NoError(t, err, "%s: Content type should be valid", path)
+				require.Equal(t, "multipart/byteranges", mediaType, "%s: Body should be multipart", path)
+
+				whole := big
+				if path == "/hello/world" {
+					whole = hello
+				}
+
+				r := multipart.NewReader(bytes.NewReader(bod), params["boundary"])
+				for _, want := range [][2]int{{0, 4}, {7, 9}} {
+					part, err := r.NextPart()
+					require.NoError(t, err, "%s: Part should be received", path)
+					data, err := io.ReadAll(part)
+					require.NoError(t, err)
+					require.Equal(t, fmt.Sprintf("bytes %d-%d/%d", want[0], want[1], len(whole)), part.Header.Get("Content-Range"), "%s: Part range should be as expected", path)
+					require.Equal(t, whole[want[0]:want[1]+1], data, "%s: Part should be as expected", path)
+				}
+				_, err = r.NextPart()
+				require.Equal(t, io.EOF, err, "%s: There should be no more parts", path)
+			}
+
+			// Resuming only makes sense if the file is the same
+			resp, _ := get("/static/big.bin", nil)
+			require.Equal(t, "bytes", resp.Header.Get("Accept-Ranges"), "Files should accept ranges")
+			etag := resp.Header.Get("ETag")
+
+			resp, bod := get("/static/big.bin", map[string]string{"Range": "bytes=10-19", "If-Range": etag})
+			require.Equal(t, http.StatusPartialContent, resp.StatusCode, "Same file should be resumed")
+			require.Equal(t, big[10:20], bod, "Body should be as expected")
+
+			resp, bod = get("/static/big.bin", map[string]string{"Range": "bytes=10-19", "If-Range": `"other"`})
+			require.Equal(t, http.StatusOK, resp.StatusCode, "Changed file should be sent whole")
+			require.Equal(t, big, bod, "Body should be as expected")
+
+			require.NoError(t, close(t.Logf), "Server should stop without issues")
+		})
+	}
+}
+
+func TestResponseCache(t *testing.T) {
+	t.Parallel()
+	ctx := context.Background()
+
+	type response struct {
+		body  string
+		cache string
+		err   error
+	}
+
+	get := func(addr string, header map[string]string) response {
+		req, err := http.NewRequest(http.MethodGet, addr, nil)
+		if err != nil {
+			return response{err: err}
+		}
+		for k, v := range header {
+			req.Header.Set(k, v)
+		}
+		resp, err := (&http.Client{Timeout: 10 * time.Second}).Do(req)
+		if err != nil {
+			return response{err: err}
+		}
+		defer resp.Body.Close()
+		bod, err := io.ReadAll(resp.Body)
+		return response{body: string(bod), cache: resp.Header.Get("X-Cache"), err: err}
+	}
+
+	for _, mode := range []string{"threads", "events", "uring"} {
+		t.Run(mode, func(t *testing.T) {
+			t.Parallel()
+
+			ctx, cancel := context.WithCancel(ctx)
+			defer cancel()
+
+			port := test.ReservePort()
+			addr := fmt.Sprintf("http://localhost:%d", port)
+
+			close, err := test.RunServer(ctx, port, "--mode", mode, "--threads", "4")
+			require.NoError(t, err, "Server should start without issues")
+			defer close(t.Logf)
+
+			// Concurrent misses wait for the one running the handler
+			const nrequests = 8
+			ch := make(chan response)
+			for i := 0; i < nrequests; i++ {
+				go func() { ch <- get(addr+"/report/concurrent", nil) }()
+			}
+
+			misses := 0
+			for i := 0; i < nrequests; i++ {
+				r := <-ch
+				require.NoError(t, r.err, "Request %d should not fail", i)
+				require.Equal(t, "Report #1 for concurrent\n", r.body, "Request %d: Report should be built once", i)
+				if r.cache == "MISS" {
+					misses++
+				}
+			}
+			require.Equal(t, 1, misses, "Only one request should miss")
+
+			r := get(addr+"/report/concurrent", nil)
+			require.NoError(t, r.err)
+			require.Equal(t, "HIT", r.cache, "Report should be cached")
+			require.Equal(t, "Report #1 for concurrent\n", r.body, "Cached report should be sent")
+
+			// Headers the route varies on are part of the key
+			r = get(addr+"/report/concurrent", map[string]string{"Accept-Language": "fr"})
+			require.NoError(t, r.err)
+			require.Equal(t, "MISS", r.cache, "Other language should not be cached yet")
+			require.Equal(t, "Report #2 for concurrent in fr\n", r.body, "Report should be built again")
+
+			require.NoError(t, close(t.Logf), "Server should stop without issues")
+		})
+	}
+
+	// Entries over the budget are evicted right away
+	t.Run("eviction", func(t *testing.T) {
+		t.Parallel()
+
+		ctx, cancel := context.WithCancel(ctx)
+		defer cancel()
+
+		port := test.ReservePort()
+		addr := fmt.Sprintf("http://localhost:%d", port)
+
+		close, err := test.RunServer(ctx, port, "--cache-size", "1")
+		require.NoError(t, err, "Server should start without issues")
+		defer close(t.Logf)
+
+		for i := 1; i <= 2; i++ {
+			r := get(addr+"/report/evicted", nil)
+			require.NoError(t, r.err)
+			require.Equal(t, "MISS", r.cache, "Request %d: Report should not fit", i)
+			require.Equal(t, fmt.Sprintf("Report #%d for evicted\n", i), r.body, "Request %d: Report should be built again", i)
+		}
+
+		require.NoError(t, close(t.Logf), "Server should stop without issues")
+	})
+}
+
+func TestAsyncHandler(t *testing.T) {
+	t.Parallel()
+	ctx := context.Background()
+
+	for _, mode := range []string{"threads", "events", "uring"} {
+		t.Run(mode, func(t *testing.T) {
+			t.Parallel()
+
+			ctx, cancel := context.WithCancel(ctx)
+			defer cancel()
+
+			port := test.ReservePort()
+			addr := fmt.Sprintf("http://localhost:%d", port)
+
+			close, err := test.RunServer(ctx, port, "--mode", mode, "--threads", "1")
+			require.NoError(t, err, "Server should start without issues")
+			defer close(t.Logf)
+
+			// Requests after a suspended one wait for its response
+			conn, err := net.Dial("tcp", fmt.Sprintf("localhost:%d", port))
+			require.NoError(t, err, "Should connect to the server")
+			defer conn.Close()
+			require.NoError(t, conn.SetDeadline(time.Now().Add(5*time.Second)))
+
+			reqs := "POST /sleep HTTP/1.1\r\nHost: localhost\r\nContent-Length: 0\r\n\r\n" +
+				"GET /hello/world HTTP/1.1\r\nHost: localhost\r\n\r\n"
+			_, err = conn.Write([]byte(reqs))
+			require.NoError(t, err, "Requests should be sent without issues")
+
+			r := bufio.NewReader(conn)
+			for i, want := range []string{"Sleeping for 1 second\n", "Hello, world!\n"} {
+				resp, err := http.ReadResponse(r, nil)
+				require.NoError(t, err, "Response %d should be received", i)
+				bod, err := io.ReadAll(resp.Body)
+				require.NoError(t, err)
+				require.Equal(t, http.StatusOK, resp.StatusCode, "Response %d: status code should be OK", i)
+				require.Equal(t, want, string(bod), "Response %d: body should be as expected", i)
+			}
+
+			// A single thread waits for every sleep at once, and serves others
+			// meanwhile
+			const nrequests = 8
+			ch := make(chan error)
+			started := time.Now()
+			for i := 0; i < nrequests; i++ {
+				go func() {
+					resp, err := (&http.Client{Timeout: 10 * time.Second}).Post(addr+"/sleep", "text/plain", nil)
+					if err != nil {
+						ch <- err
+						return
+					}
+					resp.Body.Close()
+					if resp.StatusCode != http.StatusOK {
+						ch <- fmt.Errorf("status code should be OK: %d", resp.StatusCode)
+						return
+					}
+					ch <- nil
+				}()
+			}
+
+			time.Sleep(100 * time.Millisecond)
+			resp, err := (&http.Client{Timeout: 10 * time.Second}).Get(addr + "/hello/world")
+			require.NoError(t, err, "Request should be served while others sleep")
+			resp.Body.Close()
+			require.Less(t, time.Since(started), 500*time.Millisecond, "Request should not wait for the sleeps")
+
+			for i := 0; i < nrequests; i++ {
+				require.NoError(t, <-ch, "Response %d", i)
+			}
+			require.Less(t, time.Since(started), 3*time.Second, "Sleeps should overlap")
+
+			require.NoError(t, close(t.Logf), "Server should stop without issues")
+		})
+	}
+}
+
+func TestSharding(t *testing.T) {
+	t.Parallel()
+	ctx := context.Background()
+
+	for _, mode := range []string{"threads", "events", "uring"} {
+		t.Run(mode, func(t *testing.T) {
+			t.Parallel()
+
+			ctx, cancel := context.WithCancel(ctx)
+			defer cancel()
+
+			port := test.ReservePort()
+			addr := fmt.Sprintf("http://localhost:%d", port)
+
+			close, err := test.RunServer(ctx, port, "--mode", mode, "--shards", "4")
+			require.NoError(t, err, "Server should start without issues")
+			defer close(t.Logf)
+
+			const nrequests = 32
+			for i := 0; i < nrequests; i++ {
+				// A new connection every time, so that they are spread across shards
+				client := &http.Client{
+					Timeout:   5 * time.Second,
+					Transport: &http.Transport{DisableKeepAlives: true},
+				}
+
+				resp, err := client.Get(addr + "/home")
+				require.NoError(t, err, "Request %d should be executed without issues", i)
+				require.Equal(t, http.StatusOK, resp.StatusCode, "Status code should be as expected")
+				resp.Body.Close()
+			}
+
+			require.NoError(t, close(t.Logf), "Server should stop without issues")
+		})
+	}
+}
@@ -27,13 +27,14 @@ func ReservePort() uint {
 	return p
 }
 
-func RunServer(ctx context.Context, port uint) (func(func(string, ...any)) error, error) {
+func RunServer(ctx context.Context, port uint, args ...string) (func(func(string, ...any)) error, error) {
 	r, stdout := io.Pipe()
 
 	var errR bytes.Buffer
 	initR := io.TeeReader(r, &errR)
 
-	cmd := exec.CommandContext(ctx, "../build/server", "--port", fmt.Sprint(port))
+	args = append([]string{"--port", fmt.Sprint(port)}, args...)
+	cmd := exec.CommandContext(ctx, "../build/server", args...)
 	cmd.Stdout = stdout
 	cmd.Stderr = stdout
 